@@ -0,0 +1,229 @@
+#include "VirtualRig.hpp"
+
+#include <thread>
+
+namespace vt
+{
+
+	using namespace std::chrono;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	RigProperties RigProperties::Typical()
+	{
+		RigProperties properties;
+		properties.display_resolution = cv::Size(1280, 720);
+		properties.camera_resolution = cv::Size(640, 480);
+
+		properties.camera_matrix = cv::Matx33d(
+			600.0,   0.0, 320.0,
+			  0.0, 600.0, 240.0,
+			  0.0,   0.0,   1.0
+		);
+		properties.distortion = {-0.12, 0.04, 0.0, 0.0, 0.0};
+
+		// The display fills most of the view, seen from slightly above and to the right.
+		const cv::Point2f display_corners[4] = {
+			{0.0f, 0.0f}, {1280.0f, 0.0f}, {1280.0f, 720.0f}, {0.0f, 720.0f}
+		};
+		const cv::Point2f camera_corners[4] = {
+			{90.0f, 80.0f}, {560.0f, 60.0f}, {590.0f, 400.0f}, {60.0f, 420.0f}
+		};
+		properties.homography = cv::getPerspectiveTransform(display_corners, camera_corners);
+
+		// Channels are in BGR order, as in the rest of the pipeline.
+		properties.crosstalk = cv::Matx33d(
+			0.90, 0.06, 0.02,
+			0.05, 0.92, 0.05,
+			0.02, 0.06, 0.88
+		);
+		return properties;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	VirtualRig::VirtualRig(const RigProperties& properties)
+		: m_Properties(properties),
+		  m_RNG(properties.seed)
+	{
+		CV_Assert(!properties.display_resolution.empty() && !properties.camera_resolution.empty());
+		CV_Assert(properties.framerate > 0 && properties.display_latency >= 0);
+
+		const auto& resolution = properties.camera_resolution;
+		m_CameraProperties[cv::CAP_PROP_FPS] = properties.framerate;
+		m_CameraProperties[cv::CAP_PROP_FRAME_WIDTH] = resolution.width;
+		m_CameraProperties[cv::CAP_PROP_FRAME_HEIGHT] = resolution.height;
+		m_CameraProperties[cv::CAP_PROP_EXPOSURE] = 0.0;
+		m_CameraProperties[cv::CAP_PROP_GAIN] = 0.0;
+
+		// Find where each camera pixel looks on the display, by undoing the lens
+		// distortion and then the homography, so that frames are a single remap.
+		std::vector<cv::Point2f> camera_points, ideal_points, display_points;
+		camera_points.reserve(resolution.area());
+		for(int r = 0; r < resolution.height; r++)
+			for(int c = 0; c < resolution.width; c++)
+				camera_points.emplace_back(c, r);
+
+		cv::undistortPoints(camera_points, ideal_points, properties.camera_matrix, properties.distortion, cv::noArray(), properties.camera_matrix);
+		cv::perspectiveTransform(ideal_points, display_points, properties.homography.inv());
+		cv::Mat(display_points).reshape(2, resolution.height).copyTo(m_DisplayMap);
+
+		// The vignetting falls off with the square of the distance from the principal point.
+		const cv::Point2d centre(properties.camera_matrix(0, 2), properties.camera_matrix(1, 2));
+		const double max_radius = std::max({
+			cv::norm(centre),
+			cv::norm(centre - cv::Point2d(resolution.width, 0)),
+			cv::norm(centre - cv::Point2d(0, resolution.height)),
+			cv::norm(centre - cv::Point2d(resolution.width, resolution.height))
+		});
+
+		m_Vignette.create(resolution, CV_32FC3);
+		m_Vignette.forEach<cv::Vec3f>([&](cv::Vec3f& gain, const int position[2]) {
+			const double radius = cv::norm(cv::Point2d(position[1], position[0]) - centre) / max_radius;
+			gain = cv::Vec3f::all(static_cast<float>(1.0 - properties.vignetting * radius * radius));
+		});
+
+		m_NextFrame = steady_clock::now();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const RigProperties& VirtualRig::properties() const
+	{
+		return m_Properties;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void VirtualRig::display(const cv::Mat& image)
+	{
+		CV_Assert(image.depth() == CV_8U && (image.channels() == 1 || image.channels() == 3));
+
+		cv::Mat colour_image;
+		if(image.channels() == 1)
+			cv::cvtColor(image, colour_image, cv::COLOR_GRAY2BGR);
+		else
+			colour_image = image;
+
+		// Linearize the display colours at the image's own resolution, before
+		// it is stretched across the display, as the images are often tiny.
+		cv::Mat gamma_table(1, 256, CV_32FC3);
+		for(int i = 0; i < 256; i++)
+		{
+			for(int k = 0; k < 3; k++)
+				gamma_table.at<cv::Vec3f>(i)[k] = static_cast<float>(std::pow(i / 255.0, m_Properties.display_gamma[k]));
+		}
+
+		cv::Mat linear, mixed;
+		cv::LUT(colour_image, gamma_table, linear);
+		cv::transform(linear, mixed, cv::Matx33f(m_Properties.crosstalk));
+
+		DisplayedImage displayed = {m_FramesCaptured, cv::Mat()};
+		cv::resize(mixed, displayed.linear, m_Properties.display_resolution, 0, 0, cv::INTER_NEAREST);
+		m_Displayed.push_back(std::move(displayed));
+		m_ImagesDisplayed++;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void VirtualRig::capture(cv::OutputArray dst)
+	{
+		// Frames arrive at the framerate, unless we are already behind.
+		std::this_thread::sleep_until(m_NextFrame);
+		m_NextFrame = std::max(m_NextFrame, steady_clock::now()) + microseconds(1000000 / m_Properties.framerate);
+		const int frame = ++m_FramesCaptured;
+
+		// The camera sees the last image that was shown at least the latency ago.
+		const auto is_visible = [&](const DisplayedImage& image) {
+			return image.frame + m_Properties.display_latency <= frame;
+		};
+		while(m_Displayed.size() > 1 && is_visible(m_Displayed[1]))
+			m_Displayed.pop_front();
+
+		// Dropped frames don't need to be rendered.
+		if(!dst.needed())
+			return;
+
+		if(!m_Displayed.empty() && is_visible(m_Displayed.front()))
+		{
+			cv::remap(
+				m_Displayed.front().linear, m_Warped, m_DisplayMap, cv::noArray(),
+				cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar::zeros()
+			);
+		}
+		else m_Warped = cv::Mat::zeros(m_Properties.camera_resolution, CV_32FC3);
+
+		// Light the view, then expose and encode it.
+		const double exposure = std::pow(2.0, get(cv::CAP_PROP_EXPOSURE) - m_Properties.reference_exposure);
+		const double gain = 1.0 + get(cv::CAP_PROP_GAIN) / 64.0;
+		cv::add(m_Warped, cv::Scalar::all(m_Properties.ambient), m_Warped);
+		cv::multiply(m_Warped, m_Vignette, m_Warped, exposure * gain);
+		cv::min(m_Warped, cv::Scalar::all(1.0), m_Warped);
+		cv::pow(m_Warped, 1.0 / m_Properties.camera_gamma, m_Warped);
+
+		cv::Mat noise(m_Warped.size(), CV_32FC3);
+		m_RNG.fill(noise, cv::RNG::NORMAL, cv::Scalar::all(0.0), cv::Scalar::all(m_Properties.noise));
+		cv::scaleAdd(m_Warped, 255.0, noise, m_Warped);
+
+		m_Warped.convertTo(m_Encoded, CV_8UC3);
+		m_Encoded.copyTo(dst);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool VirtualRig::set(const int property, const double value)
+	{
+		// The frame format is fixed, but every other property is accepted.
+		if(property == cv::CAP_PROP_FPS || property == cv::CAP_PROP_FRAME_WIDTH || property == cv::CAP_PROP_FRAME_HEIGHT)
+			return false;
+
+		m_CameraProperties[property] = value;
+		return true;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	double VirtualRig::get(const int property) const
+	{
+		const auto entry = m_CameraProperties.find(property);
+		return (entry != m_CameraProperties.end()) ? entry->second : 0.0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	std::vector<cv::Point2f> VirtualRig::project(const std::vector<cv::Point2f>& display_points) const
+	{
+		std::vector<cv::Point2f> ideal_points, camera_points;
+		cv::perspectiveTransform(display_points, ideal_points, m_Properties.homography);
+
+		// Apply the lens distortion to the ideal points, through their normalized rays.
+		std::vector<cv::Point3f> rays;
+		rays.reserve(ideal_points.size());
+		const auto inverse_camera = m_Properties.camera_matrix.inv();
+		for(const auto& point : ideal_points)
+		{
+			const cv::Vec3d ray = inverse_camera * cv::Vec3d(point.x, point.y, 1.0);
+			rays.emplace_back(ray[0] / ray[2], ray[1] / ray[2], 1.0f);
+		}
+
+		cv::projectPoints(rays, cv::Vec3d::all(0.0), cv::Vec3d::all(0.0), m_Properties.camera_matrix, m_Properties.distortion, camera_points);
+		return camera_points;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	int VirtualRig::frames_captured() const
+	{
+		return m_FramesCaptured;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	int VirtualRig::images_displayed() const
+	{
+		return m_ImagesDisplayed;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <deque>
+#include <map>
+
+namespace vt
+{
+
+	// Properties of a simulated display and the webcam looking at it.
+	struct RigProperties
+	{
+		cv::Size display_resolution;
+		cv::Size camera_resolution;
+		int framerate = 30;
+
+		// Camera frames between an image being shown and it being captured.
+		int display_latency = 2;
+
+		// Lens of the camera, as given by cv::calibrateCamera.
+		cv::Matx33d camera_matrix;
+		cv::Vec<double, 5> distortion;
+
+		// Maps display pixels onto the undistorted camera image.
+		cv::Matx33d homography;
+
+		// Each display channel is linearized by its gamma, then leaks into
+		// the camera channels through the crosstalk, before the ambient light
+		// is added and the camera encodes it with its own gamma.
+		cv::Vec3d display_gamma = {2.2, 2.2, 2.2};
+		cv::Matx33d crosstalk;
+		double camera_gamma = 2.2;
+		double ambient = 0.05;
+
+		// Fall off in brightness at the corners of the camera image.
+		double vignetting = 0.3;
+
+		// Standard deviation of the sensor noise, in 8-bit levels, and the
+		// seed it is drawn from so that runs of the rig can be repeated.
+		double noise = 2.0;
+		uint64_t seed = 0;
+
+		// Exposure level, in log2 seconds, at which white is captured at full scale.
+		double reference_exposure = -6.0;
+
+		// A webcam looking down at a widescreen display, slightly off-centre.
+		static RigProperties Typical();
+	};
+
+
+	// A display and webcam that are simulated in software, so that the
+	// calibration can run headless. Images shown on the display are seen
+	// by the webcam through its lens, colour response and sensor noise.
+	class VirtualRig
+	{
+	public:
+
+		VirtualRig(const RigProperties& properties);
+
+		const RigProperties& properties() const;
+
+		// Shows an image fullscreen on the display, stretching it to fit.
+		void display(const cv::Mat& image);
+
+		// Captures the next webcam frame, waiting for it at the framerate.
+		void capture(cv::OutputArray dst);
+
+		bool set(const int property, const double value);
+
+		double get(const int property) const;
+
+		// Where points of the display are seen in the webcam image.
+		std::vector<cv::Point2f> project(const std::vector<cv::Point2f>& display_points) const;
+
+		// Number of frames captured and images displayed so far.
+		int frames_captured() const;
+
+		int images_displayed() const;
+
+	private:
+
+		struct DisplayedImage
+		{
+			int frame;
+			cv::Mat linear;
+		};
+
+		RigProperties m_Properties;
+		std::map<int, double> m_CameraProperties;
+
+		// Rendering Resources
+		cv::Mat m_DisplayMap, m_Vignette;
+		cv::Mat m_Warped, m_Encoded;
+		cv::RNG m_RNG;
+
+		// Display State
+		std::deque<DisplayedImage> m_Displayed;
+		std::chrono::steady_clock::time_point m_NextFrame;
+		int m_FramesCaptured = 0;
+		int m_ImagesDisplayed = 0;
+	};
+
+}
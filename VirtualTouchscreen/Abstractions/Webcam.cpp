@@ -13,7 +13,9 @@ namespace vt
 		CV_Assert(target_framerate > 0);
 
 		// Fixes MSMF backend taking a long time to initialize. 
+#ifdef _WIN32
 		_putenv("OPENCV_VIDEOIO_MSMF_ENABLE_HW_TRANSFORMS=0");
+#endif
 
 		// Open the webcam stream
 		cv::VideoCapture webcam_stream(id, cv::CAP_DSHOW);
@@ -25,12 +27,19 @@ namespace vt
 		webcam_stream.set(cv::CAP_PROP_FRAME_WIDTH, target_size.width);
 		webcam_stream.set(cv::CAP_PROP_FRAME_HEIGHT, target_size.height);
 
-		// Open settings menu (DSHOW only)
-		webcam_stream.set(cv::CAP_PROP_SETTINGS, -1);
-
 		return Webcam(std::move(webcam_stream));
 	}
 
+//---------------------------------------------------------------------------------------------------------------------
+
+	std::optional<Webcam> Webcam::TryCreate(std::shared_ptr<VirtualRig> rig)
+	{
+		if(rig == nullptr)
+			return {};
+
+		return Webcam(std::move(rig));
+	}
+
 //---------------------------------------------------------------------------------------------------------------------
 	
 	Webcam::Webcam(cv::VideoCapture&& stream)
@@ -43,6 +52,17 @@ namespace vt
 		m_Stream = std::move(stream);
 	}
 
+//---------------------------------------------------------------------------------------------------------------------
+
+	Webcam::Webcam(std::shared_ptr<VirtualRig>&& rig)
+		: framerate(rig->properties().framerate),
+		  latency_ms(std::round(1000.0f / static_cast<float>(framerate))),
+		  width(rig->properties().camera_resolution.width),
+		  height(rig->properties().camera_resolution.height),
+		  m_Rig(std::move(rig))
+	{
+	}
+
 //---------------------------------------------------------------------------------------------------------------------
 
 	Webcam::~Webcam()
@@ -54,7 +74,37 @@ namespace vt
 
 	bool Webcam::is_open() const
 	{
-		return m_Stream.isOpened();
+		return m_Rig != nullptr || m_Stream.isOpened();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool Webcam::set(const int property, const double value)
+	{
+		return (m_Rig != nullptr) ? m_Rig->set(property, value) : m_Stream.set(property, value);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	double Webcam::get(const int property) const
+	{
+		return (m_Rig != nullptr) ? m_Rig->get(property) : m_Stream.get(property);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	VirtualRig* Webcam::rig() const
+	{
+		return m_Rig.get();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void Webcam::show_settings()
+	{
+		// Open settings menu (DSHOW only)
+		if(m_Rig == nullptr)
+			m_Stream.set(cv::CAP_PROP_SETTINGS, -1);
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -62,13 +112,21 @@ namespace vt
 	void Webcam::drop_frame()
 	{
 		// Burn a frame. 
-		m_Stream.grab();
+		if(m_Rig != nullptr)
+			m_Rig->capture(cv::noArray());
+		else
+			m_Stream.grab();
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
-	bool Webcam::next_frame(cv::UMat& dst)
+	bool Webcam::next_frame(Frame& dst)
 	{
+		if(m_Rig != nullptr)
+		{
+			m_Rig->capture(dst);
+			return true;
+		}
 		return m_Stream.read(dst);
 	}
 
@@ -2,6 +2,10 @@
 
 #include <opencv2/opencv.hpp>
 #include <optional>
+#include <memory>
+
+#include "Utility/Common.hpp"
+#include "Abstractions/VirtualRig.hpp"
 
 namespace vt
 {
@@ -21,16 +25,28 @@ namespace vt
 			const int target_framerate = 30  // Not guaranteed
 		);
 
+		// Captures from a simulated display and webcam instead of hardware.
+		static std::optional<Webcam> TryCreate(std::shared_ptr<VirtualRig> rig);
+
 		~Webcam();
 
 
+		void show_settings();
+
 		void drop_frame();
 
-		bool next_frame(cv::UMat& dst);
+		bool next_frame(Frame& dst);
 
 
 		bool is_open() const;
 
+		bool set(const int property, const double value);
+
+		double get(const int property) const;
+
+		// The simulated rig behind the webcam, or null for real hardware.
+		VirtualRig* rig() const;
+
 		cv::VideoCapture& raw();
 
 		const cv::VideoCapture& raw() const;
@@ -38,7 +54,10 @@ namespace vt
 	private:
 		Webcam(cv::VideoCapture&& stream);
 
+		Webcam(std::shared_ptr<VirtualRig>&& rig);
+
 		cv::VideoCapture m_Stream;
+		std::shared_ptr<VirtualRig> m_Rig;
 	};
 
 
@@ -1,35 +1,163 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
 #include <optional>
+#include <future>
+#include <filesystem>
+#include <charconv>
 
 #include "Abstractions/Mouse.hpp"
 #include "Abstractions/Webcam.hpp"
 #include "Systems/ViewCalibrator.hpp"
 #include "Systems/MaskGenerator.hpp"
 #include "Systems/FingerTracker.hpp"
+#include "Systems/ExposureController.hpp"
+#include "Utility/Profiler.hpp"
+#include "Tools/Benchmark.hpp"
+#include "Tools/Autotuner.hpp"
+#include "Tools/Verifier.hpp"
+#include "Tools/Session.hpp"
+#include "Tools/Sweep.hpp"
 
 #include "Configuration.hpp"
 
 //---------------------------------------------------------------------------------------------------------------------
 
+// Spatial settings, relative to the width of the screen.
+constexpr float TOUCH_MARGIN = 7.0f / SPATIAL_REFERENCE_WIDTH;
+
+//---------------------------------------------------------------------------------------------------------------------
+
 
 // Forward Declaration
 std::optional<std::tuple<cv::Point, bool>> find_touch_action(
 	const std::vector<vt::FingerTracker::Fingertip>& fingertips,
-	const cv::UMat& foreground_mask, const cv::UMat& shadow_mask,
-	const cv::UMat& camera_view
+	const vt::Frame& foreground_mask, const vt::Frame& shadow_mask,
+	const vt::Frame& camera_view
+);
+
+void enable_kernel_cache(const std::string& directory);
+
+bool parse_integer(const std::string_view text, int& value);
+
+void warm_up_pipeline(
+	const vt::Webcam& webcam, const vt::ViewCalibrator& calibrator,
+	vt::MaskGenerator& mask_generator, vt::FingerTracker& finger_tracker,
+	vt::Frame& raw_frame, vt::Frame& screen_frame,
+	vt::Frame& foreground_mask, vt::Frame& shadow_mask,
+	const int frames
 );
 
 //---------------------------------------------------------------------------------------------------------------------
 
 int main(int argc, const char* argv[])
 {
-	// Obtain webcam hardware ID. 
-	int webcam_id = (argc == 2) ? atoi(argv[1]) : WEBCAM_ID;
+	vt::Profiler startup_profiler("Startup");
+
+	// Must happen before anything touches OpenCL.
+	enable_kernel_cache(KERNEL_CACHE_DIR);
+
+	// Run the benchmarks instead of the touchscreen.
+	if(argc >= 2 && std::string(argv[1]) == "--benchmark")
+		return vt::run_benchmarks(argc, argv);
+
+	// Tune the pipeline settings on demand.
+	if(argc >= 2 && std::string(argv[1]) == "--autotune")
+		return vt::run_autotuner();
+
+	// Verify the optimised kernels against the reference kernels.
+	if(argc >= 2 && std::string(argv[1]) == "--verify")
+		return vt::run_verification(argc, argv);
+
+	// Sweep the parameters over a recorded session.
+	if(argc >= 2 && std::string(argv[1]) == "--sweep")
+		return vt::run_sweep(argc, argv);
+
+	// Obtain the webcam hardware ID, along with the options for recording 
+	// the session and choosing the processing resolution of this installation.
+	int webcam_id = WEBCAM_ID;
+	std::optional<std::string> session_directory;
+	std::optional<cv::Size> requested_resolution;
+	for(int i = 1; i < argc; i++)
+	{
+		const std::string option = argv[i];
+		if(option == "--record" && i + 1 < argc)
+		{
+			session_directory = argv[++i];
+		}
+		else if(option == "--resolution" && i + 1 < argc)
+		{
+			const std::string_view value = argv[++i];
+			const auto separator = value.find('x');
+
+			int width = 0, height = 0;
+			if(separator == std::string_view::npos
+				|| !parse_integer(value.substr(0, separator), width)
+				|| !parse_integer(value.substr(separator + 1), height)
+				|| width <= 0 || height <= 0)
+			{
+				std::cerr << "Invalid resolution, expected WIDTHxHEIGHT: " << value << std::endl;
+				return -1;
+			}
+			requested_resolution = cv::Size(width, height);
+		}
+		else if(!parse_integer(option, webcam_id))
+		{
+			std::cerr << "Unknown option: " << option << std::endl;
+			return -1;
+		}
+	}
+
+	// Open the screen source on the prediction thread. 
+	vt::MaskGenerator mask_generator;
+	mask_generator.prepare(&startup_profiler);
+
+	// The webcam, saved calibration and compute kernels are 
+	// independent of each other, so initialize them together. 
+	auto webcam_task = std::async(std::launch::async, [&]() {
+		auto phase = startup_profiler.measure("Open webcam");
+		return vt::Webcam::TryCreate(webcam_id, cv::Size(WEBCAM_WIDTH, WEBCAM_HEIGHT), 30);
+	});
+
+	auto calibration_task = std::async(std::launch::async, [&]() -> std::optional<vt::ViewCalibrator> {
+		if constexpr (!reuse_saved_calibration)
+			return std::nullopt;
+
+		auto phase = startup_profiler.measure("Load calibration");
+		return vt::ViewCalibrator::TryLoad(CALIB_SAVE_PATH);
+	}).share();
+
+	// Without a request, the resolution of the saved calibration is kept.
+	// NOTE: the calibration loads quickly, so the kernels can wait for it.
+	const auto output_resolution = [&]() {
+		if(requested_resolution.has_value())
+			return *requested_resolution;
+
+		const auto& saved_calibration = calibration_task.get();
+		return saved_calibration.has_value()
+			? saved_calibration->output_resolution()
+			: cv::Size(CALIB_OUTPUT_WIDTH, CALIB_OUTPUT_HEIGHT);
+	};
+
+	auto settings_task = std::async(std::launch::async, [&]() -> std::optional<vt::PipelineSettings> {
+		if constexpr (!reuse_saved_settings)
+			return std::nullopt;
+
+		auto phase = startup_profiler.measure("Load settings");
+		return vt::PipelineSettings::TryLoad(SETTINGS_SAVE_PATH);
+	});
+
+	auto kernel_task = std::async(std::launch::async, [&]() {
+		const auto resolution = output_resolution();
+		auto phase = startup_profiler.measure("Warm kernels");
+
+		vt::Frame raw_frame(WEBCAM_HEIGHT, WEBCAM_WIDTH, CV_8UC3, cv::Scalar::zeros()), screen_frame;
+		vt::ViewCalibrator(resolution).correct(raw_frame, screen_frame);
+		mask_generator.warm_up(resolution);
+	});
 
 
 	// Initialize the webcam
-	auto webcam = vt::Webcam::TryCreate(webcam_id, cv::Size(WEBCAM_WIDTH, WEBCAM_HEIGHT), 30);
+	auto webcam = webcam_task.get();
 	if(!webcam.has_value())
 	{
 		std::cerr << "Failed to load webcam with hardware ID: " << webcam_id << std::endl;
@@ -37,56 +165,187 @@ int main(int argc, const char* argv[])
 	}
 	else std::cout << cv::format("Loaded webcam (%dx%d@%d)\n", webcam->width, webcam->height, webcam->framerate);
 
+	{
+		auto phase = startup_profiler.measure("Webcam settings");
+		webcam->show_settings();
+	}
+
+
+	// Calibrate the webcam view, unless the saved calibration still fits the setup.
+	// Matching resolutions aren't enough, as the camera or screen may have moved.
+	auto calibrator = calibration_task.get();
+	bool calibration_valid = false;
+	if(calibrator.has_value()
+	&& (!requested_resolution.has_value() || calibrator->output_resolution() == *requested_resolution)
+	&& calibrator->input_resolution() == cv::Size(webcam->width, webcam->height))
+	{
+		auto phase = startup_profiler.measure("Verify calibration");
+		calibrator->restore(*webcam);
+		calibration_valid = calibrator->verify(*webcam, CALIB_SETTLE_TIME_MS);
+		if(!calibration_valid)
+			std::cout << "Saved calibration no longer fits the view, recalibrating..." << std::endl;
+	}
 
-	// Calibrate the webcam view
-	const cv::Size output_resolution(CALIB_OUTPUT_WIDTH, CALIB_OUTPUT_HEIGHT);
-	vt::ViewCalibrator calibrator(output_resolution);
-	calibrator.calibrate(*webcam, CALIB_MIN_COVERAGE, CALIB_SETTLE_TIME_MS);
+	if(calibration_valid)
+	{
+		std::cout << "Loaded calibration: " << CALIB_SAVE_PATH << std::endl;
+	}
+	else
+	{
+		calibrator.emplace(output_resolution());
+		calibrator->calibrate(*webcam, CALIB_MIN_COVERAGE, CALIB_SETTLE_TIME_MS, &startup_profiler);
+		calibrator->save(CALIB_SAVE_PATH);
+	}
 
 	// Initialize touchscreen systems.
-	vt::MaskGenerator mask_generator;
 	vt::FingerTracker finger_tracker;
-	vt::Mouse mouse(output_resolution);
+	const auto& screen_resolution = calibrator->output_resolution();
+	vt::Mouse mouse(screen_resolution);
+
+	kernel_task.get();
+
+	// Tune the pipeline to this machine, unless the saved settings still fit the setup.
+	auto settings = settings_task.get();
+	if(!settings.has_value()
+	|| settings->output_resolution != calibrator->output_resolution()
+	|| settings->input_resolution != calibrator->input_resolution())
+	{
+		auto phase = startup_profiler.measure("Autotune");
+		settings = vt::autotune(*calibrator, std::cout);
+		settings->save(SETTINGS_SAVE_PATH);
+	}
+	else std::cout << "Loaded settings: " << SETTINGS_SAVE_PATH << std::endl;
+	
+	settings->apply();
+	calibrator->tune(*settings);
+	finger_tracker.tune(*settings);
+
+	std::optional<vt::SessionRecorder> session_recorder;
+	if(session_directory.has_value())
+	{
+		session_recorder = vt::SessionRecorder::TryCreate(*session_directory, *calibrator);
+		if(!session_recorder.has_value())
+			return -1;
+
+		mask_generator.keep_screen(true);
+	}
 
 	// Begin the mask generator
-	mask_generator.start(*webcam, calibrator);
+	mask_generator.start(*webcam, *calibrator);
+
+	// Push synthetic frames through the pipeline, so the first touch isn't slowed down.
+	vt::Frame raw_frame, screen_frame;
+	vt::Frame foreground_mask, shadow_mask;
+	{
+		auto phase = startup_profiler.measure("Warm pipeline");
+		warm_up_pipeline(
+			*webcam, *calibrator,
+			mask_generator, finger_tracker,
+			raw_frame, screen_frame,
+			foreground_mask, shadow_mask,
+			WARM_UP_FRAMES
+		);
+	}
+
+	// Hold the shortest exposure that keeps the view clean enough.
+	std::optional<vt::ExposureController> exposure_controller;
+	if constexpr (use_exposure_controller)
+	{
+		exposure_controller.emplace(*webcam);
+	}
 
 	// Run the main processing loop
-	cv::UMat raw_frame, screen_frame;
-	cv::UMat foreground_mask, shadow_mask;
+	int mode_frames = 0;
+
 	auto start_frame = std::chrono::high_resolution_clock::now();
 	auto start_process = std::chrono::high_resolution_clock::now();
+	bool first_frame = true;
 	while(webcam->next_frame(raw_frame))
 	{
 		start_process = std::chrono::high_resolution_clock::now();
 
+		if(exposure_controller.has_value())
+		{
+			exposure_controller->update(raw_frame);
+		}
+
 		if constexpr (show_raw_webcam_view)
 		{
 			cv::imshow("Raw Capture", raw_frame);
 			cv::pollKey();
 		}
-		
-		calibrator.correct(raw_frame, screen_frame);
-		
-		// Find foreground and shadow masks
-		mask_generator.segment(
-			screen_frame,
-			foreground_mask,
-			shadow_mask
-		);
+
+		// The brightness of the view is in flux while the webcam applies a write of the
+		// exposure controller, so the frame is skipped and the touch is held as it is.
+		const bool settling = exposure_controller.has_value() && exposure_controller->settling();
+		if(settling)
+		{
+			mask_generator.skip();
+		}
+		else if constexpr (use_tile_streaming)
+		{
+			// Correct and find the foreground and shadow masks band by band.
+			mask_generator.correct_and_segment(
+				*calibrator,
+				raw_frame,
+				screen_frame,
+				foreground_mask,
+				shadow_mask
+			);
+		}
+		else
+		{
+			calibrator->correct(raw_frame, screen_frame);
+			
+			// Find foreground and shadow masks
+			mask_generator.segment(
+				screen_frame,
+				foreground_mask,
+				shadow_mask
+			);
+		}
+
+		if(session_recorder.has_value())
+		{
+			session_recorder->record(raw_frame, mask_generator.screen());
+		}
 
 		// Detect fingertips in the foreground mask and handle touch registration.
-		auto fingertips = finger_tracker.detect(foreground_mask, shadow_mask);
-		if(const auto action = find_touch_action(fingertips, foreground_mask, shadow_mask, screen_frame); action.has_value())
+		if(!settling)
 		{
-			const auto& [point, touch] = *action;
+			const auto fingertips = finger_tracker.detect(foreground_mask, shadow_mask);
+			if(const auto action = find_touch_action(fingertips, foreground_mask, shadow_mask, screen_frame); action.has_value())
+			{
+				const auto& [point, touch] = *action;
 
-			finger_tracker.focus(point, cv::Size(256, 256));
-			mouse.move(point, true);
+				finger_tracker.focus(point);
+				mouse.move(point, true);
 			
-			if(touch) mouse.hold_left();
+				if(touch) mouse.hold_left();
+			}
+			else mouse.release_hold();
+		}
+
+		// Report the startup time, up until the first processed frame.
+		if(first_frame)
+		{
+			startup_profiler.record("First frame", start_process, std::chrono::high_resolution_clock::now());
+			if constexpr (show_startup_profile)
+			{
+				startup_profiler.report(std::cout);
+			}
+			first_frame = false;
+		}
+
+		// Report the switches of the segmentation modes over the last frames.
+		if constexpr (show_segmentation_modes)
+		{
+			if(++mode_frames == PERF_REPORT_FRAMES)
+			{
+				mask_generator.report_modes(std::cout);
+				mode_frames = 0;
+			}
 		}
-		else mouse.release_hold();
 
 		// Report total processing latency
 		if constexpr (show_latencies)
@@ -105,11 +364,88 @@ int main(int argc, const char* argv[])
 
 //---------------------------------------------------------------------------------------------------------------------
 
+void enable_kernel_cache(const std::string& directory)
+{
+	// OpenCV caches compiled OpenCL programs on disk, but its default
+	// location is a temporary directory which may be cleared between
+	// runs. Keep the cache next to the calibration instead. 
+	const auto cache_path = std::filesystem::absolute(directory);
+	std::filesystem::create_directories(cache_path);
+
+	const std::string cache_dir = "OPENCV_OPENCL_CACHE_DIR=" + cache_path.string();
+#ifdef _WIN32
+	for(const std::string& variable : {std::string("OPENCV_OPENCL_CACHE_ENABLE=1"), std::string("OPENCV_OPENCL_CACHE_WRITE=1"), cache_dir})
+	{
+		// Without the cache the kernels are just compiled on every run.
+		if(_putenv(variable.c_str()) != 0)
+			std::cerr << "Failed to enable the kernel cache: " << variable << std::endl;
+	}
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool parse_integer(const std::string_view text, int& value)
+{
+	// The whole text must be the integer.
+	const auto end = text.data() + text.size();
+	const auto [last, error] = std::from_chars(text.data(), end, value);
+	return error == std::errc() && last == end && !text.empty();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void warm_up_pipeline(
+	const vt::Webcam& webcam, const vt::ViewCalibrator& calibrator,
+	vt::MaskGenerator& mask_generator, vt::FingerTracker& finger_tracker,
+	vt::Frame& raw_frame, vt::Frame& screen_frame,
+	vt::Frame& foreground_mask, vt::Frame& shadow_mask,
+	const int frames
+)
+{
+	// The synthetic frames are noise, so that every stage has work to do,
+	// and they use the real frame buffers so that they are already allocated.
+	vt::Frame prediction;
+	cv::Mat screen_buffer, prediction_buffer;
+	raw_frame.create(webcam.height, webcam.width, CV_8UC3);
+	for(int i = 0; i < frames; i++)
+	{
+		cv::randu(raw_frame, cv::Scalar::all(0), cv::Scalar::all(255));
+		calibrator.correct(raw_frame, screen_frame);
+
+		// Predicting on demand runs on this thread, so is warmed up here too.
+		if constexpr (use_prediction_on_demand)
+		{
+			screen_frame.copyTo(screen_buffer);
+			calibrator.predict(screen_buffer, prediction_buffer);
+			prediction_buffer.copyTo(prediction);
+		}
+		else
+		{
+			cv::GaussianBlur(screen_frame, prediction, cv::Size(5, 5), 0);
+			prediction.convertTo(prediction, CV_32FC3);
+		}
+
+		if constexpr (use_tile_streaming)
+		{
+			mask_generator.correct_and_segment(calibrator, raw_frame, prediction, screen_frame, foreground_mask, shadow_mask);
+		}
+		else mask_generator.segment(screen_frame, prediction, foreground_mask, shadow_mask);
+		finger_tracker.detect(foreground_mask, shadow_mask);
+	}
+
+	// Don't let the synthetic frames affect the real ones.
+	mask_generator.reset();
+	finger_tracker.reset();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 
 std::optional<std::tuple<cv::Point, bool>> find_touch_action(
 	const std::vector<vt::FingerTracker::Fingertip>& fingertips,
-	const cv::UMat& foreground_mask, const cv::UMat& shadow_mask,
-	const cv::UMat& camera_view
+	const vt::Frame& foreground_mask, const vt::Frame& shadow_mask,
+	const vt::Frame& camera_view
 )
 {
 	// Process the list of fingertips to find either the 
@@ -152,7 +488,7 @@ std::optional<std::tuple<cv::Point, bool>> find_touch_action(
 		// the object that casts it if there is a touch, meaning
 		// that the ratio should be minimal, but never zero, as 
 		// the shadow will outline the contour of the hand.  
-		const int radius = cv::norm(com - point) + 7;
+		const int radius = cv::norm(com - point) + cvRound(TOUCH_MARGIN * shadow_mask.cols);
 		cv::Rect roi(
 			cv::Point(
 				std::max(com.x - radius, 0),
@@ -184,7 +520,7 @@ std::optional<std::tuple<cv::Point, bool>> find_touch_action(
 				trackbar_initialized = true;
 			}
 
-			thread_local cv::UMat patch(612, 512, CV_8UC3);
+			thread_local vt::Frame patch(612, 512, CV_8UC3);
 			patch.setTo(cv::Scalar::zeros());
 
 			cv::resize(camera_view(roi), patch(cv::Rect(0,0,512,512)), {512, 512});
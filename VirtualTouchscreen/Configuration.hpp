@@ -1,3 +1,4 @@
+#pragma once
 
 // TODO: remove defines
 
@@ -13,7 +14,19 @@
 #define CALIB_OUTPUT_HEIGHT 480
 #define CALIB_MIN_COVERAGE 0.1
 #define CHESSBOARD_SIZE 22,18
+#define STRUCTURED_LIGHT_PERIOD 16
 #define CAPTURE_SAMPLES 6
+#define NOISE_BURST_FRAMES 30
+#define TRANSITION_FRAMES 15
+#define CALIB_SAVE_PATH "calibration.yml"
+#define SETTINGS_SAVE_PATH "settings.yml"
+#define SWEEP_SAVE_PATH "sweep.csv"
+#define KERNEL_CACHE_DIR "kernel_cache"
+#define WARM_UP_FRAMES 5
+#define AUTOTUNE_SAMPLES 15
+#define AUTOTUNE_MAX_ERROR 1.0
+#define PERF_REPORT_FRAMES 300
+#define SPATIAL_REFERENCE_WIDTH 640.0f
 
 
 // Debug Configuration
@@ -27,9 +40,67 @@ constexpr bool show_output_prediction = true;
 constexpr bool show_backsub_outputs = false;
 constexpr bool show_tracking_output = false;
 constexpr bool show_ratio_patch = false;
+constexpr bool show_startup_profile = true;
+constexpr bool show_perf_counters = false;
+constexpr bool show_segmentation_modes = false;
+
+// Execution Mode
+// NOTE: the CPU native pipeline runs every stage on cv::Mat instead of 
+// going through the T-API (cv::UMat), which only pays off with a GPU. 
+constexpr bool cpu_native_pipeline = false;
+
+// NOTE: the G-API segmentation streams the per-pixel stages through
+// line buffers on the Fluid backend, rather than whole frames. 
+constexpr bool use_gapi_segmentation = false;
+
+// NOTE: tile streaming corrects and segments the view in bands of rows
+// which stay in cache, so it is best used with the CPU native pipeline.
+constexpr bool use_tile_streaming = false;
+
+// NOTE: structured light calibration decodes Gray code and phase shift
+// patterns into a dense correction map, rather than fitting a lens model
+// and homography to a chessboard, so it also handles curved surfaces.
+constexpr bool use_structured_light_calibration = false;
+
+// NOTE: the background residual corrects the prediction for slow drift,
+// such as changes in ambient light, by fitting a low resolution gain and
+// offset to the background pixels on its own thread while segmenting.
+constexpr bool use_background_residual = true;
+
+// NOTE: colour map refinement updates the calibrated colour maps from the
+// screen colours shown on the background, and swaps them into the predictor.
+constexpr bool use_colour_refinement = true;
+
+// NOTE: the exposure controller shortens the webcam exposure while the view
+// stays above a signal to noise target, making up the brightness with gain.
+// The camera settings are written on their own thread, so never stall a frame,
+// but the frames are skipped while the webcam settles after each write.
+constexpr bool use_exposure_controller = false;
+
+// NOTE: predicting on demand queues the 8-bit screen frames rather than their
+// predictions, so that only the screen frame which is read for each webcam
+// frame is predicted, and only if it changed since the last one. 
+constexpr bool use_prediction_on_demand = true;
+
+// NOTE: the display transition model eases the prediction towards each new
+// screen frame at the rise and fall rate measured for the display, so that
+// the prediction delay only has to cover the latency of the display.
+constexpr bool use_display_transitions = true;
+
+// NOTE: edge thresholds raise the threshold of the segmentation near edges of
+// the prediction, such as text, so that slight misregistrations are ignored.
+constexpr bool use_edge_thresholds = true;
+
+// NOTE: the temporal fallback segments regions of the screen which are changing
+// rapidly, such as video, from the difference between webcam frames and the last
+// mask instead, as the prediction is least reliable there. Regions switch back
+// once their screen content settles.
+constexpr bool use_temporal_fallback = true;
 
 // Runtime Controls
 constexpr bool auto_start_calibration = false;
 constexpr bool skip_auto_exposure = false;
+constexpr bool reuse_saved_calibration = true;
+constexpr bool reuse_saved_settings = true;
 constexpr bool show_latencies = false;
 constexpr int prediction_delay = 3;
\ No newline at end of file
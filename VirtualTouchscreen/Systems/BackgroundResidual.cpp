@@ -0,0 +1,228 @@
+#include "BackgroundResidual.hpp"
+
+namespace vt
+{
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Size in pixels of each cell of the residual grid, and the stride
+	// between the background pixels that are sampled to update it.
+	constexpr auto RESIDUAL_CELL_SIZE = 16;
+	constexpr auto RESIDUAL_SAMPLE_STRIDE = 4;
+
+	// Minimum time between samples, and the decay of the older samples of a
+	// cell whenever it receives new ones, which sets how fast the model adapts.
+	constexpr auto RESIDUAL_SAMPLE_MS = 250;
+	constexpr auto RESIDUAL_DECAY = 0.95;
+
+	// Variance, in squared intensity levels, by which the gain is pulled towards one,
+	// so that cells of flat colour are corrected by their offset instead of their gain.
+	constexpr auto RESIDUAL_GAIN_PRIOR = 256.0;
+	constexpr auto RESIDUAL_MIN_GAIN = 0.5;
+	constexpr auto RESIDUAL_MAX_GAIN = 2.0;
+
+	// Samples which are further than this from the current model are most likely
+	// foreground that was missed by the segmentation, so are left out of the fit.
+	constexpr auto RESIDUAL_OUTLIER_LIMIT = 40.0f;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	BackgroundResidual::~BackgroundResidual()
+	{
+		stop();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void BackgroundResidual::configure(const cv::Size& resolution)
+	{
+		CV_Assert(!m_Sampler.running());
+
+		m_Resolution = resolution;
+		m_GridSize = cv::Size(
+			std::max(resolution.width / RESIDUAL_CELL_SIZE, 1),
+			std::max(resolution.height / RESIDUAL_CELL_SIZE, 1)
+		);
+		m_Sampler.configure(resolution, RESIDUAL_SAMPLE_STRIDE);
+
+		m_Weights = cv::Mat::zeros(m_GridSize, CV_64FC1);
+		m_SumPrediction = cv::Mat::zeros(m_GridSize, CV_64FC3);
+		m_SumView = cv::Mat::zeros(m_GridSize, CV_64FC3);
+		m_SumSquares = cv::Mat::zeros(m_GridSize, CV_64FC3);
+		m_SumProducts = cv::Mat::zeros(m_GridSize, CV_64FC3);
+		m_GridGain = cv::Mat(m_GridSize, CV_32FC3, cv::Scalar::all(1.0));
+		m_GridOffset = cv::Mat::zeros(m_GridSize, CV_32FC3);
+
+		m_Gain.release();
+		m_Offset.release();
+		m_PublishedGain.release();
+		m_PublishedOffset.release();
+		m_PublishedVersion = 0;
+		m_AppliedVersion = 0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void BackgroundResidual::start()
+	{
+		CV_Assert(!m_Resolution.empty());
+
+		m_Sampler.start(RESIDUAL_SAMPLE_MS, [this](BackgroundSample& sample) {
+			update(sample);
+		});
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void BackgroundResidual::stop()
+	{
+		m_Sampler.stop();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool BackgroundResidual::running() const
+	{
+		return m_Sampler.running();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool BackgroundResidual::update(const cv::Size& resolution)
+	{
+		std::unique_lock lock(m_Mutex);
+		if(m_PublishedVersion != m_AppliedVersion || (m_AppliedVersion != 0 && m_Gain.size() != resolution))
+		{
+			cv::resize(m_PublishedGain, m_Gain, resolution, 0, 0, cv::INTER_LINEAR);
+			cv::resize(m_PublishedOffset, m_Offset, resolution, 0, 0, cv::INTER_LINEAR);
+			m_AppliedVersion = m_PublishedVersion;
+		}
+
+		return m_AppliedVersion != 0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const Frame& BackgroundResidual::gain() const
+	{
+		return m_Gain;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const Frame& BackgroundResidual::offset() const
+	{
+		return m_Offset;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void BackgroundResidual::sample(const Frame& view, const Frame& prediction, const Frame& foreground_mask)
+	{
+		m_Sampler.sample(view, prediction, foreground_mask);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void BackgroundResidual::update(BackgroundSample& sample)
+	{
+		// NOTE: the sample stays pending until the update is
+		// published, so the main thread drops any new samples.
+		update_model(sample.view, sample.prediction, sample.foreground_mask);
+
+		std::unique_lock lock(m_Mutex);
+		m_GridGain.copyTo(m_PublishedGain);
+		m_GridOffset.copyTo(m_PublishedOffset);
+		m_PublishedVersion++;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void BackgroundResidual::update_model(const cv::Mat& view, const cv::Mat& prediction, const cv::Mat& foreground_mask)
+	{
+		CV_Assert(view.type() == CV_8UC3 && prediction.type() == CV_32FC3 && foreground_mask.type() == CV_8UC1);
+
+		// Accumulate the sums of the sampled background in each cell of the grid.
+		cv::Mat weights = cv::Mat::zeros(m_GridSize, CV_64FC1);
+		cv::Mat sum_prediction = cv::Mat::zeros(m_GridSize, CV_64FC3);
+		cv::Mat sum_view = cv::Mat::zeros(m_GridSize, CV_64FC3);
+		cv::Mat sum_squares = cv::Mat::zeros(m_GridSize, CV_64FC3);
+		cv::Mat sum_products = cv::Mat::zeros(m_GridSize, CV_64FC3);
+
+		for(int r = 0; r < view.rows; r++)
+		{
+			const int gr = r * m_GridSize.height / view.rows;
+			const auto* observed_row = view.ptr<cv::Vec3b>(r);
+			const auto* predicted_row = prediction.ptr<cv::Vec3f>(r);
+			const auto* mask_row = foreground_mask.ptr<uchar>(r);
+			const auto* gain_row = m_GridGain.ptr<cv::Vec3f>(gr);
+			const auto* offset_row = m_GridOffset.ptr<cv::Vec3f>(gr);
+
+			for(int c = 0; c < view.cols; c++)
+			{
+				if(mask_row[c] != 0) continue;
+
+				const int gc = c * m_GridSize.width / view.cols;
+				const cv::Vec3f observed = observed_row[c];
+				const cv::Vec3f& predicted = predicted_row[c];
+
+				bool outlier = false;
+				for(int k = 0; k < 3; k++)
+				{
+					const float residual = observed[k] - (gain_row[gc][k] * predicted[k] + offset_row[gc][k]);
+					outlier |= std::abs(residual) > RESIDUAL_OUTLIER_LIMIT;
+				}
+				if(outlier) continue;
+
+				weights.at<double>(gr, gc) += 1.0;
+				for(int k = 0; k < 3; k++)
+				{
+					sum_prediction.at<cv::Vec3d>(gr, gc)[k] += predicted[k];
+					sum_view.at<cv::Vec3d>(gr, gc)[k] += observed[k];
+					sum_squares.at<cv::Vec3d>(gr, gc)[k] += predicted[k] * predicted[k];
+					sum_products.at<cv::Vec3d>(gr, gc)[k] += predicted[k] * observed[k];
+				}
+			}
+		}
+
+		// Decay the older samples of each cell that was updated, then refit its
+		// gain and offset. Cells that weren't seen keep their last residual.
+		for(int gr = 0; gr < m_GridSize.height; gr++)
+		{
+			for(int gc = 0; gc < m_GridSize.width; gc++)
+			{
+				const double n = weights.at<double>(gr, gc);
+				if(n <= 0.0) continue;
+
+				double& total = m_Weights.at<double>(gr, gc);
+				total = RESIDUAL_DECAY * total + n;
+
+				auto& sp = m_SumPrediction.at<cv::Vec3d>(gr, gc);
+				auto& sv = m_SumView.at<cv::Vec3d>(gr, gc);
+				auto& spp = m_SumSquares.at<cv::Vec3d>(gr, gc);
+				auto& spv = m_SumProducts.at<cv::Vec3d>(gr, gc);
+				sp = RESIDUAL_DECAY * sp + sum_prediction.at<cv::Vec3d>(gr, gc);
+				sv = RESIDUAL_DECAY * sv + sum_view.at<cv::Vec3d>(gr, gc);
+				spp = RESIDUAL_DECAY * spp + sum_squares.at<cv::Vec3d>(gr, gc);
+				spv = RESIDUAL_DECAY * spv + sum_products.at<cv::Vec3d>(gr, gc);
+
+				for(int k = 0; k < 3; k++)
+				{
+					const double mean_prediction = sp[k] / total, mean_view = sv[k] / total;
+					const double variance = std::max(spp[k] / total - mean_prediction * mean_prediction, 0.0);
+					const double covariance = spv[k] / total - mean_prediction * mean_view;
+
+					const double gain = std::clamp(
+						(covariance + RESIDUAL_GAIN_PRIOR) / (variance + RESIDUAL_GAIN_PRIOR),
+						RESIDUAL_MIN_GAIN, RESIDUAL_MAX_GAIN
+					);
+					m_GridGain.at<cv::Vec3f>(gr, gc)[k] = static_cast<float>(gain);
+					m_GridOffset.at<cv::Vec3f>(gr, gc)[k] = static_cast<float>(mean_view - gain * mean_prediction);
+				}
+			}
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <mutex>
+
+#include "Utility/BackgroundSampler.hpp"
+#include "Utility/Common.hpp"
+
+namespace vt
+{
+
+	// Tracks the slow drift between the predicted background and the webcam
+	// view, such as changes in ambient light or the projector warming up, as
+	// a low resolution gain and offset of each channel. The model is fitted
+	// on a background thread from sparse samples of the background pixels.
+	class BackgroundResidual
+	{
+	public:
+
+		BackgroundResidual() = default;
+
+		~BackgroundResidual();
+
+		// Discards the model and prepares it for the given resolution.
+		void configure(const cv::Size& resolution);
+
+		void start();
+
+		// NOTE: does nothing if the update thread was never started.
+		void stop();
+
+		bool running() const;
+
+		// Upsamples the latest residual to the resolution whenever the update thread
+		// publishes a new one, returning false if no residual has been fitted yet.
+		bool update(const cv::Size& resolution);
+
+		// The latest upsampled residual, which the prediction is corrected by
+		// as gain * prediction + offset. Both are empty until it is fitted.
+		const Frame& gain() const;
+		const Frame& offset() const;
+
+		// Hands a sample of the background pixels to the update thread. This
+		// never blocks, so samples are dropped while an update is in progress.
+		void sample(const Frame& view, const Frame& prediction, const Frame& foreground_mask);
+
+	private:
+
+		void update(BackgroundSample& sample);
+
+		void update_model(const cv::Mat& view, const cv::Mat& prediction, const cv::Mat& foreground_mask);
+
+	private:
+
+		cv::Size m_Resolution, m_GridSize;
+
+		// Main Thread Resources
+		Frame m_Gain, m_Offset;
+		uint64_t m_AppliedVersion = 0;
+
+		// Update Thread Resources
+		cv::Mat m_Weights, m_SumPrediction, m_SumView, m_SumSquares, m_SumProducts;
+		cv::Mat m_GridGain, m_GridOffset;
+
+		// Shared Resources
+		BackgroundSampler m_Sampler;
+		std::mutex m_Mutex;
+		cv::Mat m_PublishedGain, m_PublishedOffset;
+		uint64_t m_PublishedVersion = 0;
+	};
+
+}
@@ -0,0 +1,221 @@
+#include "ColourMapEstimator.hpp"
+
+namespace vt
+{
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Stride between the background pixels that are sampled,
+	// and the minimum time between the samples.
+	constexpr auto REFINE_SAMPLE_STRIDE = 4;
+	constexpr auto REFINE_SAMPLE_MS = 100;
+
+	// Number of samples accumulated before the maps are refined and published.
+	constexpr auto REFINE_BATCHES = 10;
+
+	// Fraction of the mean residual that is applied to each map entry, and the
+	// weight that an entry must have been sampled with for it to be refined.
+	constexpr auto REFINE_RATE = 0.5;
+	constexpr auto REFINE_MIN_WEIGHT = 8.0;
+
+	// Samples which are further than this from the prediction are most likely
+	// foreground that was missed by the segmentation, so are left out.
+	constexpr auto REFINE_OUTLIER_LIMIT = 40.0f;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	ColourMapEstimator::~ColourMapEstimator()
+	{
+		stop();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ColourMapEstimator::configure(const ViewCalibrator& calibration)
+	{
+		CV_Assert(!m_Sampler.running());
+
+		m_Resolution = calibration.output_resolution();
+		m_Sampler.configure(m_Resolution, REFINE_SAMPLE_STRIDE);
+		m_SampleSize = m_Sampler.sample_size();
+		cv::Mat reflectance_map;
+		expand_reflectance_grid(calibration.reflectance_map(), m_Resolution, reflectance_map);
+		cv::resize(reflectance_map, m_SampleReflectance, m_SampleSize, 0, 0, cv::INTER_NEAREST);
+
+		m_ColourMaps = calibration.colour_maps();
+		m_ResidualSums.assign(m_ColourMaps.size() * std::tuple_size_v<ColourMap>, cv::Vec3d::all(0.0));
+		m_Weights.assign(m_ColourMaps.size() * std::tuple_size_v<ColourMap>, 0.0);
+		m_Batches = 0;
+		m_Stale = false;
+
+		m_PublishedMaps.store(std::make_shared<const ColourGrid>(m_ColourMaps));
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ColourMapEstimator::start()
+	{
+		CV_Assert(!m_Resolution.empty());
+
+		m_Sampler.start(REFINE_SAMPLE_MS, [this](BackgroundSample& sample) {
+			update(sample);
+		});
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ColourMapEstimator::stop()
+	{
+		m_Sampler.stop();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool ColourMapEstimator::running() const
+	{
+		return m_Sampler.running();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	std::shared_ptr<const ColourGrid> ColourMapEstimator::colour_maps() const
+	{
+		return m_PublishedMaps.load();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ColourMapEstimator::sample(
+		const cv::Mat& screen,
+		const Frame& view,
+		const Frame& prediction,
+		const Frame& foreground_mask,
+		const Frame& residual_gain,
+		const Frame& residual_offset
+	)
+	{
+		if(screen.empty())
+			return;
+
+		// Refining against the corrected prediction keeps the maps from also
+		// correcting the drift that the residual already corrects. 
+		m_Sampler.sample(view, prediction, foreground_mask, screen, residual_gain, residual_offset);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ColourMapEstimator::update(BackgroundSample& sample)
+	{
+		// The first sample after refining may have been predicted from the old maps.
+		if(!m_Stale)
+		{
+			accumulate(sample.screen, sample.view, sample.prediction, sample.foreground_mask);
+			if(++m_Batches == REFINE_BATCHES)
+			{
+				refine();
+				m_Batches = 0;
+				m_Stale = true;
+			}
+		}
+		else m_Stale = false;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ColourMapEstimator::accumulate(const cv::Mat& screen, const cv::Mat& view, const cv::Mat& prediction, const cv::Mat& foreground_mask)
+	{
+		CV_Assert(screen.type() == CV_8UC3 && view.type() == CV_8UC3 && prediction.type() == CV_32FC3);
+		CV_Assert(foreground_mask.type() == CV_8UC1 && screen.size() == m_SampleSize);
+
+		constexpr auto MAP_ENTRIES = std::tuple_size_v<ColourMap>;
+		for(int r = 0; r < m_SampleSize.height; r++)
+		{
+			// NOTE: the samples were taken by nearest neighbour, so lie on these rows and columns.
+			const auto row_blend = blend_regions(r * m_Resolution.height / m_SampleSize.height, m_Resolution.height);
+			const auto* screen_row = screen.ptr<cv::Vec3b>(r);
+			const auto* observed_row = view.ptr<cv::Vec3b>(r);
+			const auto* predicted_row = prediction.ptr<cv::Vec3f>(r);
+			const auto* reflectance_row = m_SampleReflectance.ptr<cv::Vec3f>(r);
+			const auto* mask_row = foreground_mask.ptr<uchar>(r);
+
+			for(int c = 0; c < m_SampleSize.width; c++)
+			{
+				if(mask_row[c] != 0) continue;
+
+				// Find the residual in the space of the colour maps, before the reflectance.
+				const cv::Vec3f observed = observed_row[c];
+				const auto& predicted = predicted_row[c];
+				const auto& reflectance = reflectance_row[c];
+
+				bool outlier = false;
+				cv::Vec3d residual;
+				for(int k = 0; k < 3; k++)
+				{
+					const float difference = observed[k] - predicted[k];
+					outlier |= std::abs(difference) > REFINE_OUTLIER_LIMIT || reflectance[k] <= 0.0f;
+					residual[k] = difference / reflectance[k];
+				}
+				if(outlier) continue;
+
+				// Locate the sub-cube of the screen colour, as in the prediction.
+				const auto norm_col = cv::Vec3f(screen_row[c]) / 255.0f;
+				const int x = std::min(static_cast<int>(norm_col[0] / CMAP_STEP), CMAP_SIZE - 2);
+				const int y = std::min(static_cast<int>(norm_col[1] / CMAP_STEP), CMAP_SIZE - 2);
+				const int z = std::min(static_cast<int>(norm_col[2] / CMAP_STEP), CMAP_SIZE - 2);
+				const auto factors = (norm_col - cv::Vec3f(x, y, z) * CMAP_STEP) / CMAP_STEP;
+
+				// Spread the residual over every entry that contributed to the
+				// prediction, by the weight that the entry contributed with.
+				const auto column_blend = blend_regions(c * m_Resolution.width / m_SampleSize.width, m_Resolution.width);
+				for(int i = 0; i < 4; i++)
+				{
+					const int dr = i / 2, dc = i % 2;
+					const float region_weight = (dr ? row_blend.weight : 1.0f - row_blend.weight)
+					                          * (dc ? column_blend.weight : 1.0f - column_blend.weight);
+					if(region_weight <= 0.0f) continue;
+
+					const int region = (row_blend.region + dr) * CMAP_REGIONS + column_blend.region + dc;
+					for(int corner = 0; corner < 8; corner++)
+					{
+						const int dx = corner & 1, dy = (corner >> 1) & 1, dz = corner >> 2;
+						const double weight = region_weight
+							* (dx ? factors[0] : 1.0f - factors[0])
+							* (dy ? factors[1] : 1.0f - factors[1])
+							* (dz ? factors[2] : 1.0f - factors[2]);
+
+						const size_t entry = region * MAP_ENTRIES + xyz_to_3d_index(x + dx, y + dy, z + dz, CMAP_SIZE);
+						m_Weights[entry] += weight;
+						m_ResidualSums[entry] += weight * residual;
+					}
+				}
+			}
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ColourMapEstimator::refine()
+	{
+		constexpr auto MAP_ENTRIES = std::tuple_size_v<ColourMap>;
+		for(size_t entry = 0; entry < m_Weights.size(); entry++)
+		{
+			// Entries of colours that weren't shown keep their calibration.
+			if(m_Weights[entry] >= REFINE_MIN_WEIGHT)
+			{
+				auto& colour = m_ColourMaps[entry / MAP_ENTRIES][entry % MAP_ENTRIES];
+				const cv::Vec3d correction = m_ResidualSums[entry] * (REFINE_RATE / m_Weights[entry]);
+				for(int k = 0; k < 3; k++)
+					colour[k] = std::max(static_cast<float>(colour[k] + correction[k]), 0.0f);
+			}
+		}
+
+		// The residuals were measured against the old maps, so start again.
+		std::fill(m_ResidualSums.begin(), m_ResidualSums.end(), cv::Vec3d::all(0.0));
+		std::fill(m_Weights.begin(), m_Weights.end(), 0.0);
+
+		m_PublishedMaps.store(std::make_shared<const ColourGrid>(m_ColourMaps));
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <memory>
+
+#include "ViewCalibrator.hpp"
+#include "Utility/BackgroundSampler.hpp"
+#include "Utility/Common.hpp"
+
+namespace vt
+{
+
+	// Refines the calibrated colour maps while running, using the screen colours
+	// that are shown on the background and how the webcam observes them. The
+	// residuals are accumulated for each entry of the maps on a background thread,
+	// which periodically publishes the refined maps for the predictor to swap in.
+	class ColourMapEstimator
+	{
+	public:
+
+		ColourMapEstimator() = default;
+
+		~ColourMapEstimator();
+
+		// Discards any refinement, starting again from the calibrated maps.
+		void configure(const ViewCalibrator& calibration);
+
+		void start();
+
+		// NOTE: does nothing if the update thread was never started.
+		void stop();
+
+		bool running() const;
+
+		// The latest colour maps, or null if not yet configured.
+		std::shared_ptr<const ColourGrid> colour_maps() const;
+
+		// Hands a sample of the background pixels to the update thread, where the
+		// prediction must be the one made from the screen frame. This never blocks,
+		// so samples are dropped while the last one is still being accumulated.
+		// NOTE: the maps only refine what the background residual leaves, so its
+		// gain and offset are given to correct the prediction by, once it's fitted. 
+		void sample(
+			const cv::Mat& screen,
+			const Frame& view,
+			const Frame& prediction,
+			const Frame& foreground_mask,
+			const Frame& residual_gain = Frame(),
+			const Frame& residual_offset = Frame()
+		);
+
+	private:
+
+		void update(BackgroundSample& sample);
+
+		void accumulate(const cv::Mat& screen, const cv::Mat& view, const cv::Mat& prediction, const cv::Mat& foreground_mask);
+
+		void refine();
+
+	private:
+
+		cv::Size m_Resolution, m_SampleSize;
+		cv::Mat m_SampleReflectance;
+
+		// Update Thread Resources
+		ColourGrid m_ColourMaps;
+		std::vector<cv::Vec3d> m_ResidualSums;
+		std::vector<double> m_Weights;
+		int m_Batches = 0;
+		bool m_Stale = false;
+
+		// Shared Resources
+		std::atomic<std::shared_ptr<const ColourGrid>> m_PublishedMaps;
+		BackgroundSampler m_Sampler;
+	};
+
+}
@@ -0,0 +1,244 @@
+#include "ExposureController.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+namespace vt
+{
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Size of the sparse sample of each frame, which is taken by nearest
+	// neighbour so that the noise of the individual pixels is kept.
+	const cv::Size CONTROL_SAMPLE_SIZE(80, 60);
+
+	// Frames between each control step, and the frames waited after
+	// each write for the camera to apply it before measuring again.
+	constexpr auto CONTROL_INTERVAL_FRAMES = 30;
+	constexpr auto CONTROL_SETTLE_FRAMES = 5;
+
+	// Halving the exposure and doubling the gain at worst halves the signal to noise
+	// ratio, so the exposure is only shortened while the ratio is twice the target.
+	constexpr auto CONTROL_SNR_TARGET = 40.0;
+
+	// Most halvings of the initial exposure, as the exposure is in log2 seconds,
+	// and some webcams silently clamp values below their range.
+	constexpr auto CONTROL_MAX_EXPOSURE_STEPS = 6;
+
+	// Range of the gain and the step used to learn its response,
+	// and how many times the response is probed before giving up.
+	constexpr auto CONTROL_MAX_GAIN = 255.0;
+	constexpr auto CONTROL_GAIN_PROBE = 16.0;
+	constexpr auto CONTROL_MAX_PROBES = 3;
+
+	// Brightness changes are measured as the median log ratio of the samples, and
+	// are only trusted if the samples agree, as the screen content may have changed.
+	constexpr auto RESPONSE_TOLERANCE = 0.05;
+	constexpr auto RESPONSE_MAX_SPREAD = 0.1;
+	constexpr auto RESPONSE_MAX_CORRECTIONS = 3;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	ExposureController::ExposureController(Webcam& webcam)
+		: m_Webcam(webcam),
+		  m_MaxExposure(webcam.get(cv::CAP_PROP_EXPOSURE)),
+		  m_MinExposure(m_MaxExposure - CONTROL_MAX_EXPOSURE_STEPS),
+		  m_BaseGain(webcam.get(cv::CAP_PROP_GAIN))
+	{
+		m_Exposure = m_MaxExposure;
+		m_Gain = m_BaseGain;
+
+		m_WriterThread = std::thread(&ExposureController::writer_process, this);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	ExposureController::~ExposureController()
+	{
+		{
+			std::unique_lock lock(m_WriterMutex);
+			m_Runflag = false;
+		}
+		m_WriterSignal.notify_one();
+		m_WriterThread.join();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	double ExposureController::snr() const
+	{
+		return m_SNR;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool ExposureController::settling() const
+	{
+		return m_SettleFrames > 0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ExposureController::update(const Frame& raw_frame)
+	{
+		std::swap(m_Sample, m_LastSample);
+		cv::resize(raw_frame, m_SampleBuffer, CONTROL_SAMPLE_SIZE, 0, 0, cv::INTER_NEAREST);
+		cv::cvtColor(m_SampleBuffer, m_GrayBuffer, cv::COLOR_BGR2GRAY);
+		m_GrayBuffer.convertTo(m_Sample, CV_32FC1);
+
+		if(m_LastSample.empty())
+			return;
+
+		// Wait for the last write to take effect, then check its response.
+		if(m_SettleFrames > 0)
+		{
+			if(--m_SettleFrames > 0)
+				return;
+
+			double log_ratio = 0.0;
+			const bool reliable = measure_response(log_ratio);
+			if(m_ProbingGain)
+			{
+				// Learn the response of the gain, then undo the probe.
+				if(reliable && log_ratio > RESPONSE_TOLERANCE)
+					m_GainSensitivity = log_ratio / m_LastGainStep;
+
+				m_ProbingGain = false;
+				m_Gain -= m_LastGainStep;
+				write({{cv::CAP_PROP_GAIN, m_Gain}});
+				m_SettleFrames = CONTROL_SETTLE_FRAMES;
+			}
+			else if(m_Compensating && reliable && std::abs(log_ratio) > RESPONSE_TOLERANCE)
+			{
+				// Correct any brightness change that the gain didn't compensate for.
+				if(++m_Corrections <= RESPONSE_MAX_CORRECTIONS)
+				{
+					m_Gain = std::clamp(m_Gain - log_ratio / m_GainSensitivity, m_BaseGain, CONTROL_MAX_GAIN);
+					write({{cv::CAP_PROP_GAIN, m_Gain}});
+					m_SettleFrames = CONTROL_SETTLE_FRAMES;
+				}
+				else m_Compensating = false;
+			}
+			else m_Compensating = false;
+			return;
+		}
+
+		if(++m_Frames % CONTROL_INTERVAL_FRAMES != 0)
+			return;
+
+		// Estimate the temporal noise from the difference of consecutive samples,
+		// where the median absolute difference is robust to any moving content.
+		std::vector<float> differences(m_Sample.total());
+		cv::Mat difference_mat(m_Sample.size(), CV_32FC1, differences.data());
+		cv::absdiff(m_Sample, m_LastSample, difference_mat);
+
+		const auto median = differences.begin() + differences.size() / 2;
+		std::nth_element(differences.begin(), median, differences.end());
+		const double noise = std::max(1.4826 * (*median) / std::sqrt(2.0), 0.5);
+		m_SNR = cv::mean(m_Sample)[0] / noise;
+
+		// Learn how the brightness responds to the gain before using it.
+		if(m_GainSensitivity <= 0.0)
+		{
+			if(m_Probes < CONTROL_MAX_PROBES && m_Gain + CONTROL_GAIN_PROBE <= CONTROL_MAX_GAIN)
+			{
+				m_Probes++;
+				m_Sample.copyTo(m_Before);
+				m_LastGainStep = CONTROL_GAIN_PROBE;
+				m_Gain += m_LastGainStep;
+				m_ProbingGain = true;
+				write({{cv::CAP_PROP_GAIN, m_Gain}});
+				m_SettleFrames = CONTROL_SETTLE_FRAMES;
+			}
+			return;
+		}
+
+		// Each exposure level is double the last, so the gain must make up for it.
+		const double gain_step = std::log(2.0) / m_GainSensitivity;
+		if(m_SNR >= 2.0 * CONTROL_SNR_TARGET && m_Exposure - 1.0 >= m_MinExposure && m_Gain + gain_step <= CONTROL_MAX_GAIN)
+		{
+			m_Exposure -= 1.0;
+			m_Gain += gain_step;
+		}
+		else if(m_SNR < CONTROL_SNR_TARGET && m_Exposure < m_MaxExposure)
+		{
+			m_Exposure += 1.0;
+			m_Gain = std::max(m_Gain - gain_step, m_BaseGain);
+		}
+		else return;
+
+		m_Sample.copyTo(m_Before);
+		m_Compensating = true;
+		m_Corrections = 0;
+		write({{cv::CAP_PROP_EXPOSURE, m_Exposure}, {cv::CAP_PROP_GAIN, m_Gain}});
+		m_SettleFrames = CONTROL_SETTLE_FRAMES;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool ExposureController::measure_response(double& log_ratio) const
+	{
+		// Only compare pixels which are neither too dark nor clipped.
+		std::vector<float> ratios;
+		ratios.reserve(m_Sample.total());
+		for(int r = 0; r < m_Sample.rows; r++)
+		{
+			const float* after = m_Sample.ptr<float>(r);
+			const float* before = m_Before.ptr<float>(r);
+			for(int c = 0; c < m_Sample.cols; c++)
+			{
+				if(before[c] > 16.0f && before[c] < 250.0f && after[c] > 0.0f && after[c] < 250.0f)
+					ratios.push_back(std::log(after[c] / before[c]));
+			}
+		}
+
+		if(ratios.size() < m_Sample.total() / 4)
+			return false;
+
+		const auto median = ratios.begin() + ratios.size() / 2;
+		std::nth_element(ratios.begin(), median, ratios.end());
+		log_ratio = *median;
+
+		for(auto& ratio : ratios)
+			ratio = std::abs(ratio - static_cast<float>(log_ratio));
+		std::nth_element(ratios.begin(), median, ratios.end());
+		return *median < RESPONSE_MAX_SPREAD;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ExposureController::write(const std::map<int, double>& properties)
+	{
+		{
+			std::unique_lock lock(m_WriterMutex);
+			for(const auto& [property, value] : properties)
+				m_PendingWrites[property] = value;
+		}
+		m_WriterSignal.notify_one();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ExposureController::writer_process()
+	{
+		std::map<int, double> writes;
+		while(true)
+		{
+			{
+				std::unique_lock lock(m_WriterMutex);
+				m_WriterSignal.wait(lock, [&](){ return !m_PendingWrites.empty() || !m_Runflag; });
+				if(!m_Runflag) return;
+
+				writes.swap(m_PendingWrites);
+			}
+
+			// NOTE: VideoCapture::set can stall for several frames on some backends.
+			for(const auto& [property, value] : writes)
+				m_Webcam.set(property, value);
+			writes.clear();
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
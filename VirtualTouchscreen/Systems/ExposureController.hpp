@@ -0,0 +1,75 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <map>
+
+#include "Abstractions/Webcam.hpp"
+#include "Utility/Common.hpp"
+
+namespace vt
+{
+
+	// Holds the shortest webcam exposure which still meets a signal to noise
+	// target, which reduces motion blur and latency. Each step of the exposure
+	// is compensated by the gain, so that the brightness of the view and thus
+	// the photometric calibration stays valid. The response of the gain is
+	// learned while running, by measuring the brightness change of each write.
+	class ExposureController
+	{
+	public:
+
+		// NOTE: the current exposure of the webcam is the longest that will be used.
+		ExposureController(Webcam& webcam);
+
+		~ExposureController();
+
+		// Measures the raw webcam frame and adjusts the exposure and gain if needed.
+		// NOTE: camera properties are written on another thread, so this never stalls.
+		void update(const Frame& raw_frame);
+
+		// Signal to noise ratio of the last measurement.
+		double snr() const;
+
+		// Whether the webcam is still applying the last write, such as the probe
+		// of the gain, so the brightness of the view doesn't match the calibration.
+		bool settling() const;
+
+	private:
+
+		void write(const std::map<int, double>& properties);
+
+		void writer_process();
+
+		bool measure_response(double& log_ratio) const;
+
+	private:
+
+		Webcam& m_Webcam;
+
+		// Control State
+		double m_MaxExposure, m_MinExposure, m_Exposure;
+		double m_BaseGain, m_Gain;
+		double m_GainSensitivity = 0.0;
+		double m_LastGainStep = 0.0;
+		double m_SNR = 0.0;
+		int m_Frames = 0, m_SettleFrames = 0;
+		int m_Probes = 0, m_Corrections = 0;
+		bool m_ProbingGain = false;
+		bool m_Compensating = false;
+
+		// Measurement Resources
+		cv::Mat m_Sample, m_LastSample, m_Before;
+		Frame m_SampleBuffer, m_GrayBuffer;
+
+		// Writer Thread Resources
+		std::thread m_WriterThread;
+		std::mutex m_WriterMutex;
+		std::condition_variable m_WriterSignal;
+		std::map<int, double> m_PendingWrites;
+		bool m_Runflag = true;
+	};
+
+}
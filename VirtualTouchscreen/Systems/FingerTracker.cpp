@@ -1,6 +1,7 @@
 #include "FingerTracker.hpp"
 
 #include <algorithm>
+#include <array>
 #include <numbers>
 
 #include "../Utility/Common.hpp"
@@ -16,21 +17,79 @@ namespace vt
 
 	// Arc Test Settings
 	constexpr auto ARC_MIN_SCORE = 50;
-	constexpr auto ARC_TEST_LENGTH = 450;
-	constexpr auto NONMAX_PROXIMIITY = 500;
+	constexpr auto ARC_TEST_LENGTH = 450;          // Default, tuned by the settings. 
+	constexpr auto ARC_CENTRE_OFFSET = 15;         // Contour offset of the arc centre. 
+	constexpr auto NONMAX_PROXIMIITY = 500;        // Squared distance. 
 
 	// Tracking Settings
 	constexpr auto MAX_TRACKING_RANGE = 75;
 	constexpr auto MAX_TRACKING_LIFE = 10;
-	constexpr auto FOCUS_RESET_TIME = 10;
+
+	// Focus Settings
+	constexpr auto FOCUS_REGION_SIZE = 256;        // Side of the region around each track.
+	constexpr auto FOCUS_RESCAN_TIME = 10;         // Frames between full frame searches.
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Merges overlapping regions, until none of the merged regions overlap.
+	static void merge_regions(std::vector<cv::Rect>& regions)
+	{
+		for(bool merged = true; merged;)
+		{
+			merged = false;
+			for(size_t i = 0; i < regions.size(); i++)
+			{
+				for(size_t j = i + 1; j < regions.size(); j++)
+				{
+					if((regions[i] & regions[j]).empty())
+						continue;
+
+					regions[i] |= regions[j];
+					std::swap(regions[j--], regions.back());
+					regions.pop_back();
+					merged = true;
+				}
+			}
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	constexpr float arc_char_max(int x)
+	{
+		if(x < 40)
+			return -0.05f * (x * x) + 175;
+		else 
+			return -0.001f * (x * x) + 75.0f; 
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	constexpr float arc_char_min(int x)
+	{
+		return std::max<float>(-0.1f * (x * x) + 50.0f, 10);
+	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
-	FingerTracker::FingerTracker(){}
+	// The angle bounds of the arc test are tabulated at compile 
+	// time, as they only depend on the distance along the arc. 
+	constexpr auto ARC_BOUNDS = []() {
+		std::array<std::pair<float, float>, ARC_TEST_LENGTH + 4> bounds{};
+		for(int i = 0; i < static_cast<int>(bounds.size()); i++)
+			bounds[i] = {arc_char_min(i), arc_char_max(i)};
+		return bounds;
+	}();
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	FingerTracker::FingerTracker()
+		: m_ArcTestLength(ARC_TEST_LENGTH)
+	{}
 
 //---------------------------------------------------------------------------------------------------------------------
 	
-	std::vector<FingerTracker::Fingertip> FingerTracker::detect(const cv::UMat& mask, const cv::UMat& shadow_mask)
+	std::vector<FingerTracker::Fingertip> FingerTracker::detect(const Frame& mask, const Frame& shadow_mask)
 	{
 		std::vector<Fingertip> fingertips;
 
@@ -42,110 +101,141 @@ namespace vt
 		}
 		shadow_mask.copyTo(m_ShadowMask);
 
-		// Update tracking region
-		if(--m_TrackingResetTimer <= 0)
+		// Scale the spatial settings to the screen.
+		m_Scale = static_cast<float>(mask.cols) / SPATIAL_REFERENCE_WIDTH;
+
+		const auto min_contour_area = MIN_CONTOUR_AREA * m_Scale * m_Scale;
+		const auto nonmax_proximity = NONMAX_PROXIMIITY * m_Scale * m_Scale;
+		const auto max_tracking_range = MAX_TRACKING_RANGE * m_Scale;
+		const auto arc_min_score = cvRound(ARC_MIN_SCORE * m_Scale);
+		const auto arc_centre_offset = std::max(cvRound(ARC_CENTRE_OFFSET * m_Scale), 1);
+
+		// The focus regions are only valid for the resolution they were found at.
+		if(mask.size() != m_Resolution)
+			m_FocusRegions.clear();
+		m_Resolution = mask.size();
+
+		// Only search the focus regions around the tracked fingertips, unless nothing
+		// is being tracked or a rescan of the entire frame is due to find new hands.
+		m_SearchRegions.clear();
+		if(--m_RescanTimer <= 0 || m_FocusRegions.empty())
+		{
+			m_SearchRegions.emplace_back(0, 0, mask.cols, mask.rows);
+			m_RescanTimer = FOCUS_RESCAN_TIME;
+		}
+		else
 		{
-			m_TrackingRegion.x = 0;
-			m_TrackingRegion.y = 0;
-			m_TrackingRegion.width = mask.cols;
-			m_TrackingRegion.height = mask.rows;
+			merge_regions(m_FocusRegions);
+			m_SearchRegions.swap(m_FocusRegions);
 		}
+		m_FocusRegions.clear();
 
-        // Find all external contours within the focus area.
 		std::vector<std::vector<cv::Point>> contours;
-		cv::findContours(
-			mask(m_TrackingRegion), 
-			contours, 
-			cv::RETR_EXTERNAL, 
-			cv::CHAIN_APPROX_NONE, 
-			m_TrackingRegion.tl()
-		);
-
-		// Find candidate fingertip arcs in the contours.  
-		for(auto& contour : contours)
+		for(const auto& region : m_SearchRegions)
 		{
-			// Ignore small contours which are likely noise. 
-			const auto area = cv::contourArea(contour);
-			if(area < MIN_CONTOUR_AREA)
-				continue;
+			m_TrackingRegion = region;
 
-			// Draw the contour in the debug render. 
+			// Draw the search region in the debug render.
 			if constexpr (show_tracking_output)
 			{
-				for(const auto& point : contour)
-				{
-					m_DebugRender.at<cv::Vec3b>(point) = cv::Vec3b::all(64);
-				}
+				cv::rectangle(m_DebugRender, region, {96,96,0}, 1);
 			}
 
-			// Get the convex hull of the contour. We assume that the hull
-			// points represent extremities in the mask, and that fingers
-			// will always be at an extremity when pointing outwards. 
-			cv::convexHull(contour, m_Extremities, false, false);
-			if(m_Extremities.empty())
-				continue;
-			
-			// Draw the convex hull in the debug render. 
-			if constexpr (show_tracking_output)
+			// Find all external contours within the region.
+			cv::findContours(
+				mask(m_TrackingRegion), 
+				contours, 
+				cv::RETR_EXTERNAL, 
+				cv::CHAIN_APPROX_NONE, 
+				m_TrackingRegion.tl()
+			);
+
+			// Find candidate fingertip arcs in the contours.  
+			for(auto& contour : contours)
 			{
-				int last_index = m_Extremities.back();
-				for (const auto& index : m_Extremities)
+				// Ignore small contours which are likely noise. 
+				const auto area = cv::contourArea(contour);
+				if(area < min_contour_area)
+					continue;
+
+				// Draw the contour in the debug render. 
+				if constexpr (show_tracking_output)
 				{
-					cv::line(m_DebugRender, contour[last_index], contour[index], {0,0,192}, 1);
-					last_index = index;
+					for(const auto& point : contour)
+					{
+						m_DebugRender.at<cv::Vec3b>(point) = cv::Vec3b::all(64);
+					}
 				}
-			}
-
-			// Find an edge point on the convex hull. This is where
-			// all our tests should begin to avoid cutting an arc. 
-			size_t offset = 0;
-			for(; offset < m_Extremities.size(); offset++)
-			{
-				if(edge_test(contour[m_Extremities[offset]]))
-					break;
-			}
-
-			// Run arc tests for curved extremities, while also 
-			// performing non-max suppression on nearby points. 
-			int last = offset, best = -1, best_score = ARC_MIN_SCORE;
-			for(size_t i = 0; i < m_Extremities.size(); i++)
-			{
-				const auto index = m_Extremities[(offset + i) % m_Extremities.size()];
-				const auto score = arc_score(contour, index);
 
-				// Test if the extremity is part of the latest cluster.
-				const auto v = contour[index] - contour[last];
-				if(v.dot(v) > NONMAX_PROXIMIITY)
+				// Get the convex hull of the contour. We assume that the hull
+				// points represent extremities in the mask, and that fingers
+				// will always be at an extremity when pointing outwards. 
+				cv::convexHull(contour, m_Extremities, false, false);
+				if(m_Extremities.empty())
+					continue;
+			
+				// Draw the convex hull in the debug render. 
+				if constexpr (show_tracking_output)
 				{
-					// Save max point if there is one 
-					if(best != -1)
+					int last_index = m_Extremities.back();
+					for (const auto& index : m_Extremities)
 					{
-						m_Candidates.emplace_back(
-							contour[best],
-							(contour[(best + 15) % contour.size()] + contour[(best - 15 + contour.size())  % contour.size()]) / 2
-						);
+						cv::line(m_DebugRender, contour[last_index], contour[index], {0,0,192}, 1);
+						last_index = index;
 					}
-					
-					// Start a new cluster. 
-					best_score = ARC_MIN_SCORE;
-					last = index;
-					best = -1;
 				}
-				else last = index;
 
-				// Compare score of extremity to the current best in the cluster. 
-				if(score > best_score)
+				// Find an edge point on the convex hull. This is where
+				// all our tests should begin to avoid cutting an arc. 
+				size_t offset = 0;
+				for(; offset < m_Extremities.size(); offset++)
 				{
-					best_score = score;
-					best = index;
+					if(edge_test(contour[m_Extremities[offset]]))
+						break;
 				}
 
-				// Draw the candidate in the debug render. 
-				if constexpr (show_tracking_output)
+				// Run arc tests for curved extremities, while also 
+				// performing non-max suppression on nearby points. 
+				int last = offset, best = -1, best_score = arc_min_score;
+				for(size_t i = 0; i < m_Extremities.size(); i++)
 				{
-					if(score > ARC_MIN_SCORE)
+					const auto index = m_Extremities[(offset + i) % m_Extremities.size()];
+					const auto score = arc_score(contour, index);
+
+					// Test if the extremity is part of the latest cluster.
+					const auto v = contour[index] - contour[last];
+					if(v.dot(v) > nonmax_proximity)
 					{
-						cv::circle(m_DebugRender, contour[index], 1, {255,0,255}, 1);
+						// Save max point if there is one 
+						if(best != -1)
+						{
+							m_Candidates.emplace_back(
+								contour[best],
+								(contour[(best + arc_centre_offset) % contour.size()] + contour[(best - arc_centre_offset + contour.size())  % contour.size()]) / 2
+							);
+						}
+					
+						// Start a new cluster. 
+						best_score = arc_min_score;
+						last = index;
+						best = -1;
+					}
+					else last = index;
+
+					// Compare score of extremity to the current best in the cluster. 
+					if(score > best_score)
+					{
+						best_score = score;
+						best = index;
+					}
+
+					// Draw the candidate in the debug render. 
+					if constexpr (show_tracking_output)
+					{
+						if(score > arc_min_score)
+						{
+							cv::circle(m_DebugRender, contour[index], 1, {255,0,255}, 1);
+						}
 					}
 				}
 			}
@@ -159,7 +249,7 @@ namespace vt
 			int match_index = -1;
 
 			// Find closest candidate within tracking distance.
-			double closest_distance_sqr = std::pow(MAX_TRACKING_RANGE, 2);
+			double closest_distance_sqr = std::pow(max_tracking_range, 2);
 			for(int c = 0; c < m_Candidates.size(); c++)
 			{
 				const auto& candidate = m_Candidates[c];
@@ -217,6 +307,7 @@ namespace vt
 		// Update state for the next run. 
 		m_Candidates.clear();
 		update_tracking_memory(fingertips);
+		update_focus_regions();
 
 		// Output the tracking debug render
 		if constexpr (show_tracking_output)
@@ -236,23 +327,6 @@ namespace vt
 		return fingertips;
 	}
 
-//---------------------------------------------------------------------------------------------------------------------
-
-	float FingerTracker::arc_char_max(int x) const
-	{
-		if(x < 40)
-			return -0.05f * (x * x) + 175;
-		else 
-			return -0.001f * (x * x) + 75.0f; 
-	}
-
-//---------------------------------------------------------------------------------------------------------------------
-
-	float FingerTracker::arc_char_min(int x) const
-	{
-		return std::max<float>(-0.1f * (x * x) + 50.0f, 10);
-	}
-
 //---------------------------------------------------------------------------------------------------------------------
 
 	int FingerTracker::arc_score(const std::vector<cv::Point>& contour, const size_t index) const
@@ -263,11 +337,24 @@ namespace vt
 		if(edge_test(ref))
 			return 0;
 
+		// Walk the contour in both directions, wrapping around its ends as 
+		// often as needed, which short contours can be walked past.
+		const auto size = static_cast<int>(contour.size());
+		int prev_index = static_cast<int>(index) - 4, next_index = static_cast<int>(index) + 4;
+		prev_index = ((prev_index % size) + size) % size;
+		next_index %= size;
+
+		// The arc is tested over the same extent of the screen at any
+		// resolution, so its bounds are looked up at the reference scale.
+		const int test_length = cvRound(m_ArcTestLength * m_Scale);
+
 		int score = 0;
-		for (int i = 4; i < ARC_TEST_LENGTH + 4; i++)
+		for (int i = 4; i < test_length + 4; i++)
 		{
-			const auto& prev = contour[(index - i + contour.size()) % contour.size()];
-			const auto& next = contour[(index + i) % contour.size()];
+			const auto& prev = contour[prev_index];
+			const auto& next = contour[next_index];
+			prev_index = (prev_index == 0) ? size - 1 : prev_index - 1;
+			next_index = (next_index == size - 1) ? 0 : next_index + 1;
 
 			// Finish the test if we hit an edge. 
 			if (edge_test(prev) || edge_test(next))
@@ -275,7 +362,9 @@ namespace vt
 
 			// Test that the angle is within angle bounds. 
 			const auto angle = fmod(360.0f + signed_angle_between(next - ref, prev - ref), 360.0f);
-			if(angle < arc_char_min(i) || angle > arc_char_max(i))
+			const auto bound = std::min<size_t>(cvRound(i / m_Scale), ARC_BOUNDS.size() - 1);
+			const auto& [min_angle, max_angle] = ARC_BOUNDS[bound];
+			if(angle < min_angle || angle > max_angle)
 				break;
 
 			score++;
@@ -318,23 +407,50 @@ namespace vt
 
 //---------------------------------------------------------------------------------------------------------------------
 
-	void FingerTracker::focus(const cv::Point& point, const cv::Size& size)
+	void FingerTracker::update_focus_regions()
+	{
+		// Focus on each live track, including those which were briefly lost.
+		for(const auto& [finger, life] : m_TrackingMemory)
+		{
+			if(const auto region = focus_region(finger.point); !region.empty())
+				m_FocusRegions.push_back(region);
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	cv::Rect FingerTracker::focus_region(const cv::Point& point) const
+	{
+		const int side = cvRound(FOCUS_REGION_SIZE * m_Scale);
+		const cv::Size size(side, side);
+		const cv::Point top_left = point - cv::Point(size / 2);
+		return cv::Rect(top_left, size) & cv::Rect(cv::Point(0, 0), m_Resolution);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void FingerTracker::focus(const cv::Point& point)
 	{
-		const auto half_size = size / 2;
+		if(const auto region = focus_region(point); !region.empty())
+			m_FocusRegions.push_back(region);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
 
-		const cv::Point top_left(
-			std::max(point.x - half_size.width, 0),
-			std::max(point.y - half_size.height, 0)
-		);
+	void FingerTracker::reset()
+	{
+		m_Candidates.clear();
+		m_TrackingMemory.clear();
+		m_FocusRegions.clear();
+		m_RescanTimer = 0;
+	}
 
-		// TODO: get size properly
-		const cv::Point bot_right(
-			std::min(point.x + half_size.width, CALIB_OUTPUT_WIDTH - 1),
-			std::min(point.y + half_size.height, CALIB_OUTPUT_HEIGHT - 1)
-		);
+//---------------------------------------------------------------------------------------------------------------------
 
-		m_TrackingRegion = cv::Rect(top_left, bot_right);
-		m_TrackingResetTimer = FOCUS_RESET_TIME;
+	void FingerTracker::tune(const PipelineSettings& settings)
+	{
+		CV_Assert(settings.arc_test_length > 0);
+		m_ArcTestLength = settings.arc_test_length;
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
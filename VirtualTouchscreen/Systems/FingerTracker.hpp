@@ -4,6 +4,9 @@
 #include <optional>
 #include <vector>
 
+#include "Utility/Common.hpp"
+#include "Utility/Settings.hpp"
+
 namespace vt
 {
 	class FingerTracker
@@ -25,25 +28,39 @@ namespace vt
 
 		FingerTracker();
 
-		std::vector<Fingertip> detect(const cv::UMat& foreground_mask, const cv::UMat& shadow_mask);
+		std::vector<Fingertip> detect(const Frame& foreground_mask, const Frame& shadow_mask);
 
-		void focus(const cv::Point& point, const cv::Size& size);
+		// Also searches the region around the point until the next rescan, on
+		// top of the focus regions around each of the tracked fingertips.
+		void focus(const cv::Point& point);
 
-	private:
+		void reset();
 
-		float arc_char_min(int x) const;
-		
-		float arc_char_max(int x) const;
+		// Use tuned settings for the arc test.
+		void tune(const PipelineSettings& settings);
 
+		// Scores how much the contour curves like a fingertip around the index. 
 		int arc_score(const std::vector<cv::Point>& contour, const size_t index) const;
 
+	private:
+
 		void update_tracking_memory(const std::vector<Fingertip>& fingertips);
 
+		void update_focus_regions();
+
+		cv::Rect focus_region(const cv::Point& point) const;
+
 		bool edge_test(const cv::Point& point) const;
 
 	private:
+		cv::Size m_Resolution;
+		float m_Scale = 1.0f;
+		int m_ArcTestLength;
+
+		// The region being searched, whose edges may cut the contours.
 		cv::Rect m_TrackingRegion;
-		int m_TrackingResetTimer = 0;
+		std::vector<cv::Rect> m_FocusRegions, m_SearchRegions;
+		int m_RescanTimer = 0;
 		inline static size_t m_NextID = 0;
 		
 		cv::Mat m_ShadowMask;
@@ -1,5 +1,6 @@
 #include "MaskGenerator.hpp"
 
+#include <cstring>
 #include <ScreenVision.h>
 
 #include "../Configuration.hpp"
@@ -15,15 +16,167 @@ namespace vt
 
 	// Objects less than threshold are classified as a shadow.
 	constexpr auto SHADOW_OFFSET = 50;
-	constexpr auto NOISE_OFFSET = 15;
 	
 	constexpr auto PREDICTION_RATE_HZ = 60;
 	constexpr auto PREDICTION_RATE_MS = 1000 / PREDICTION_RATE_HZ;
+
+	// Weighting of the BGR channel differences.
+	constexpr float SCORE_WEIGHTS[3] = {0.75f, 0.75f, 1.00f};
+
+	// Deviations of webcam noise that a pixel's threshold is offset by,
+	// relative to the average noise of the view. 
+	constexpr auto NOISE_DEVIATIONS = 2.0;
+
+	// Misregistration between the view and the prediction, in pixels, that
+	// the threshold tolerates at edges. The 3x3 Sobel is 8x the gradient.
+	constexpr auto EDGE_MISREGISTRATION = 0.5;
+	constexpr auto EDGE_GRADIENT_SCALE = EDGE_MISREGISTRATION / 8.0;
+
+	// Frames after a new prediction for which the edge thresholds are rebuilt,
+	// which is as long as the display state takes to transition to it. 
+	constexpr auto EDGE_REBUILD_FRAMES = use_display_transitions ? TRANSITION_FRAMES : 1;
+
+	// Regions per side of the screen whose change rate is tracked, and the mean
+	// change of a region's screen content, in 8-bit levels, that counts as a change.
+	constexpr auto CHANGE_REGIONS = 8;
+	constexpr auto CHANGE_LEVEL = 4.0;
+
+	// The change rate is the smoothed fraction of prediction steps in which a region
+	// changed. Regions fall back above the first rate, and switch back below the second.
+	constexpr auto CHANGE_RATE_SMOOTHING = 0.1f;
+	constexpr auto CHANGE_RATE_FALLBACK = 0.3f;
+	constexpr auto CHANGE_RATE_SETTLED = 0.1f;
+
+	// Weighted difference between webcam frames, in 8-bit levels, above
+	// which a pixel of a fallen back region no longer keeps its last label.
+	constexpr auto TEMPORAL_THRESHOLD = 20.0;
+
+	// Rows per band when streaming, and the number of extra rows
+	// each stage needs to see around the band. The morphology
+	// halos grow by a row for each iteration of the 3x3 kernel.
+	constexpr auto STREAM_TILE_ROWS = 32;
+	constexpr auto SHARPEN_HALO_ROWS = 1;
+	constexpr auto BOX_FILTER_HALO_ROWS = 2;
 	 
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Scores a row of the difference, where the row width is
+	// known at compile time unless WIDTH is zero. The prediction
+	// is corrected by the residual gain and offset, if given, and
+	// the per-pixel noise threshold is subtracted, if given.
+	template<int WIDTH>
+	static void score_row(
+		const cv::Vec3f* view,
+		const cv::Vec3f* prediction,
+		const cv::Vec3f* gain,
+		const cv::Vec3f* offset,
+		const float* threshold,
+		float* score,
+		const int width
+	)
+	{
+		const int cols = (WIDTH > 0) ? WIDTH : width;
+		for(int c = 0; c < cols; c++)
+		{
+			cv::Vec3f predicted = prediction[c];
+			if(gain != nullptr)
+				predicted = predicted.mul(gain[c]) + offset[c];
+
+			const float difference = SCORE_WEIGHTS[0] * std::abs(predicted[0] - view[c][0])
+			                       + SCORE_WEIGHTS[1] * std::abs(predicted[1] - view[c][1])
+			                       + SCORE_WEIGHTS[2] * std::abs(predicted[2] - view[c][2]);
+
+			score[c] = (threshold != nullptr) ? difference - threshold[c] : difference;
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Moves the change rate of each region towards whether its screen content
+	// changed in this prediction step, which it can't without a new frame.
+	static void update_change_rates(const cv::Mat& screen, const bool new_frame, cv::Mat& last_screen, cv::Mat& change, cv::Mat& rates)
+	{
+		cv::Mat region_change;
+		if(new_frame && !last_screen.empty())
+		{
+			cv::absdiff(screen, last_screen, change);
+			cv::resize(change, region_change, rates.size(), 0, 0, cv::INTER_AREA);
+		}
+		if(new_frame)
+			screen.copyTo(last_screen);
+
+		for(int r = 0; r < rates.rows; r++)
+		{
+			float* rate = rates.ptr<float>(r);
+			for(int c = 0; c < rates.cols; c++)
+			{
+				bool changed = false;
+				if(!region_change.empty())
+				{
+					const auto& mean_change = region_change.at<cv::Vec3b>(r, c);
+					changed = std::max({mean_change[0], mean_change[1], mean_change[2]}) > CHANGE_LEVEL;
+				}
+				rate[c] += CHANGE_RATE_SMOOTHING * ((changed ? 1.0f : 0.0f) - rate[c]);
+			}
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	template<typename T>
+	static void score_difference(
+		const T& view,
+		const T& prediction,
+		const T& gain,
+		const T& offset,
+		const T& threshold,
+		T& difference,
+		T& score
+	)
+	{
+		const bool corrected = !gain.empty() && gain.size() == prediction.size();
+		if constexpr (std::is_same_v<T, cv::Mat>)
+		{
+			// On the CPU, the correction, difference and weighting are
+			// fused so that neither the corrected prediction nor the 
+			// difference frame are ever written out. 
+			score.create(view.size(), CV_32FC1);
+			dispatch_width(view.cols, [&](auto width) {
+				constexpr int WIDTH = decltype(width)::value;
+				cv::parallel_for_(cv::Range(0, view.rows), [&](const cv::Range& rows) {
+					for(int r = rows.start; r < rows.end; r++)
+						score_row<WIDTH>(
+							view.template ptr<cv::Vec3f>(r),
+							prediction.template ptr<cv::Vec3f>(r),
+							corrected ? gain.template ptr<cv::Vec3f>(r) : nullptr,
+							corrected ? offset.template ptr<cv::Vec3f>(r) : nullptr,
+							threshold.empty() ? nullptr : threshold.template ptr<float>(r),
+							score.template ptr<float>(r),
+							view.cols
+						);
+				});
+			});
+		}
+		else
+		{
+			if(corrected)
+			{
+				cv::multiply(prediction, gain, difference);
+				cv::add(difference, offset, difference);
+				cv::absdiff(difference, view, difference);
+			}
+			else cv::absdiff(prediction, view, difference);
+			cv::transform(difference, score, cv::Matx13f(SCORE_WEIGHTS[0], SCORE_WEIGHTS[1], SCORE_WEIGHTS[2]));
+			if(!threshold.empty())
+				cv::subtract(score, threshold, score);
+		}
+	}
+
 //---------------------------------------------------------------------------------------------------------------------
 	
-	MaskGenerator::MaskGenerator() 
-		: m_Runflag(false)
+	MaskGenerator::MaskGenerator(const bool use_graph) 
+		: m_UseGraph(use_graph),
+		  m_Runflag(false)
 	{
 		// Initialize light sharpening kernel.
 		cv::Mat({3,3}, {
@@ -41,76 +194,528 @@ namespace vt
 
 //---------------------------------------------------------------------------------------------------------------------
 
-	void MaskGenerator::start(const Webcam& webcam, const ViewCalibrator& calibration)
+	MaskGenerator::~MaskGenerator()
 	{
-		const auto& input_size = calibration.output_resolution();
-		m_NextPrediction.create(input_size, CV_32FC3);
-		m_ForegroundView.create(input_size, CV_8UC3);
-		m_BorderMask.create(input_size, CV_8UC1);
-		m_RawFrame.create(input_size, CV_8UC3);
+		if(m_PredictionThread.joinable())
+			stop();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::prepare(Profiler* profiler)
+	{
+		CV_Assert(!m_PredictionThread.joinable());
+
+		// Start the prediction thread, which will open the screen
+		// capture and then wait for the calibration from start().
+		m_Calibration = std::promise<const ViewCalibrator*>();
+		m_Runflag = true;
+		m_PredictionThread = std::thread(
+			&MaskGenerator::predictor_process,
+			this,
+			m_Calibration.get_future(),
+			profiler
+		);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::warm_up(const cv::Size& resolution)
+	{
+		allocate(resolution);
+
+		Frame view(resolution, CV_8UC3, cv::Scalar::zeros());
+		Frame prediction(resolution, CV_32FC3, cv::Scalar::zeros());
+		Frame foreground_mask, shadow_mask;
+		segment(view, prediction, foreground_mask, shadow_mask);
+
+		// Don't let the blank view leak into the first real frame. 
+		reset();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::reset()
+	{
+		m_BackgroundMask.release();
+
+		// Any thresholds still being built are of the old state, so are skipped.
+		{
+			std::unique_lock lock(m_EdgeMutex);
+			m_AppliedEdgeVersion = m_PublishedEdgeVersion;
+		}
+		m_EdgeThreshold.release();
+		m_EdgeFrames = EDGE_REBUILD_FRAMES;
+
+		m_LastView.release();
+		m_LastForeground.release();
+		m_LastShadow.release();
+		m_ReplayScreen.release();
+		m_RegionModes = cv::Mat::zeros(CHANGE_REGIONS, CHANGE_REGIONS, CV_8UC1);
+		m_RegionRates = cv::Mat::zeros(CHANGE_REGIONS, CHANGE_REGIONS, CV_32FC1);
+
+		if(m_Graph.has_value())
+			m_Graph->reset();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::configure(const ViewCalibrator& calibration)
+	{
+		m_Settings = calibration.settings();
+		const auto resolution = calibration.output_resolution();
+
+		// Pixels which are noisier than average get a higher threshold, and quieter pixels a lower one.
+		const auto& noise_map = calibration.noise_map();
+		if(!noise_map.empty())
+		{
+			const double gain = NOISE_DEVIATIONS * cv::norm(m_SharpeningKernel) * (SCORE_WEIGHTS[0] + SCORE_WEIGHTS[1] + SCORE_WEIGHTS[2]);
+			cv::Mat threshold;
+			cv::resize(noise_map, threshold, resolution, 0, 0, cv::INTER_LINEAR);
+			threshold.convertTo(threshold, CV_32FC1, gain, -gain * cv::mean(noise_map)[0]);
+			threshold.copyTo(m_NoiseThreshold);
+			m_BaseThreshold = threshold;
+		}
+		else
+		{
+			m_NoiseThreshold.release();
+			m_BaseThreshold.release();
+		}
+
+		allocate(resolution);
+		m_AmbientIntensity = calibration.ambient_intensity();
+		m_Residual.configure(resolution);
+		reset();
+
+		if constexpr (use_colour_refinement)
+		{
+			m_ColourEstimator.configure(calibration);
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::allocate(const cv::Size& resolution)
+	{
+		// The noise threshold is only valid for the calibrated resolution.
+		if(m_NoiseThreshold.size() != resolution)
+		{
+			m_NoiseThreshold.release();
+			m_BaseThreshold.release();
+		}
+
+		m_ForegroundView.create(resolution, CV_8UC3);
+		m_BorderMask.create(resolution, CV_8UC1);
 
 		m_BorderMask.setTo(cv::Scalar::zeros());
-		const auto [w, h] = input_size - cv::Size(1, 1);
+		const auto [w, h] = resolution - cv::Size(1, 1);
 		cv::line(m_BorderMask, {0,0}, {w,0}, cv::Scalar(255), 3);
 		cv::line(m_BorderMask, {w,0}, {w,h}, cv::Scalar(255), 3);
 		cv::line(m_BorderMask, {w,h}, {0,h}, cv::Scalar(255), 3);
 		cv::line(m_BorderMask, {0,h}, {0,0}, cv::Scalar(255), 3);
 
-		m_AmbientIntensity = calibration.ambient_intensity();
+		// The graph is compiled for a specific resolution. 
+		if(m_UseGraph)
+		{
+			m_Graph.emplace(
+				resolution,
+				m_SharpeningKernel,
+				m_MorphKernel,
+				m_BorderMask,
+				m_Settings.noise_offset,
+				m_Settings.erode_iterations,
+				m_Settings.dilate_iterations,
+				show_output_prediction
+			);
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::start(const Webcam& webcam, const ViewCalibrator& calibration)
+	{
+		const auto& input_size = calibration.output_resolution();
+		m_NextPrediction.create(input_size, CV_32FC3);
+		configure(calibration);
 
-		// Fill in frame queue
-		m_FrameQueue.resize(prediction_delay);
+		// Fill in frame queue, where predicting on demand only needs the screens.
+		m_FrameQueue.resize(use_prediction_on_demand ? 0 : m_Settings.prediction_delay);
 		for(auto& buffer : m_FrameQueue)
 		{
 			buffer.create(input_size, CV_32FC3);
 			buffer.setTo(cv::Scalar::zeros());
 		}
+
+		m_ScreenQueue.resize(m_Settings.prediction_delay);
+		for(auto& buffer : m_ScreenQueue)
+		{
+			buffer.create(input_size, CV_8UC3);
+			buffer.setTo(cv::Scalar::zeros());
+		}
+		m_ScreenNumbers.assign(m_Settings.prediction_delay, 0);
+		m_ChangeRates = cv::Mat::zeros(CHANGE_REGIONS, CHANGE_REGIONS, CV_32FC1);
 		m_WriteIndex = 0;
 
-		// Start the prediction thread. 
-		m_Runflag = true;
-		m_PredictionThread = std::thread(
-			&MaskGenerator::predictor_process,
-			this,
-			calibration.context()
-		);
+		m_Calibrator = &calibration;
+		m_PredictedMaps.reset();
+		m_Prediction.release();
+		m_PredictedScreen.release();
+		m_DisplayState.release();
+
+		// Hand the calibration over to the prediction thread. 
+		if(!m_PredictionThread.joinable())
+			prepare();
+
+		m_Calibration.set_value(&calibration);
+
+		if constexpr (use_background_residual)
+		{
+			m_Residual.start();
+		}
+
+		if constexpr (use_colour_refinement)
+		{
+			m_ColourEstimator.start();
+		}
+
+		// The edge thresholds are published for the main thread to pick up.
+		if constexpr (use_edge_thresholds)
+		{
+			m_EdgeWorker.start([this](cv::Mat& state) {
+				build_edge_threshold(state, m_WorkerEdges);
+
+				std::unique_lock lock(m_EdgeMutex);
+				std::swap(m_WorkerEdges, m_PublishedEdges);
+				m_PublishedEdgeVersion++;
+			});
+		}
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
-	void MaskGenerator::segment(const cv::UMat& view, cv::UMat& foreground_mask, cv::UMat& shadow_mask)
+	void MaskGenerator::segment(const Frame& view, Frame& foreground_mask, Frame& shadow_mask)
 	{
 		CV_Assert(m_Runflag);
 
-		// Sharpen the input view.
-		cv::filter2D(view, m_View, CV_32FC3, m_SharpeningKernel);
+		// Read the predicted background. 
+		read_prediction(m_Background);
+
+		// The residual is fitted against the uncorrected prediction,
+		// so only corrects it as part of the segmentation.
+		if constexpr (use_background_residual)
+		{
+			m_Residual.update(m_Background.size());
+		}
+		segment(view, m_Background, foreground_mask, shadow_mask);
+
+		if constexpr (use_temporal_fallback)
+		{
+			apply_temporal_fallback(view, foreground_mask, shadow_mask);
+		}
+
+		if constexpr (use_background_residual)
+		{
+			m_Residual.sample(view, m_Background, foreground_mask);
+		}
+
+		if constexpr (use_colour_refinement)
+		{
+			m_ColourEstimator.sample(m_Screen, view, m_Background, foreground_mask, m_Residual.gain(), m_Residual.offset());
+		}
+
+		show_debug_output(foreground_mask, shadow_mask);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::correct_and_segment(
+		const ViewCalibrator& calibration,
+		const Frame& raw_frame,
+		Frame& view,
+		Frame& foreground_mask,
+		Frame& shadow_mask
+	)
+	{
+		CV_Assert(m_Runflag);
 
 		// Read the predicted background. 
 		read_prediction(m_Background);
 
-		// Perform dynamic background subtraction via the
-		// difference between the prediction and webcam view.
-		cv::absdiff(m_Background, m_View, m_Difference);
-		cv::transform(m_Difference, m_Score, cv::Matx13f(0.75f, 0.75f, 1.00f));
+		// The residual is fitted against the uncorrected prediction,
+		// so only corrects it as part of the segmentation.
+		if constexpr (use_background_residual)
+		{
+			m_Residual.update(m_Background.size());
+		}
+		correct_and_segment(calibration, raw_frame, m_Background, view, foreground_mask, shadow_mask);
+
+		if constexpr (use_temporal_fallback)
+		{
+			apply_temporal_fallback(view, foreground_mask, shadow_mask);
+		}
+
+		if constexpr (use_background_residual)
+		{
+			m_Residual.sample(view, m_Background, foreground_mask);
+		}
+
+		if constexpr (use_colour_refinement)
+		{
+			m_ColourEstimator.sample(m_Screen, view, m_Background, foreground_mask, m_Residual.gain(), m_Residual.offset());
+		}
+
+		// The sharpened view is never materialized when streaming.
+		if constexpr (show_output_prediction)
+		{
+			cv::filter2D(view, m_View, CV_32FC3, m_SharpeningKernel);
+		}
+
+		show_debug_output(foreground_mask, shadow_mask);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::correct_and_segment(
+		const ViewCalibrator& calibration,
+		const Frame& raw_frame,
+		const Frame& prediction,
+		Frame& view,
+		Frame& foreground_mask,
+		Frame& shadow_mask
+	)
+	{
+		CV_Assert(prediction.type() == CV_32FC3);
+
+		const auto resolution = calibration.output_resolution();
+		view.create(resolution, CV_8UC3);
+		foreground_mask.create(resolution, CV_8UC1);
+		shadow_mask.create(resolution, CV_8UC1);
+		m_Score.create(resolution, CV_32FC1);
+		m_ForegroundView.create(resolution, CV_8UC1);
+		m_ConnectedMask.create(resolution, CV_8UC1);
+		m_NoiseMask.create(resolution, CV_8UC1);
+		if constexpr (show_output_prediction)
+		{
+			m_RawMask.create(resolution, CV_8UC1);
+		}
+
+		// An empty background mask averages the entire score. 
+		if(m_BackgroundMask.empty())
+		{
+			m_BackgroundMask.create(resolution, CV_8UC1);
+			m_BackgroundMask.setTo(cv::Scalar(255));
+		}
+
+		// The bands write straight into the frames. 
+		cv::Mat view_mat = cv::OutputArray(view).getMat();
+		cv::Mat foreground_mat = cv::OutputArray(foreground_mask).getMat();
+		cv::Mat shadow_mat = cv::OutputArray(shadow_mask).getMat();
+		cv::Mat score_mat = cv::OutputArray(m_Score).getMat();
+		cv::Mat gray_mat = cv::OutputArray(m_ForegroundView).getMat();
+		cv::Mat connected_mat = cv::OutputArray(m_ConnectedMask).getMat();
+		cv::Mat background_mat = cv::OutputArray(m_BackgroundMask).getMat();
+		cv::Mat raw_mask_mat = cv::OutputArray(m_RawMask).getMat();
+		cv::Mat noise_mat = cv::OutputArray(m_NoiseMask).getMat();
+		const cv::Mat border_mat = cv::InputArray(m_BorderMask).getMat();
+		const cv::Mat prediction_mat = cv::InputArray(prediction).getMat();
+		const cv::Mat gain_mat = cv::InputArray(m_Residual.gain()).getMat();
+		const cv::Mat offset_mat = cv::InputArray(m_Residual.offset()).getMat();
+		const bool use_residual = !gain_mat.empty() && gain_mat.size() == resolution;
+		const cv::Mat threshold_mat = cv::InputArray(m_EdgeThreshold.empty() ? m_NoiseThreshold : m_EdgeThreshold).getMat();
+		const cv::Mat sharpening_kernel = cv::InputArray(m_SharpeningKernel).getMat();
+		const cv::Mat morph_kernel = cv::InputArray(m_MorphKernel).getMat();
+
+		const int bands = (resolution.height + STREAM_TILE_ROWS - 1) / STREAM_TILE_ROWS;
+		const auto band_rows = [&](const int band, const int halo) {
+			return cv::Range(
+				std::max(band * STREAM_TILE_ROWS - halo, 0),
+				std::min((band + 1) * STREAM_TILE_ROWS + halo, resolution.height)
+			);
+		};
+
+		// Correct each band along with its halo, then sharpen and score it, 
+		// accumulating the background of the score for the noise floor.
+		std::vector<cv::Vec2d> background_sums(bands);
+		cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+			thread_local cv::Mat corrected, sharpened;
+			for(int b = range.start; b < range.end; b++)
+			{
+				const auto rows = band_rows(b, 0), halo_rows = band_rows(b, SHARPEN_HALO_ROWS);
+				const auto interior = cv::Range(rows.start - halo_rows.start, rows.end - halo_rows.start);
+
+				calibration.correct(raw_frame, corrected, halo_rows);
+				corrected.rowRange(interior).copyTo(view_mat.rowRange(rows));
+				cv::filter2D(corrected, sharpened, CV_32FC3, sharpening_kernel);
+
+				cv::Vec2d sum = {0.0, 0.0};
+				dispatch_width(resolution.width, [&](auto width) {
+					constexpr int WIDTH = decltype(width)::value;
+					for(int r = rows.start; r < rows.end; r++)
+					{
+						float* score = score_mat.ptr<float>(r);
+						const uchar* background = background_mat.ptr<uchar>(r);
+						score_row<WIDTH>(
+							sharpened.ptr<cv::Vec3f>(r - halo_rows.start),
+							prediction_mat.ptr<cv::Vec3f>(r),
+							use_residual ? gain_mat.ptr<cv::Vec3f>(r) : nullptr,
+							use_residual ? offset_mat.ptr<cv::Vec3f>(r) : nullptr,
+							threshold_mat.empty() ? nullptr : threshold_mat.ptr<float>(r),
+							score,
+							resolution.width
+						);
+
+						for(int c = 0; c < resolution.width; c++)
+						{
+							if(background[c] != 0)
+							{
+								sum[0] += score[c];
+								sum[1] += 1.0;
+							}
+						}
+					}
+				});
+				background_sums[b] = sum;
+
+				cv::Mat gray_band = gray_mat.rowRange(rows);
+				cv::cvtColor(view_mat.rowRange(rows), gray_band, cv::COLOR_BGR2GRAY);
+			}
+		});
 
 		// Assume minimal differences belong to background and remove. 
-		const auto noise_floor = cv::mean(m_Score, m_BackgroundMask);
-		cv::threshold(m_Score, m_Score, noise_floor[0] + NOISE_OFFSET, 255, cv::THRESH_BINARY);
-		m_Score.convertTo(foreground_mask, CV_8UC1);
+		cv::Vec2d background_sum = {0.0, 0.0};
+		for(const auto& sum : background_sums)
+			background_sum += sum;
+		const double noise_floor = (background_sum[1] > 0.0) ? background_sum[0] / background_sum[1] : 0.0;
+
+		// Threshold each band and erode it to remove small noises and thin lines. 
+		cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+			thread_local cv::Mat score, mask;
+			for(int b = range.start; b < range.end; b++)
+			{
+				const auto rows = band_rows(b, 0), halo_rows = band_rows(b, m_Settings.erode_iterations);
+				const auto interior = cv::Range(rows.start - halo_rows.start, rows.end - halo_rows.start);
+
+				cv::threshold(score_mat.rowRange(halo_rows), score, noise_floor + m_Settings.noise_offset, 255, cv::THRESH_BINARY);
+				score.convertTo(mask, CV_8UC1);
+
+				if constexpr (show_output_prediction)
+				{
+					mask.rowRange(interior).copyTo(raw_mask_mat.rowRange(rows));
+				}
+
+				cv::erode(mask, mask, morph_kernel, {-1,-1}, m_Settings.erode_iterations);
+				mask.rowRange(interior).copyTo(foreground_mat.rowRange(rows));
+			}
+		});
+
+		// Remove any noise that is not connected to the edge of the screen. 
+		cv::add(foreground_mat, border_mat, noise_mat);
+		cv::floodFill(noise_mat, {0,0}, cv::Scalar(0));
+		cv::subtract(foreground_mat, noise_mat, connected_mat);
+		cv::subtract(connected_mat, border_mat, connected_mat);
+
+		// Dilate and smooth each band, then find its background and shadow. 
+		cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+			thread_local cv::Mat mask;
+			for(int b = range.start; b < range.end; b++)
+			{
+				const auto rows = band_rows(b, 0), halo_rows = band_rows(b, m_Settings.dilate_iterations + BOX_FILTER_HALO_ROWS);
+				const auto interior = cv::Range(rows.start - halo_rows.start, rows.end - halo_rows.start);
+
+				cv::dilate(connected_mat.rowRange(halo_rows), mask, morph_kernel, {-1,-1}, m_Settings.dilate_iterations);
+				cv::boxFilter(mask, mask, -1, cv::Size(5, 5));
+
+				cv::Mat foreground_band = foreground_mat.rowRange(rows);
+				cv::Mat background_band = background_mat.rowRange(rows);
+				cv::Mat gray_band = gray_mat.rowRange(rows);
+				cv::Mat shadow_band = shadow_mat.rowRange(rows);
+
+				cv::threshold(mask.rowRange(interior), foreground_band, 192, 255, cv::THRESH_BINARY);
+				cv::bitwise_not(foreground_band, background_band);
+				gray_band.setTo(cv::Scalar::all(255), background_band);
+				cv::threshold(gray_band, shadow_band, m_AmbientIntensity + SHADOW_OFFSET, 255, cv::THRESH_BINARY_INV);
+			}
+		});
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
 
+	void MaskGenerator::show_debug_output(const Frame& foreground_mask, const Frame& shadow_mask)
+	{
 		// Uncomment to see prediction and background side by side.
 		if constexpr (show_output_prediction)
 		{
-			thread_local cv::UMat n1, n2, n3;
+			thread_local Frame n1, n2, n3;
 			m_View.convertTo(n1, CV_8UC3);
 			m_Background.convertTo(n2, CV_8UC3);
-			cv::cvtColor(foreground_mask, n3, cv::COLOR_GRAY2BGR);
+			cv::cvtColor(m_RawMask, n3, cv::COLOR_GRAY2BGR);
 			vt::imshow_3x1("View vs. Prediction vs. Raw Mask", n1, n2, n3);
 			cv::pollKey();
 		}
 
+		if constexpr (show_backsub_outputs)
+		{
+			cv::imshow("Foreground Mask", foreground_mask);
+			cv::imshow("Shadow Mask", shadow_mask);
+			cv::pollKey();
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::segment(
+		const Frame& view,
+		const Frame& prediction,
+		Frame& foreground_mask,
+		Frame& shadow_mask
+	)
+	{
+		// The threshold is raised near edges of the prediction, if they were built.
+		const auto& threshold = m_EdgeThreshold.empty() ? m_NoiseThreshold : m_EdgeThreshold;
+
+		// The graph fuses the residual correction into its scoring, like score_difference.
+		if(m_Graph.has_value())
+		{
+			const bool corrected = !m_Residual.gain().empty() && m_Residual.gain().size() == prediction.size();
+			m_Graph->apply(
+				view, prediction,
+				corrected ? m_Residual.gain() : Frame(),
+				corrected ? m_Residual.offset() : Frame(),
+				threshold,
+				m_AmbientIntensity + SHADOW_OFFSET,
+				foreground_mask, shadow_mask, 
+				m_RawMask
+			);
+
+			// The graph never materializes the sharpened view.
+			if constexpr (show_output_prediction)
+			{
+				cv::filter2D(view, m_View, CV_32FC3, m_SharpeningKernel);
+			}
+			return;
+		}
+
+		// Sharpen the input view.
+		cv::filter2D(view, m_View, CV_32FC3, m_SharpeningKernel);
+
+		// Perform dynamic background subtraction via the
+		// difference between the prediction and webcam view.
+		// The prediction is corrected by the residual, once it has been fitted.
+		score_difference(m_View, prediction, m_Residual.gain(), m_Residual.offset(), threshold, m_Difference, m_Score);
+
+		// Assume minimal differences belong to background and remove. 
+		const auto noise_floor = cv::mean(m_Score, m_BackgroundMask);
+		cv::threshold(m_Score, m_Score, noise_floor[0] + m_Settings.noise_offset, 255, cv::THRESH_BINARY);
+		m_Score.convertTo(foreground_mask, CV_8UC1);
+
+		// Keep the raw mask around for the debug output.
+		if constexpr (show_output_prediction)
+		{
+			foreground_mask.copyTo(m_RawMask);
+		}
+
 		// Erode the mask to remove remove small noises and thin lines. 
-		cv::erode(foreground_mask, foreground_mask, m_MorphKernel, {-1,-1}, 2);
+		cv::erode(foreground_mask, foreground_mask, m_MorphKernel, {-1,-1}, m_Settings.erode_iterations);
 
 		// Remove any noise that is not connected to the edge of the screen. 
 		cv::add(foreground_mask, m_BorderMask, m_NoiseMask);
@@ -119,7 +724,7 @@ namespace vt
 		cv::subtract(foreground_mask, m_BorderMask, foreground_mask);
 
 		// Dilate the mask and smooth it to remove jagged edges. 
-		cv::dilate(foreground_mask, foreground_mask, m_MorphKernel, {-1,-1}, 2);
+		cv::dilate(foreground_mask, foreground_mask, m_MorphKernel, {-1,-1}, m_Settings.dilate_iterations);
 		cv::boxFilter(foreground_mask, foreground_mask, -1, cv::Size(5, 5));
 		cv::threshold(foreground_mask, foreground_mask, 192, 255, cv::THRESH_BINARY);
 
@@ -128,13 +733,6 @@ namespace vt
 		cv::cvtColor(view, m_ForegroundView, cv::COLOR_BGR2GRAY);
 		m_ForegroundView.setTo(cv::Scalar::all(255), m_BackgroundMask);
 		cv::threshold(m_ForegroundView, shadow_mask, m_AmbientIntensity + SHADOW_OFFSET, 255, cv::THRESH_BINARY_INV);
-
-		if constexpr (show_backsub_outputs)
-		{
-			cv::imshow("Foreground Mask", foreground_mask);
-			cv::imshow("Shadow Mask", shadow_mask);
-			cv::pollKey();
-		}
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -143,12 +741,16 @@ namespace vt
 	{
 		m_Runflag = false;
 		m_PredictionThread.join();
+		m_Residual.stop();
+		m_ColourEstimator.stop();
+		m_EdgeWorker.stop();
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
-	void MaskGenerator::predictor_process(ViewProperties calibration)
+	void MaskGenerator::predictor_process(std::future<const ViewCalibrator*> calibration_future, Profiler* profiler)
 	{
+		const auto open_time = Profiler::Clock::now();
 		auto screen_capture = sv::ScreenCapture::Open(
 			MonitorFromPoint(POINT{MONITOR_OFFSET}, MONITOR_DEFAULTTONEAREST)
 		);
@@ -159,27 +761,79 @@ namespace vt
 			exit(-1);
 		}
 
-		// Create a view calibrator for use with our unique OpenCL context
-		ViewCalibrator calibrator(calibration);
+		if(profiler != nullptr)
+			profiler->record("Open screen source", open_time, Profiler::Clock::now());
+
+		// Wait for the calibration, unless we are stopped before it arrives.
+		while(calibration_future.wait_for(milliseconds(PREDICTION_RATE_MS)) != std::future_status::ready)
+		{
+			if(!m_Runflag) return;
+		}
+		const auto* shared_calibrator = calibration_future.get();
+
+		// Create a view calibrator for use with our unique OpenCL context. 
+		// The CPU native pipeline has no contexts, so can share the original,
+		// as can predicting on demand, where this thread never predicts.
+		std::optional<ViewCalibrator> unique_calibrator;
+		if constexpr (!cpu_native_pipeline && !use_prediction_on_demand)
+		{
+			unique_calibrator.emplace(shared_calibrator->context());
+		}
+		const auto& calibrator = unique_calibrator.has_value() ? *unique_calibrator : *shared_calibrator;
 		
 
 		// Initialize buffer resources
-		const auto buffer_size = calibration.output_resolution;
+		const auto buffer_size = calibrator.output_resolution();
 		cv::UMat raw_capture(buffer_size, CV_8UC4), resize_buffer(buffer_size, CV_8UC3);
 		cv::Mat prediction_buffer(buffer_size, CV_32FC3), frame_buffer(buffer_size, CV_8UC3);
+		cv::Mat last_frame, change_buffer, change_rates = cv::Mat::zeros(CHANGE_REGIONS, CHANGE_REGIONS, CV_32FC1);
+
+		// Run a synthetic frame through the prediction so that its kernels 
+		// are built and its buffers are touched before the first real frame.
+		// Predicting on demand builds them on the main loop's warm-up instead.
+		if constexpr (!use_prediction_on_demand)
+		{
+			cv::randu(raw_capture, cv::Scalar::all(0), cv::Scalar::all(255));
+			cv::cvtColor(raw_capture, resize_buffer, cv::COLOR_BGRA2BGR);
+			cv::resize(resize_buffer, frame_buffer, buffer_size);
+			calibrator.predict(frame_buffer, prediction_buffer);
+		}
+
+		// The buffers are pushed onto the queue until the first screen frame arrives,
+		// so the synthetic frame is replaced by the blank frame the queue starts with.
+		frame_buffer.setTo(cv::Scalar::zeros());
+		prediction_buffer.setTo(cv::Scalar::zeros());
+		uint64_t screen_number = 0;
 
 		while(m_Runflag)
 		{
 			// Capture the screen buffer of the monitor. 
 			const auto start_time = high_resolution_clock::now();
-			if(bool new_frame = screen_capture->read(raw_capture, PREDICTION_RATE_MS - 1); new_frame)
+			const bool new_frame = screen_capture->read(raw_capture, PREDICTION_RATE_MS - 1);
+			if(new_frame)
 			{
 				// If we have a new frame (screen buffer changed) then 
 				// downsample and predict its projector-camera output. 
 				cv::cvtColor(raw_capture, resize_buffer, cv::COLOR_BGRA2BGR);
-				cv::resize(resize_buffer, frame_buffer, calibration.output_resolution);
+				cv::resize(resize_buffer, frame_buffer, buffer_size);
+				screen_number++;
 				
-				calibrator.predict(frame_buffer, prediction_buffer);
+				if constexpr (!use_prediction_on_demand)
+				{
+					if constexpr (use_colour_refinement)
+					{
+						// Swap in the latest refinement of the colour maps.
+						const auto colour_maps = m_ColourEstimator.colour_maps();
+						calibrator.predict(frame_buffer, prediction_buffer, *colour_maps);
+					}
+					else calibrator.predict(frame_buffer, prediction_buffer);
+				}
+			}
+
+			// Track how often each region of the screen changes.
+			if constexpr (use_temporal_fallback)
+			{
+				update_change_rates(frame_buffer, new_frame, last_frame, change_buffer, change_rates);
 			}
 
 			// Ensure we always meet the prediction rate timing.   
@@ -191,29 +845,341 @@ namespace vt
 				std::unique_lock lock(m_PredictionMutex);
 
 				// Push latest frame onto the frame queue
-				prediction_buffer.copyTo(m_FrameQueue[m_WriteIndex]);
-				m_WriteIndex = (m_WriteIndex + 1) % m_FrameQueue.size();
+				if constexpr (!use_prediction_on_demand)
+				{
+					prediction_buffer.copyTo(m_FrameQueue[m_WriteIndex]);
+				}
+				frame_buffer.copyTo(m_ScreenQueue[m_WriteIndex]);
+				m_ScreenNumbers[m_WriteIndex] = screen_number;
+				change_rates.copyTo(m_ChangeRates);
+				m_WriteIndex = (m_WriteIndex + 1) % m_ScreenQueue.size();
+			}
+		}
+	}
 
-				frame_buffer.copyTo(m_RawFrame);
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::read_prediction(Frame& dst)
+	{
+		uint64_t screen_number = 0;
+		{
+			std::unique_lock lock(m_PredictionMutex);
+
+			// NOTE: read index is write index due to 
+			// other thread incrementing it after writing 
+			if constexpr (!use_prediction_on_demand)
+			{
+				if constexpr (use_display_transitions)
+					m_FrameQueue[m_WriteIndex].copyTo(m_Prediction);
+				else
+					m_FrameQueue[m_WriteIndex].copyTo(dst);
+			}
+
+			// The colour refinement needs the screen that was predicted.
+			if(m_KeepScreen || use_colour_refinement || use_prediction_on_demand)
+			{
+				m_ScreenQueue[m_WriteIndex].copyTo(m_Screen);
+			}
+			screen_number = m_ScreenNumbers[m_WriteIndex];
+
+			if constexpr (use_temporal_fallback)
+			{
+				m_ChangeRates.copyTo(m_RegionRates);
 			}
+
+			if constexpr (show_raw_projector_input)
+			{
+				cv::imshow("Raw Frame", m_ScreenQueue[m_WriteIndex]);
+				cv::pollKey();
+			}
+		}
+
+		if constexpr (use_prediction_on_demand)
+		{
+			predict_changes(*m_Calibrator, screen_number);
+		}
+		else if(screen_number != m_EdgeScreen)
+		{
+			m_EdgeFrames = EDGE_REBUILD_FRAMES;
+		}
+		m_EdgeScreen = screen_number;
+
+		// The display may still be part way through showing the new screen.
+		if constexpr (use_display_transitions)
+		{
+			m_Calibrator->transition(m_Prediction, m_DisplayState);
+			m_DisplayState.copyTo(dst);
+		}
+		else if constexpr (use_prediction_on_demand)
+		{
+			m_Prediction.copyTo(dst);
+		}
+
+		// The edges are of the state that is segmented against.
+		if constexpr (use_edge_thresholds)
+		{
+			update_edge_threshold(dst);
 		}
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
-	void MaskGenerator::read_prediction(cv::UMat& dst)
+	void MaskGenerator::predict_changes(const ViewCalibrator& calibration, const uint64_t screen_number)
 	{
-		std::unique_lock lock(m_PredictionMutex);
+		std::shared_ptr<const ColourGrid> colour_maps;
+		if constexpr (use_colour_refinement)
+		{
+			colour_maps = m_ColourEstimator.colour_maps();
+		}
 
-		// NOTE: read index is write index due to 
-		// other thread incrementing it after writing 
-		m_FrameQueue[m_WriteIndex].copyTo(dst);
+		// The screen rarely changes between webcam frames, and then often only in part,
+		// such as a line of text or the cursor, so only the band of rows which changed
+		// since the last prediction is predicted. The whole screen is predicted at
+		// first, and whenever the colour maps were refined.
+		cv::Range rows(0, m_Screen.rows);
+		if(!m_Prediction.empty() && colour_maps == m_PredictedMaps && m_PredictedScreen.size() == m_Screen.size())
+		{
+			if(screen_number == m_PredictedNumber)
+				return;
 
-		if constexpr (show_raw_projector_input)
+			const size_t row_bytes = m_Screen.cols * m_Screen.elemSize();
+			const auto changed = [&](const int r) {
+				return std::memcmp(m_Screen.ptr(r), m_PredictedScreen.ptr(r), row_bytes) != 0;
+			};
+			while(rows.start < rows.end && !changed(rows.start))
+				rows.start++;
+			while(rows.end > rows.start && !changed(rows.end - 1))
+				rows.end--;
+		}
+		else
 		{
-			cv::imshow("Raw Frame", m_RawFrame);
-			cv::pollKey();
+			m_Prediction.create(m_Screen.size(), CV_32FC3);
+			m_PredictedScreen.create(m_Screen.size(), m_Screen.type());
+		}
+
+		calibration.predict(m_Screen, m_Prediction, colour_maps != nullptr ? *colour_maps : calibration.colour_maps(), rows);
+		m_Screen.rowRange(rows).copyTo(m_PredictedScreen.rowRange(rows));
+
+		m_PredictedNumber = screen_number;
+		m_PredictedMaps = colour_maps;
+		if(!rows.empty())
+			m_EdgeFrames = EDGE_REBUILD_FRAMES;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::predict_on_demand(const ViewCalibrator& calibration, const cv::Mat& screen, const uint64_t screen_number, Frame& dst)
+	{
+		screen.copyTo(m_Screen);
+		predict_changes(calibration, screen_number);
+		m_Prediction.copyTo(dst);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::keep_screen(const bool enable)
+	{
+		m_KeepScreen = enable;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::skip()
+	{
+		CV_Assert(m_Runflag);
+
+		read_prediction(m_Background);
+
+		// The next view is not compared against the skipped views.
+		m_LastView.release();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const cv::Mat& MaskGenerator::screen() const
+	{
+		return m_Screen;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::apply_temporal_fallback(const Frame& view, Frame& foreground_mask, Frame& shadow_mask)
+	{
+		// Switch the regions between the segmentations, where the hysteresis keeps a
+		// region from flickering between them while its change rate is borderline.
+		bool any_fallback = false;
+		for(int r = 0; r < CHANGE_REGIONS; r++)
+		{
+			const float* rate = m_RegionRates.ptr<float>(r);
+			uchar* mode = m_RegionModes.ptr<uchar>(r);
+			for(int c = 0; c < CHANGE_REGIONS; c++)
+			{
+				if(mode[c] == 0 && rate[c] > CHANGE_RATE_FALLBACK)
+				{
+					mode[c] = 255;
+					m_Fallbacks++;
+				}
+				else if(mode[c] != 0 && rate[c] < CHANGE_RATE_SETTLED)
+				{
+					mode[c] = 0;
+					m_Recoveries++;
+				}
+				any_fallback |= mode[c] != 0;
+			}
 		}
+
+		if(any_fallback && !m_LastView.empty())
+		{
+			// Regions which had, or bordered, some foreground are occupied by a hand.
+			cv::resize(m_LastForeground, m_Occupancy, m_RegionModes.size(), 0, 0, cv::INTER_AREA);
+			cv::dilate(m_Occupancy, m_Occupancy, cv::Mat());
+
+			// Each run of fallen back regions along a row is relabelled at once, where pixels
+			// that changed between webcam frames keep the predicted label. Pixels that stayed
+			// still keep their last label if the run is occupied. Otherwise they are background,
+			// so a hand entering the run is a change which the prediction confirms.
+			const auto resolution = view.size();
+			const cv::Matx13f weights(SCORE_WEIGHTS[0], SCORE_WEIGHTS[1], SCORE_WEIGHTS[2]);
+			for(int r = 0; r < CHANGE_REGIONS; r++)
+			{
+				const uchar* mode = m_RegionModes.ptr<uchar>(r);
+				const uchar* occupancy = m_Occupancy.ptr<uchar>(r);
+				for(int start = 0; start < CHANGE_REGIONS; start++)
+				{
+					if(mode[start] == 0) continue;
+
+					int end = start;
+					bool occupied = false;
+					for(; end < CHANGE_REGIONS && mode[end] != 0; end++)
+						occupied |= occupancy[end] != 0;
+
+					const int x0 = start * resolution.width / CHANGE_REGIONS;
+					const int x1 = end * resolution.width / CHANGE_REGIONS;
+					const int y0 = r * resolution.height / CHANGE_REGIONS;
+					const int y1 = (r + 1) * resolution.height / CHANGE_REGIONS;
+					const cv::Rect region(x0, y0, x1 - x0, y1 - y0);
+
+					cv::absdiff(view(region), m_LastView(region), m_TemporalDifference);
+					cv::transform(m_TemporalDifference, m_TemporalScore, weights);
+					cv::compare(m_TemporalScore, TEMPORAL_THRESHOLD, m_StableMask, cv::CMP_LE);
+
+					Frame foreground_region = foreground_mask(region);
+					Frame shadow_region = shadow_mask(region);
+					if(occupied)
+					{
+						m_LastForeground(region).copyTo(foreground_region, m_StableMask);
+						m_LastShadow(region).copyTo(shadow_region, m_StableMask);
+					}
+					else
+					{
+						foreground_region.setTo(cv::Scalar::zeros(), m_StableMask);
+						shadow_region.setTo(cv::Scalar::zeros(), m_StableMask);
+					}
+
+					start = end;
+				}
+			}
+		}
+
+		view.copyTo(m_LastView);
+		foreground_mask.copyTo(m_LastForeground);
+		shadow_mask.copyTo(m_LastShadow);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::track_changes(const cv::Mat& screen)
+	{
+		update_change_rates(screen, true, m_ReplayScreen, m_ReplayChange, m_RegionRates);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::report_modes(std::ostream& stream)
+	{
+		stream << cv::format(
+			"Segmentation: %d/%d regions temporal, %llu fallbacks, %llu recoveries\n",
+			cv::countNonZero(m_RegionModes), CHANGE_REGIONS * CHANGE_REGIONS,
+			static_cast<unsigned long long>(m_Fallbacks),
+			static_cast<unsigned long long>(m_Recoveries)
+		);
+		m_Fallbacks = 0;
+		m_Recoveries = 0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::threshold_edges(const cv::Mat& prediction)
+	{
+		build_edge_threshold(prediction, m_EdgeBuffer);
+		m_EdgeBuffer.copyTo(m_EdgeThreshold);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::update_edge_threshold(const Frame& state)
+	{
+		// Pick up the latest thresholds published by the edge worker.
+		{
+			std::unique_lock lock(m_EdgeMutex);
+			if(m_PublishedEdgeVersion != m_AppliedEdgeVersion)
+			{
+				if(m_PublishedEdges.size() == state.size())
+					m_PublishedEdges.copyTo(m_EdgeThreshold);
+				m_AppliedEdgeVersion = m_PublishedEdgeVersion;
+			}
+		}
+
+		// The thresholds are rebuilt on the edge worker, so lag the segmentation by a
+		// frame or so and only cost this thread a copy of the display state. It only
+		// changes while it transitions to a new prediction, so is only handed to the
+		// worker until then, and never while it's busy.
+		if(m_EdgeFrames > 0 && m_EdgeWorker.idle())
+		{
+			state.copyTo(m_EdgeState);
+			if(m_EdgeWorker.submit(m_EdgeState))
+				m_EdgeFrames--;
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void MaskGenerator::build_edge_threshold(const cv::Mat& prediction, cv::Mat& dst) const
+	{
+		CV_Assert(prediction.type() == CV_32FC3);
+		CV_Assert(m_BaseThreshold.empty() || m_BaseThreshold.size() == prediction.size());
+
+		// NOTE: this runs on the edge worker too, so keeps its own buffers,
+		// which are bound by reference for the workers of the parallel loop.
+		thread_local cv::Mat gradient_x, gradient_y;
+		cv::Sobel(prediction, gradient_x, CV_32F, 1, 0, 3, EDGE_GRADIENT_SCALE);
+		cv::Sobel(prediction, gradient_y, CV_32F, 0, 1, 3, EDGE_GRADIENT_SCALE);
+		const cv::Mat& gradients_x = gradient_x;
+		const cv::Mat& gradients_y = gradient_y;
+
+		// A misregistration of the view differs from the prediction by about the
+		// gradient, leaving thin lines along edges such as text that the morphology
+		// would otherwise have to erode. So the gradient, weighted as in the score,
+		// is added on top of the noise threshold.
+		dst.create(prediction.size(), CV_32FC1);
+		cv::parallel_for_(cv::Range(0, prediction.rows), [&](const cv::Range& rows) {
+			for(int r = rows.start; r < rows.end; r++)
+			{
+				const auto* gx = gradients_x.ptr<cv::Vec3f>(r);
+				const auto* gy = gradients_y.ptr<cv::Vec3f>(r);
+				const float* base = m_BaseThreshold.empty() ? nullptr : m_BaseThreshold.ptr<float>(r);
+				float* threshold = dst.ptr<float>(r);
+
+				for(int c = 0; c < prediction.cols; c++)
+				{
+					float edge = 0.0f;
+					for(int k = 0; k < 3; k++)
+						edge += SCORE_WEIGHTS[k] * (std::abs(gx[c][k]) + std::abs(gy[c][k]));
+
+					threshold[c] = (base != nullptr) ? base[c] + edge : edge;
+				}
+			}
+		});
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
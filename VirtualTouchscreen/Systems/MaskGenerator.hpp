@@ -2,9 +2,16 @@
 
 #include <opencv2/opencv.hpp>
 #include <ScreenVision.h>
+#include <ostream>
+#include <future>
 #include <thread>
 
 #include "ViewCalibrator.hpp"
+#include "SegmentationGraph.hpp"
+#include "BackgroundResidual.hpp"
+#include "ColourMapEstimator.hpp"
+#include "Utility/Profiler.hpp"
+#include "Utility/Worker.hpp"
 
 namespace vt
 {
@@ -13,39 +20,164 @@ namespace vt
 	{
 	public:
 
-		MaskGenerator();
+		MaskGenerator(const bool use_graph = use_gapi_segmentation);
 
+		~MaskGenerator();
+
+		// Opens the screen source ahead of start() so that it
+		// can initialize while the view is being calibrated.
+		void prepare(Profiler* profiler = nullptr);
+
+		// Prepares the segmentation for the given calibration.
+		void configure(const ViewCalibrator& calibration);
+
+		// Runs the segmentation on a blank view to build its kernels.
+		void warm_up(const cv::Size& resolution);
+
+		// Forgets any state carried over from previous frames.
+		void reset();
+
+		// NOTE: the calibration is shared with the prediction thread, so must outlive it. 
 		void start(const Webcam& webcam, const ViewCalibrator& calibration);
 
-		void segment(const cv::UMat& view, cv::UMat& foreground_mask, cv::UMat& shadow_mask);
+		void segment(const Frame& view, Frame& foreground_mask, Frame& shadow_mask);
+
+		// NOTE: the prediction is corrected by the background residual while it is
+		// scored, once one has been fitted, so is given without the correction. 
+		void segment(const Frame& view, const Frame& prediction, Frame& foreground_mask, Frame& shadow_mask);
+
+		// Corrects and segments the view in bands of rows, so that each band stays
+		// in cache through all the stages which don't depend on the entire frame. 
+		void correct_and_segment(
+			const ViewCalibrator& calibration,
+			const Frame& raw_frame,
+			Frame& view,
+			Frame& foreground_mask,
+			Frame& shadow_mask
+		);
+
+		void correct_and_segment(
+			const ViewCalibrator& calibration,
+			const Frame& raw_frame,
+			const Frame& prediction,
+			Frame& view,
+			Frame& foreground_mask,
+			Frame& shadow_mask
+		);
 
 		void stop();
+
+		// Keeps a copy of the screen frame that each prediction was made from.
+		void keep_screen(const bool enable);
+
+		// Reads the next prediction without segmenting, for views that can't be trusted,
+		// so that the prediction stays in step with the display. Nothing is sampled.
+		void skip();
+
+		// The screen frame of the last prediction, if kept.
+		const cv::Mat& screen() const;
+
+		// Predicts the screen as its prediction is read when predicting on demand,
+		// for benchmarks without the prediction thread, where each new screen has
+		// a new number and repeats of the last screen reuse its prediction.
+		void predict_on_demand(const ViewCalibrator& calibration, const cv::Mat& screen, const uint64_t screen_number, Frame& dst);
+
+		// Raises the threshold near the edges of the prediction for the following
+		// segmentations right away, for replays without the prediction thread.
+		// Otherwise, they are built on a worker from the display state.
+		void threshold_edges(const cv::Mat& prediction);
+
+		// Tracks how often each region of the screen changes, for replays without
+		// the prediction thread, which otherwise tracks it from every screen frame.
+		void track_changes(const cv::Mat& screen);
+
+		// Follows the last masks in the regions of the screen which change too often
+		// to predict. This is applied whenever the prediction is read, so is only
+		// needed by replays which segment against their own predictions. 
+		void apply_temporal_fallback(const Frame& view, Frame& foreground_mask, Frame& shadow_mask);
+
+		// Reports how many regions switched between the predicted and
+		// temporal segmentation since the last report, then clears them.
+		void report_modes(std::ostream& stream);
 	
 	private:
 
-		void predictor_process(ViewProperties properties);
+		void allocate(const cv::Size& resolution);
+
+		void predictor_process(std::future<const ViewCalibrator*> calibration, Profiler* profiler);
+
+		void read_prediction(Frame& dst);
+
+		void predict_changes(const ViewCalibrator& calibration, const uint64_t screen_number);
+
+		void build_edge_threshold(const cv::Mat& prediction, cv::Mat& dst) const;
+
+		void update_edge_threshold(const Frame& state);
 
-		void read_prediction(cv::UMat& dst);
+		void show_debug_output(const Frame& foreground_mask, const Frame& shadow_mask);
 	
 	private:
 
-		cv::UMat m_View, m_Background, m_Difference, m_Score;
-		cv::UMat m_ForegroundView, m_BackgroundMask;
-		cv::UMat m_SharpeningKernel, m_MorphKernel;
-		cv::UMat m_NoiseMask, m_BorderMask;
+		Frame m_View, m_Background, m_Difference, m_Score;
+		Frame m_ForegroundView, m_BackgroundMask, m_RawMask;
+		Frame m_SharpeningKernel, m_MorphKernel;
+		Frame m_NoiseMask, m_BorderMask, m_ConnectedMask;
+		Frame m_NoiseThreshold;
+		cv::Mat m_BaseThreshold;
 		float m_AmbientIntensity = 0.0f;
+		PipelineSettings m_Settings;
 
+		// Graph Segmentation
+		const bool m_UseGraph;
+		std::optional<SegmentationGraph> m_Graph;
+
+		// Background Residual
+		BackgroundResidual m_Residual;
+
+		// Colour Map Refinement
+		ColourMapEstimator m_ColourEstimator;
 		
 		// Capture Thread Resources
 		std::thread m_PredictionThread;
 		std::mutex m_PredictionMutex;
+		std::promise<const ViewCalibrator*> m_Calibration;
 		cv::Mat m_NextPrediction;
-		cv::Mat m_RawFrame;
+		cv::Mat m_Screen;
+		bool m_KeepScreen = false;
 		bool m_Runflag;
 
 		// Frame Queue
+		// Each screen frame is numbered, so that repeats can be recognized.
 		std::vector<cv::Mat> m_FrameQueue;
+		std::vector<cv::Mat> m_ScreenQueue;
+		std::vector<uint64_t> m_ScreenNumbers;
 		size_t m_WriteIndex = 0;
+
+		// On Demand Prediction
+		const ViewCalibrator* m_Calibrator = nullptr;
+		std::shared_ptr<const ColourGrid> m_PredictedMaps;
+		cv::Mat m_Prediction, m_PredictedScreen;
+		uint64_t m_PredictedNumber = 0;
+
+		// Display Transitions
+		cv::Mat m_DisplayState;
+
+		// Edge Thresholds
+		// The thresholds are built on the edge worker, which publishes them. 
+		Frame m_EdgeThreshold;
+		cv::Mat m_EdgeBuffer, m_EdgeState, m_WorkerEdges, m_PublishedEdges;
+		Worker<cv::Mat> m_EdgeWorker;
+		std::mutex m_EdgeMutex;
+		uint64_t m_EdgeScreen = 0, m_PublishedEdgeVersion = 0, m_AppliedEdgeVersion = 0;
+		int m_EdgeFrames = 0;
+
+		// Temporal Fallback
+		// The change rates of the screen regions are shared with the prediction thread.
+		cv::Mat m_ChangeRates, m_RegionRates, m_RegionModes, m_Occupancy;
+		cv::Mat m_ReplayScreen, m_ReplayChange;
+		Frame m_LastView, m_LastForeground, m_LastShadow;
+		Frame m_TemporalDifference, m_TemporalScore, m_StableMask;
+		uint64_t m_Fallbacks = 0, m_Recoveries = 0;
 	};
 
 
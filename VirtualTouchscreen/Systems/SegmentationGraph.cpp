@@ -0,0 +1,351 @@
+#include "SegmentationGraph.hpp"
+
+#include <opencv2/gapi/core.hpp>
+#include <opencv2/gapi/imgproc.hpp>
+#include <opencv2/gapi/fluid/core.hpp>
+#include <opencv2/gapi/fluid/imgproc.hpp>
+#include <opencv2/gapi/fluid/gfluidkernel.hpp>
+#include <opencv2/gapi/cpu/gcpukernel.hpp>
+
+namespace vt
+{
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Sharpens the view, then scores its weighted difference to the prediction, corrected 
+	// by the residual gain and offset, less the per-pixel threshold of the score.
+	G_API_OP(
+		GSharpenDifference,
+		<cv::GMat(cv::GMat, cv::GMat, cv::GMat, cv::GMat, cv::GMat, cv::Mat, cv::Scalar)>,
+		"vt.segmentation.sharpen_difference"
+	)
+	{
+		static cv::GMatDesc outMeta(
+			const cv::GMatDesc& view, const cv::GMatDesc&, const cv::GMatDesc&, const cv::GMatDesc&,
+			const cv::GMatDesc&, const cv::Mat&, const cv::Scalar&
+		)
+		{
+			return view.withType(CV_32F, 1);
+		}
+	};
+
+	// Thresholds the score above the mean of its masked background, plus an offset.
+	G_API_OP(GNoiseThreshold, <cv::GMat(cv::GMat, cv::GMat, double)>, "vt.segmentation.noise_threshold")
+	{
+		static cv::GMatDesc outMeta(const cv::GMatDesc& score, const cv::GMatDesc&, double)
+		{
+			return score.withType(CV_8U, 1);
+		}
+	};
+
+	// Smooths the jagged edges of the mask with a 5x5 box filter, then thresholds it.
+	G_API_OP(GSmoothMask, <cv::GMat(cv::GMat)>, "vt.segmentation.smooth_mask")
+	{
+		static cv::GMatDesc outMeta(const cv::GMatDesc& mask)
+		{
+			return mask;
+		}
+	};
+
+	// Removes anything from the mask which isn't connected to the border. 
+	G_API_OP(GBorderConnected, <cv::GMat(cv::GMat, cv::GMat)>, "vt.segmentation.border_connected")
+	{
+		static cv::GMatDesc outMeta(const cv::GMatDesc& mask, const cv::GMatDesc&)
+		{
+			return mask;
+		}
+	};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Scores a row of the view, where the rows are those above, at and below it, 
+	// each with a pixel of border either side, and the sharpened row is scratch.
+	// NOTE: same as the sharpening filter2D and score_row of the eager implementation.
+	static void sharpen_difference_row(
+		const uchar* const rows[3],
+		const cv::Vec3f* prediction,
+		const cv::Vec3f* gain,
+		const cv::Vec3f* offset,
+		const float* threshold,
+		const float* kernel,
+		const cv::Vec3f& weights,
+		float* sharpened,
+		float* score,
+		const int width
+	)
+	{
+		// The channels are interleaved, so every tap of the kernel is a fixed
+		// offset away and the whole row is sharpened as one flat array. 
+		for(int i = 0, elements = width * 3; i < elements; i++)
+		{
+			float total = 0.0f;
+			for(int ky = 0; ky < 3; ky++)
+				for(int kx = 0; kx < 3; kx++)
+					total += kernel[ky * 3 + kx] * rows[ky][i + (kx - 1) * 3];
+			sharpened[i] = total;
+		}
+
+		const auto* view = reinterpret_cast<const cv::Vec3f*>(sharpened);
+		for(int c = 0; c < width; c++)
+		{
+			const cv::Vec3f predicted = prediction[c].mul(gain[c]) + offset[c];
+			const float difference = weights[0] * std::abs(predicted[0] - view[c][0])
+			                       + weights[1] * std::abs(predicted[1] - view[c][1])
+			                       + weights[2] * std::abs(predicted[2] - view[c][2]);
+
+			score[c] = difference - threshold[c];
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	GAPI_FLUID_KERNEL(GFluidSharpenDifference, GSharpenDifference, true)
+	{
+		static const int Window = 3;
+
+		static void run(
+			const cv::gapi::fluid::View& view,
+			const cv::gapi::fluid::View& prediction,
+			const cv::gapi::fluid::View& gain,
+			const cv::gapi::fluid::View& offset,
+			const cv::gapi::fluid::View& threshold,
+			const cv::Mat& kernel,
+			const cv::Scalar& weights,
+			cv::gapi::fluid::Buffer& score,
+			cv::gapi::fluid::Buffer& scratch
+		)
+		{
+			const uchar* const rows[3] = {view.InLine<uchar>(-1), view.InLine<uchar>(0), view.InLine<uchar>(1)};
+			sharpen_difference_row(
+				rows,
+				prediction.InLine<cv::Vec3f>(0),
+				gain.InLine<cv::Vec3f>(0),
+				offset.InLine<cv::Vec3f>(0),
+				threshold.InLine<float>(0),
+				kernel.ptr<float>(),
+				cv::Vec3f(weights[0], weights[1], weights[2]),
+				scratch.OutLine<float>(),
+				score.OutLine<float>(),
+				score.length()
+			);
+		}
+
+		// The scratch holds a sharpened row of the view. 
+		static void initScratch(
+			const cv::GMatDesc& view, const cv::GMatDesc&, const cv::GMatDesc&, const cv::GMatDesc&,
+			const cv::GMatDesc&, const cv::Mat&, const cv::Scalar&, cv::gapi::fluid::Buffer& scratch
+		)
+		{
+			scratch = cv::gapi::fluid::Buffer(cv::GMatDesc(CV_32F, 3, cv::Size(view.size.width, 1)));
+		}
+
+		static void resetScratch(cv::gapi::fluid::Buffer&)
+		{}
+
+		static cv::gapi::fluid::Border getBorder(
+			const cv::GMatDesc&, const cv::GMatDesc&, const cv::GMatDesc&, const cv::GMatDesc&,
+			const cv::GMatDesc&, const cv::Mat&, const cv::Scalar&
+		)
+		{
+			// Matches the default border of filter2D. 
+			return {cv::BORDER_REFLECT_101, cv::Scalar()};
+		}
+	};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// NOTE: the Fluid threshold doesn't support floating point scores, and the noise
+	// floor needs the entire score anyway, so the threshold is done along with it.
+	GAPI_OCV_KERNEL(GCPUNoiseThreshold, GNoiseThreshold)
+	{
+		static void run(const cv::Mat& score, const cv::Mat& mask, double offset, cv::Mat& raw_mask)
+		{
+			thread_local cv::Mat thresholded;
+			const double noise_floor = cv::mean(score, mask)[0] + offset;
+			cv::threshold(score, thresholded, noise_floor, 255, cv::THRESH_BINARY);
+			thresholded.convertTo(raw_mask, CV_8U);
+		}
+	};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// NOTE: the Fluid box filter only supports a 3x3 kernel.
+	GAPI_OCV_KERNEL(GCPUSmoothMask, GSmoothMask)
+	{
+		static void run(const cv::Mat& mask, cv::Mat& smoothed)
+		{
+			cv::boxFilter(mask, smoothed, -1, cv::Size(5, 5));
+			cv::threshold(smoothed, smoothed, 192, 255, cv::THRESH_BINARY);
+		}
+	};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	GAPI_OCV_KERNEL(GCPUBorderConnected, GBorderConnected)
+	{
+		static void run(const cv::Mat& mask, const cv::Mat& border_mask, cv::Mat& connected)
+		{
+			thread_local cv::Mat noise_mask;
+			cv::add(mask, border_mask, noise_mask);
+			cv::floodFill(noise_mask, {0,0}, cv::Scalar(0));
+			cv::subtract(mask, noise_mask, connected);
+			cv::subtract(connected, border_mask, connected);
+		}
+	};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	SegmentationGraph::SegmentationGraph(
+		const cv::Size& resolution,
+		cv::InputArray sharpening_kernel,
+		cv::InputArray morph_kernel,
+		cv::InputArray border_mask,
+		const double noise_offset,
+		const int erode_iterations,
+		const int dilate_iterations,
+		const bool output_raw_mask
+	)
+		: m_Resolution(resolution),
+		  m_OutputRawMask(output_raw_mask)
+	{
+		CV_Assert(sharpening_kernel.type() == CV_32FC1 && sharpening_kernel.size() == cv::Size(3, 3));
+		CV_Assert(border_mask.size() == resolution && border_mask.type() == CV_8UC1);
+
+		// The graph keeps its own copy of the kernels.
+		const cv::Mat sharpening = sharpening_kernel.getMat().clone();
+		const cv::Mat morph = morph_kernel.getMat().clone();
+		border_mask.copyTo(m_BorderMask);
+		reset();
+
+		// Stand-ins for a residual and threshold which haven't been found yet.
+		m_UnitGain = cv::Mat(resolution, CV_32FC3, cv::Scalar::all(1.0));
+		m_ZeroOffset = cv::Mat::zeros(resolution, CV_32FC3);
+		m_ZeroThreshold = cv::Mat::zeros(resolution, CV_32FC1);
+
+		cv::GMat view, prediction, gain, offset, background_mask, border, threshold;
+		cv::GScalar shadow_threshold;
+
+		// Perform dynamic background subtraction via the
+		// difference between the prediction and webcam view.
+		// The prediction is corrected by the residual, and the 
+		// per-pixel threshold is subtracted from the score.
+		const auto score = GSharpenDifference::on(
+			view, prediction, gain, offset, threshold, sharpening, cv::Scalar(0.75, 0.75, 1.00)
+		);
+
+		// Assume minimal differences belong to background and remove. 
+		const auto raw_mask = GNoiseThreshold::on(score, background_mask, noise_offset);
+
+		// Erode the mask to remove remove small noises and thin lines. 
+		auto foreground_mask = raw_mask;
+		for(int i = 0; i < erode_iterations; i++)
+			foreground_mask = cv::gapi::erode(foreground_mask, morph);
+
+		// Remove any noise that is not connected to the edge of the screen. 
+		foreground_mask = GBorderConnected::on(foreground_mask, border);
+
+		// Dilate the mask and smooth it to remove jagged edges. 
+		for(int i = 0; i < dilate_iterations; i++)
+			foreground_mask = cv::gapi::dilate(foreground_mask, morph);
+		foreground_mask = GSmoothMask::on(foreground_mask);
+
+		// Find the shadow mask, where the background is treated as white.
+		const auto next_background_mask = cv::gapi::bitwise_not(foreground_mask);
+		const auto foreground_view = cv::gapi::max(cv::gapi::BGR2Gray(view), next_background_mask);
+		const auto shadow_mask = cv::gapi::threshold(
+			foreground_view, shadow_threshold, cv::GScalar(cv::Scalar(255)), cv::THRESH_BINARY_INV
+		);
+
+		cv::GComputation computation(
+			cv::GIn(view, prediction, gain, offset, background_mask, border, threshold, shadow_threshold),
+			m_OutputRawMask
+				? cv::GOut(foreground_mask, shadow_mask, next_background_mask, raw_mask)
+				: cv::GOut(foreground_mask, shadow_mask, next_background_mask)
+		);
+
+		const auto kernels = cv::gapi::combine(
+			cv::gapi::core::fluid::kernels(),
+			cv::gapi::imgproc::fluid::kernels(),
+			cv::gapi::kernels<GFluidSharpenDifference, GCPUNoiseThreshold, GCPUSmoothMask, GCPUBorderConnected>()
+		);
+
+		m_Graph = computation.compile(
+			cv::GMatDesc(CV_8U, 3, resolution),
+			cv::GMatDesc(CV_32F, 3, resolution),
+			cv::GMatDesc(CV_32F, 3, resolution),
+			cv::GMatDesc(CV_32F, 3, resolution),
+			cv::GMatDesc(CV_8U, 1, resolution),
+			cv::GMatDesc(CV_8U, 1, resolution),
+			cv::GMatDesc(CV_32F, 1, resolution),
+			cv::empty_scalar_desc(),
+			cv::compile_args(kernels)
+		);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void SegmentationGraph::apply(
+		cv::InputArray view,
+		cv::InputArray prediction,
+		cv::InputArray gain,
+		cv::InputArray offset,
+		cv::InputArray threshold,
+		const double shadow_threshold,
+		cv::OutputArray foreground_mask,
+		cv::OutputArray shadow_mask,
+		cv::OutputArray raw_mask
+	)
+	{
+		CV_Assert(view.size() == m_Resolution && view.type() == CV_8UC3);
+		CV_Assert(prediction.size() == m_Resolution && prediction.type() == CV_32FC3);
+
+		foreground_mask.create(m_Resolution, CV_8UC1);
+		shadow_mask.create(m_Resolution, CV_8UC1);
+
+		// NOTE: these are views of the arguments, so the graph writes straight into them.
+		const cv::Mat view_mat = view.getMat(), prediction_mat = prediction.getMat();
+		const cv::Mat gain_mat = gain.empty() ? m_UnitGain : gain.getMat();
+		const cv::Mat offset_mat = offset.empty() ? m_ZeroOffset : offset.getMat();
+		const cv::Mat threshold_mat = threshold.empty() ? m_ZeroThreshold : threshold.getMat();
+		CV_Assert(gain_mat.size() == m_Resolution && gain_mat.type() == CV_32FC3);
+		CV_Assert(offset_mat.size() == m_Resolution && offset_mat.type() == CV_32FC3);
+		CV_Assert(threshold_mat.size() == m_Resolution && threshold_mat.type() == CV_32FC1);
+		cv::Mat foreground_mat = foreground_mask.getMat(), shadow_mat = shadow_mask.getMat();
+		const cv::Scalar shadow_scalar = cv::Scalar::all(shadow_threshold);
+
+		if(m_OutputRawMask)
+		{
+			CV_Assert(raw_mask.needed());
+			raw_mask.create(m_Resolution, CV_8UC1);
+			cv::Mat raw_mat = raw_mask.getMat();
+
+			m_Graph(
+				cv::gin(view_mat, prediction_mat, gain_mat, offset_mat, m_BackgroundMask, m_BorderMask, threshold_mat, shadow_scalar),
+				cv::gout(foreground_mat, shadow_mat, m_NextBackgroundMask, raw_mat)
+			);
+		}
+		else
+		{
+			m_Graph(
+				cv::gin(view_mat, prediction_mat, gain_mat, offset_mat, m_BackgroundMask, m_BorderMask, threshold_mat, shadow_scalar),
+				cv::gout(foreground_mat, shadow_mat, m_NextBackgroundMask)
+			);
+		}
+
+		std::swap(m_BackgroundMask, m_NextBackgroundMask);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void SegmentationGraph::reset()
+	{
+		// Treating everything as background gives the same 
+		// noise floor as the eager implementation's empty mask. 
+		m_BackgroundMask.create(m_Resolution, CV_8UC1);
+		m_BackgroundMask.setTo(cv::Scalar(255));
+		m_NextBackgroundMask.create(m_Resolution, CV_8UC1);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
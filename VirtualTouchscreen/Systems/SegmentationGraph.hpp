@@ -0,0 +1,56 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/gapi.hpp>
+
+namespace vt
+{
+
+	// The segmentation of MaskGenerator expressed as a G-API graph. 
+	// The Fluid backend streams the per-pixel stages through line 
+	// buffers, so only the global steps (the noise floor and border
+	// connectivity) and the 5x5 smoothing, which Fluid has no kernel
+	// for, run on the OpenCV backend over the full frame. 
+	class SegmentationGraph
+	{
+	public:
+
+		SegmentationGraph(
+			const cv::Size& resolution,
+			cv::InputArray sharpening_kernel,
+			cv::InputArray morph_kernel,
+			cv::InputArray border_mask,
+			const double noise_offset,
+			const int erode_iterations,
+			const int dilate_iterations,
+			const bool output_raw_mask = false
+		);
+
+		// The prediction is corrected by the residual gain and offset, and the
+		// threshold is subtracted from the score, where any may be left empty.
+		void apply(
+			cv::InputArray view,
+			cv::InputArray prediction,
+			cv::InputArray gain,
+			cv::InputArray offset,
+			cv::InputArray threshold,
+			const double shadow_threshold,
+			cv::OutputArray foreground_mask,
+			cv::OutputArray shadow_mask,
+			cv::OutputArray raw_mask = cv::noArray()
+		);
+
+		// Forgets the background of the previous frame.
+		void reset();
+
+	private:
+		const cv::Size m_Resolution;
+		const bool m_OutputRawMask;
+		cv::GCompiled m_Graph;
+
+		// The background mask is fed back into the next frame. 
+		cv::Mat m_BorderMask, m_BackgroundMask, m_NextBackgroundMask;
+		cv::Mat m_UnitGain, m_ZeroOffset, m_ZeroThreshold;
+	};
+
+}
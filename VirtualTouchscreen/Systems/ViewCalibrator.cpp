@@ -1,6 +1,8 @@
 #include "ViewCalibrator.hpp"
 
 #include <thread>
+#include <array>
+#include <algorithm>
 #include <chrono>
 #include <bitset>
 #include <limits>
@@ -13,26 +15,154 @@
 namespace vt
 {
 
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Mean difference, in 8-bit levels, between the prediction of a chessboard and the
+	// corrected capture of it, over which a calibration no longer fits the view. The
+	// blur of the webcam alone accounts for roughly 10 levels along the square edges.
+	constexpr auto VERIFY_MAX_ERROR = 30.0;
+
+	// The colour pattern is repeated in every region of the colour maps, so it is
+	// split over several captures to keep each colour sample large. Only the centre
+	// of each sample is measured, as the blur of the webcam spreads its neighbours
+	// a few pixels into it, so this is the fraction left out at each side.
+	constexpr auto CMAP_PATTERN_SIZE = 8;
+	constexpr auto CMAP_PATTERN_CAPTURES = (CMAP_SIZE * CMAP_SIZE * CMAP_SIZE) / (CMAP_PATTERN_SIZE * CMAP_PATTERN_SIZE);
+	constexpr auto CMAP_SAMPLE_INSET = 0.25;
+
+	// Version of the saved calibration, which must be raised whenever what is saved changes.
+	// Calibrations of any other version are rejected, so that they are redone.
+	constexpr auto CALIB_FORMAT_VERSION = 1;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Size of a grid with a cell for every so many pixels, and at least two in each direction.
+	static cv::Size grid_size(const cv::Size& resolution, const int cell)
+	{
+		return cv::Size(
+			std::max((resolution.width + cell - 1) / cell, 2),
+			std::max((resolution.height + cell - 1) / cell, 2)
+		);
+	}
+
 //---------------------------------------------------------------------------------------------------------------------
 
 	ViewCalibrator::ViewCalibrator(const cv::Size& output_resolution)
-		: m_CorrectionMap(output_resolution, CV_32FC2, cv::Scalar::zeros()),
+		: m_OutputResolution(output_resolution),
 		  m_ViewHomography(cv::Mat::eye(3, 3, CV_32FC1)),
-		  m_OutputResolution(output_resolution)
+		  m_ColourMaps(CMAP_REGIONS * CMAP_REGIONS, ColourMap{})
 	{
 		CV_Assert(output_resolution.width > 0 && output_resolution.height > 0);
+		m_CorrectionGrid = cv::Mat::zeros(grid_size(output_resolution, CORRECTION_CELL), CV_32FC2);
+		build_correction_maps();
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
 	ViewCalibrator::ViewCalibrator(const ViewProperties& context)
-		: m_ViewHomography(context.view_homography),
-		  m_CorrectionMap(context.correction_map),
-		  m_OutputResolution(context.output_resolution),
+		: m_OutputResolution(context.output_resolution),
+		  m_InputResolution(context.input_resolution),
+		  m_Exposure(context.exposure),
+		  m_CorrectionGrid(context.correction_grid),
+		  m_ViewHomography(context.view_homography),
 		  m_ScreenContour(context.screen_contour),
-		  m_ColourMap(context.colour_map)
+		  m_ColourMaps(context.colour_maps),
+		  m_DisplayResponse(context.display_response),
+		  m_Settings(context.settings)
 	{
+		CV_Assert(m_ColourMaps.size() == CMAP_REGIONS * CMAP_REGIONS);
 		context.reflectance_map.copyTo(m_ReflectanceMap);
+		context.noise_map.copyTo(m_NoiseMap);
+		build_correction_maps();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	std::optional<ViewCalibrator> ViewCalibrator::TryLoad(const std::string& path)
+	{
+		try
+		{
+			cv::FileStorage file(path, cv::FileStorage::READ);
+			if(!file.isOpened())
+				return std::nullopt;
+
+			int version = 0;
+			file["format_version"] >> version;
+			if(version != CALIB_FORMAT_VERSION)
+			{
+				std::cerr << "Ignoring calibration of another version: " << path << std::endl;
+				return std::nullopt;
+			}
+
+			ViewProperties context;
+			cv::Mat colour_map;
+			file["input_resolution"] >> context.input_resolution;
+			file["output_resolution"] >> context.output_resolution;
+			file["exposure"] >> context.exposure;
+			file["view_homography"] >> context.view_homography;
+			file["screen_contour"] >> context.screen_contour;
+			file["correction_grid"] >> context.correction_grid;
+			file["colour_maps"] >> colour_map;
+			file["reflectance_map"] >> context.reflectance_map;
+			file["noise_map"] >> context.noise_map;
+			file["display_rise"] >> context.display_response.rise;
+			file["display_fall"] >> context.display_response.fall;
+
+			// Reject calibrations which are incomplete or corrupted.
+			const size_t regions = CMAP_REGIONS * CMAP_REGIONS;
+			if(context.output_resolution.empty() || context.input_resolution.empty()
+			|| context.correction_grid.rows < 2 || context.correction_grid.cols < 2 || context.correction_grid.type() != CV_32FC2
+			|| context.reflectance_map.rows < 2 || context.reflectance_map.cols < 2 || context.reflectance_map.type() != CV_16FC3
+			|| (!context.noise_map.empty() && context.noise_map.type() != CV_32FC1)
+			|| colour_map.total() != regions * std::tuple_size_v<ColourMap> || colour_map.type() != CV_32FC3)
+			{
+				std::cerr << "Ignoring invalid calibration: " << path << std::endl;
+				return std::nullopt;
+			}
+
+			context.colour_maps.resize(regions);
+			for(size_t i = 0; i < context.colour_maps.size(); i++)
+			{
+				const auto* region_map = colour_map.ptr<cv::Vec3f>() + i * std::tuple_size_v<ColourMap>;
+				std::copy_n(region_map, std::tuple_size_v<ColourMap>, context.colour_maps[i].begin());
+			}
+
+			return ViewCalibrator(context);
+		}
+		catch(const cv::Exception& e)
+		{
+			std::cerr << "Failed to load calibration: " << e.what() << std::endl;
+			return std::nullopt;
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::save(const std::string& path) const
+	{
+		// Use base64 encoding as the maps are too large to store as text. 
+		cv::FileStorage file(path, cv::FileStorage::WRITE | cv::FileStorage::BASE64);
+		CV_Assert(file.isOpened());
+
+		file << "format_version" << CALIB_FORMAT_VERSION;
+		file << "input_resolution" << m_InputResolution;
+		file << "output_resolution" << m_OutputResolution;
+		file << "exposure" << m_Exposure;
+		file << "view_homography" << m_ViewHomography;
+		file << "screen_contour" << m_ScreenContour;
+		file << "correction_grid" << m_CorrectionGrid;
+		file << "colour_maps" << cv::Mat(static_cast<int>(m_ColourMaps.size() * std::tuple_size_v<ColourMap>), 1, CV_32FC3, (void*)m_ColourMaps.data());
+		file << "reflectance_map" << m_ReflectanceMap;
+		file << "noise_map" << m_NoiseMap;
+		file << "display_rise" << m_DisplayResponse.rise;
+		file << "display_fall" << m_DisplayResponse.fall;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const cv::Size& ViewCalibrator::input_resolution() const
+	{
+		return m_InputResolution;
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -46,24 +176,72 @@ namespace vt
 
 	float ViewCalibrator::ambient_intensity() const
 	{
-		const auto ambient_colour = m_ColourMap[0];
+		cv::Vec3f ambient_colour(0, 0, 0);
+		for(const auto& colour_map : m_ColourMaps)
+			ambient_colour += colour_map[0];
+		ambient_colour /= static_cast<float>(m_ColourMaps.size());
 
 		return (1.0f/3.0f) * (ambient_colour[0] + ambient_colour[1] + ambient_colour[2]);
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
-	void ViewCalibrator::calibrate(
+	const cv::Mat& ViewCalibrator::noise_map() const
+	{
+		return m_NoiseMap;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const DisplayResponse& ViewCalibrator::display_response() const
+	{
+		return m_DisplayResponse;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const ColourGrid& ViewCalibrator::colour_maps() const
+	{
+		return m_ColourMaps;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const cv::Mat& ViewCalibrator::reflectance_map() const
+	{
+		return m_ReflectanceMap;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::tune(const PipelineSettings& settings)
+	{
+		m_Settings = settings;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const PipelineSettings& ViewCalibrator::settings() const
+	{
+		return m_Settings;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool ViewCalibrator::calibrate(
 		Webcam& webcam,
 		const float min_coverage,
-		const int settle_time_ms
+		const int settle_time_ms,
+		Profiler* profiler
 	)
 	{
 		CV_Assert(webcam.is_open());
 
 		// Initialize the fullscreen calibration window for the user. 
 		const cv::String window_name = "Screen Calibrator";
-		const auto screen_region = make_fullscreen_window(window_name);
+		const bool virtual_rig = webcam.rig() != nullptr;
+		if(!virtual_rig)
+			make_fullscreen_window(window_name);
 
 		// Get the user to position their camera correctly.
 		if constexpr (!auto_start_calibration)
@@ -84,12 +262,20 @@ namespace vt
 			 cv::Scalar(255,255,000), cv::Scalar(000,255,255)
 		};
 
-		std::vector<cv::UMat> colour_samples(calibration_colours.size());
-		cv::UMat chessboard_sample;
+		std::vector<Frame> colour_samples(calibration_colours.size());
+		Frame chessboard_sample;
 
 		// Run interactive calibration
+		Profiler::Clock::time_point attempt_start;
+		const auto record_attempt = [&](const std::string& name) {
+			if(profiler != nullptr)
+				profiler->record(name, attempt_start, Profiler::Clock::now());
+		};
+
 		while(true)
 		{
+			attempt_start = Profiler::Clock::now();
+
 			// Calibrate the webcam properties. 
 			if constexpr (!skip_auto_exposure)
 			{
@@ -113,31 +299,52 @@ namespace vt
 				//cv::pollKey();
 			}
 
-			// Capture chessboard pattern for geometric lens distortion calibration. 
-			const cv::Size chessboard_size(CHESSBOARD_SIZE);
-			cv::Mat chessboard_pattern = make_chessboard(
-				chessboard_size, cv::Vec3b::all(0), cv::Vec3b::all(255)
-			);
+			std::optional<std::vector<cv::Point2f>> screen_corners;
+			if constexpr (use_structured_light_calibration)
+			{
+				// Find the geometric calibration model by decoding structured light. 
+				screen_corners = find_structured_light_model(
+					webcam,
+					settle_time_ms,
+					window_name,
+					calibration_colours,
+					colour_samples
+				);
 
-			capture_image(
-				webcam,
-				chessboard_sample,
-				chessboard_pattern,
-				settle_time_ms,
-				CAPTURE_SAMPLES,
-				window_name
-			);
+				// There is no chessboard, so show the results on the white sample.
+				colour_samples[0].copyTo(chessboard_sample);
+			}
+			else
+			{
+				// Capture chessboard pattern for geometric lens distortion calibration. 
+				const cv::Size chessboard_size(CHESSBOARD_SIZE);
+				cv::Mat chessboard_pattern = make_chessboard(
+					chessboard_size, cv::Vec3b::all(0), cv::Vec3b::all(255)
+				);
 
-			// Find the geometric calibration model using the chessboard and colour samples. 
-			const auto screen_corners = find_geometric_model(
-				calibration_colours, 
-				colour_samples,
-				chessboard_sample,
-				chessboard_size
-			);
+				capture_image(
+					webcam,
+					chessboard_sample,
+					chessboard_pattern,
+					settle_time_ms,
+					CAPTURE_SAMPLES,
+					window_name
+				);
+
+				// Find the geometric calibration model using the chessboard and colour samples. 
+				screen_corners = find_geometric_model(
+					calibration_colours, 
+					colour_samples,
+					chessboard_sample,
+					chessboard_size
+				);
+			}
 			
 			if (!screen_corners.has_value())
 			{
+				record_attempt("Calibrate (failed)");
+				if(virtual_rig) return false;
+
 				// TODO: proper feedback message
 				show_feedback(
 					webcam,
@@ -153,6 +360,9 @@ namespace vt
 			// Check that the detected screen region meets the minimum coverage constraints. 
 			if(cv::contourArea(m_ScreenContour) < min_coverage * m_OutputResolution.area())
 			{
+				record_attempt("Calibrate (failed)");
+				if(virtual_rig) return false;
+
 				show_feedback(
 					webcam,
 					"Please move the camera closer",
@@ -164,7 +374,7 @@ namespace vt
 
 
 			// Correct all the colour samples using the geometric calibration. 
-			std::vector<cv::UMat> corrected_wgcy_samples(calibration_colours.size());
+			std::vector<Frame> corrected_wgcy_samples(calibration_colours.size());
 			for(size_t i = 0; i < colour_samples.size(); i++)
 			{
 				correct(colour_samples[i], corrected_wgcy_samples[i]);
@@ -182,9 +392,29 @@ namespace vt
 				corrected_wgcy_samples[0]
 			);
 
+			// Find the noise model of the webcam over the corrected view.
+			find_noise_model(
+				webcam,
+				settle_time_ms,
+				window_name
+			);
+
+			// Find how quickly the display transitions between frames.
+			find_temporal_model(
+				webcam,
+				settle_time_ms,
+				window_name
+			);
+
+			record_attempt("Calibrate");
 			break;
 		}
 
+		// Record the camera state that the calibration is valid for. 
+		m_InputResolution = cv::Size(webcam.width, webcam.height);
+		m_Exposure = webcam.get(cv::CAP_PROP_EXPOSURE);
+		if(virtual_rig) return true;
+
 		// Show results by drawing the screen outline on the chessboard sample. 
 		cv::Point2f last_point = m_ScreenContour.back();
 		for(const auto& point : m_ScreenContour)
@@ -198,14 +428,56 @@ namespace vt
 		cv::waitKey(2000);
 
 		cv::destroyWindow(window_name);
+		return true;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::restore(Webcam& webcam) const
+	{
+		CV_Assert(webcam.is_open());
+		CV_Assert(m_InputResolution == cv::Size(webcam.width, webcam.height));
+
+		lock_camera(webcam);
+		if constexpr (!skip_auto_exposure)
+		{
+			webcam.set(cv::CAP_PROP_EXPOSURE, m_Exposure);
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool ViewCalibrator::verify(Webcam& webcam, const int settle_time_ms) const
+	{
+		CV_Assert(webcam.is_open());
+
+		const cv::Mat pattern = make_chessboard(cv::Size(CHESSBOARD_SIZE), cv::Vec3b::all(0), cv::Vec3b::all(255));
+
+		Frame sample, view;
+		capture_image(webcam, sample, pattern, settle_time_ms, CAPTURE_SAMPLES, "Calibration Check", true);
+		correct(sample, view);
+
+		// Any movement of the camera or screen misaligns the squares of the chessboard.
+		cv::Mat screen, prediction, observed;
+		cv::resize(pattern, screen, m_OutputResolution, 0, 0, cv::INTER_NEAREST);
+		predict(screen, prediction);
+		view.copyTo(observed);
+		observed.convertTo(observed, CV_32FC3);
+		cv::absdiff(observed, prediction, observed);
+
+		const auto channel_errors = cv::mean(observed);
+		const double error = (channel_errors[0] + channel_errors[1] + channel_errors[2]) / 3.0;
+		std::cout << cv::format("Calibration error: %.1f (mean difference to prediction)\n", error);
+
+		return error <= VERIFY_MAX_ERROR;
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
 	std::optional<std::vector<cv::Point2f>> ViewCalibrator::find_geometric_model(
 		const std::vector<cv::Scalar>& colours,
-		const std::vector<cv::UMat>& samples,
-		const cv::UMat& chessboard_sample,
+		const std::vector<Frame>& samples,
+		const Frame& chessboard_sample,
 		const cv::Size& chessboard_size
 	)
 	{
@@ -279,7 +551,7 @@ namespace vt
 		);
 
 		// Initialize lens correction map.
-		cv::UMat lens_correction_map;
+		Frame lens_correction_map;
 		cv::initUndistortRectifyMap(
 			camera_matrix,
 			distortion_coefficients,
@@ -293,10 +565,10 @@ namespace vt
 
 
 		// Apply lens correction on the samples.
-		cv::UMat corrected_chessboard;
+		Frame corrected_chessboard;
 		cv::remap(chessboard_sample, corrected_chessboard, lens_correction_map, cv::noArray(), cv::INTER_LANCZOS4);
 
-		std::vector<cv::UMat> corrected_samples(samples.size());
+		std::vector<Frame> corrected_samples(samples.size());
 		for (int i = 0; i < corrected_samples.size(); i++)
 		{
 			cv::remap(samples[i], corrected_samples[i], lens_correction_map, cv::noArray(), cv::INTER_LANCZOS4);
@@ -354,17 +626,340 @@ namespace vt
 		m_ViewHomography = cv::findHomography(screen_points, ideal_corners, cv::noArray(), usac_params);
 
 		// Apply the homography to the lens distortion map to combine them
-		cv::warpPerspective(lens_correction_map, m_CorrectionMap, m_ViewHomography, m_OutputResolution, cv::INTER_LANCZOS4);
+		Frame correction_map;
+		cv::warpPerspective(lens_correction_map, correction_map, m_ViewHomography, m_OutputResolution, cv::INTER_LANCZOS4);
+		m_CorrectionGrid = sample_correction_grid(cv::InputArray(correction_map).getMat());
+		build_correction_maps();
 
 		// Return original screen corners
 		return screen_corners;
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
-	
-	// TODO: put this somewhere better
-	constexpr auto CMAP_SIZE = 8;
-	constexpr auto CMAP_STEP = 1.0f / (CMAP_SIZE - 1.0f);
+
+	std::optional<std::vector<cv::Point2f>> ViewCalibrator::find_structured_light_model(
+		Webcam& webcam,
+		const int settle_time_ms,
+		const std::string& window_name,
+		const std::vector<cv::Scalar>& colours,
+		const std::vector<Frame>& samples
+	)
+	{
+		// Pixels need this much contrast between black and white to be decoded.
+		constexpr auto MIN_CONTRAST = 20;
+		constexpr auto MIN_AMPLITUDE = 2.0 * MIN_CONTRAST;
+
+		// The Gray code is decoded in cells of half the phase period, so that
+		// its estimate is never more than half a period out when unwrapping.
+		constexpr auto PERIOD = STRUCTURED_LIGHT_PERIOD;
+		constexpr auto CELL = PERIOD / 2;
+		static_assert(PERIOD % 2 == 0);
+
+		// Find raw screen contour using the given colour samples (the first is white).
+		const auto screen_corners = detect_screen(colours, samples);
+		if (!screen_corners.has_value())
+		{
+			std::cout << "Failed to find screen contour \n";
+			return std::nullopt;
+		}
+
+		// Capture a black sample, so that each pixel can be thresholded
+		// half way between its own black and white response. 
+		Frame capture_buffer;
+		cv::Mat white, black, threshold, gray;
+		capture_colour(webcam, capture_buffer, cv::Scalar::all(0), settle_time_ms, CAPTURE_SAMPLES, window_name);
+		cv::cvtColor(samples[0], white, cv::COLOR_BGR2GRAY);
+		cv::cvtColor(capture_buffer, black, cv::COLOR_BGR2GRAY);
+		cv::addWeighted(white, 0.5, black, 0.5, 0.0, threshold);
+
+		cv::Mat valid;
+		cv::subtract(white, black, gray, cv::noArray(), CV_16S);
+		cv::compare(gray, MIN_CONTRAST, valid, cv::CMP_GT);
+
+		// Decodes the screen coordinate seen by each webcam pixel along one axis. 
+		cv::Mat pattern(m_OutputResolution, CV_8UC3);
+		const auto decode_axis = [&](const int axis) {
+			const int extent = (axis == 0) ? m_OutputResolution.width : m_OutputResolution.height;
+			const int cells = (extent + CELL - 1) / CELL;
+			int bits = 0;
+			while((1 << bits) < cells) bits++;
+
+			// Decode the Gray code of the cell, most significant bit first, 
+			// where each binary bit is the Gray bit XOR the previous binary bit.
+			cv::Mat code(threshold.size(), CV_16UC1, cv::Scalar::zeros());
+			cv::Mat binary(threshold.size(), CV_8UC1, cv::Scalar::zeros()), bit;
+			for(int b = bits - 1; b >= 0; b--)
+			{
+				pattern.forEach<cv::Vec3b>([&](cv::Vec3b& pixel, const int position[2]) {
+					const int n = position[1 - axis] / CELL;
+					pixel = cv::Vec3b::all(((n ^ (n >> 1)) >> b) & 1 ? 255 : 0);
+				});
+				capture_image(webcam, capture_buffer, pattern, settle_time_ms, CAPTURE_SAMPLES, window_name);
+				cv::cvtColor(capture_buffer, gray, cv::COLOR_BGR2GRAY);
+				cv::compare(gray, threshold, bit, cv::CMP_GT);
+
+				cv::bitwise_xor(binary, bit, binary);
+				cv::add(code, code, code);
+				cv::add(code, cv::Scalar(1), code, binary);
+			}
+
+			cv::Mat in_range;
+			cv::compare(code, cells, in_range, cv::CMP_LT);
+			cv::bitwise_and(valid, in_range, valid);
+
+			// Capture the phase within the period using four shifted sinusoids.
+			std::array<cv::Mat, 4> shifts;
+			for(int k = 0; k < 4; k++)
+			{
+				pattern.forEach<cv::Vec3b>([&](cv::Vec3b& pixel, const int position[2]) {
+					const double angle = 2.0 * CV_PI * position[1 - axis] / PERIOD + k * CV_PI / 2.0;
+					pixel = cv::Vec3b::all(cv::saturate_cast<uchar>(127.5 + 127.5 * std::cos(angle)));
+				});
+				capture_image(webcam, capture_buffer, pattern, settle_time_ms, CAPTURE_SAMPLES, window_name);
+				cv::cvtColor(capture_buffer, gray, cv::COLOR_BGR2GRAY);
+				gray.convertTo(shifts[k], CV_32FC1);
+			}
+
+			cv::Mat cosine, sine, phase, amplitude;
+			cv::subtract(shifts[0], shifts[2], cosine);
+			cv::subtract(shifts[3], shifts[1], sine);
+			cv::phase(cosine, sine, phase);
+			cv::magnitude(cosine, sine, amplitude);
+
+			cv::Mat modulated;
+			cv::compare(amplitude, MIN_AMPLITUDE, modulated, cv::CMP_GT);
+			cv::bitwise_and(valid, modulated, valid);
+
+			// Unwrap the phase to the period closest to the centre of the Gray code cell.
+			// NOTE: converting to integers rounds to the nearest period. 
+			cv::Mat coarse, fine, offset, periods, position;
+			code.convertTo(coarse, CV_32FC1, CELL, (CELL - 1) / 2.0);
+			phase.convertTo(fine, CV_32FC1, PERIOD / (2.0 * CV_PI));
+			cv::subtract(coarse, fine, offset);
+			offset.convertTo(periods, CV_32SC1, 1.0 / PERIOD);
+			periods.convertTo(position, CV_32FC1, PERIOD);
+			cv::add(position, fine, position);
+
+			return position;
+		};
+
+		const cv::Mat screen_x = decode_axis(0);
+		const cv::Mat screen_y = decode_axis(1);
+
+		// Invert the correspondences by fitting the webcam coordinates as an affine function of the 
+		// screen coordinates within each cell of the screen, which is evaluated at the cell centre. 
+		const cv::Size grid_size(
+			(m_OutputResolution.width + CELL - 1) / CELL,
+			(m_OutputResolution.height + CELL - 1) / CELL
+		);
+
+		// Sums of 1, x, y, xx, xy, yy, u, xu, yu, v, xv, yv relative to the cell centre.
+		std::vector<cv::Vec<double, 12>> sums(grid_size.area(), cv::Vec<double, 12>::all(0.0));
+		for(int r = 0; r < valid.rows; r++)
+		{
+			const uchar* mask = valid.ptr<uchar>(r);
+			const float* xs = screen_x.ptr<float>(r);
+			const float* ys = screen_y.ptr<float>(r);
+			for(int c = 0; c < valid.cols; c++)
+			{
+				if(mask[c] == 0 || xs[c] < 0.0f || ys[c] < 0.0f)
+					continue;
+
+				const int gx = static_cast<int>(xs[c]) / CELL, gy = static_cast<int>(ys[c]) / CELL;
+				if(gx >= grid_size.width || gy >= grid_size.height)
+					continue;
+
+				const double x = xs[c] - (gx * CELL + (CELL - 1) / 2.0);
+				const double y = ys[c] - (gy * CELL + (CELL - 1) / 2.0);
+				const double terms[12] = {1.0, x, y, x * x, x * y, y * y, 1.0 * c, x * c, y * c, 1.0 * r, x * r, y * r};
+				sums[gy * grid_size.width + gx] += cv::Vec<double, 12>(terms);
+			}
+		}
+
+		cv::Mat grid(grid_size, CV_32FC2, cv::Scalar::all(-1));
+		std::vector<cv::Point2f> webcam_points, screen_points;
+		for(int gy = 0; gy < grid_size.height; gy++)
+		{
+			for(int gx = 0; gx < grid_size.width; gx++)
+			{
+				const auto& s = sums[gy * grid_size.width + gx];
+				if(s[0] < 3.0)
+					continue;
+
+				// Fall back to the mean if the cell is too degenerate to fit.
+				const cv::Matx33d normal(s[0], s[1], s[2], s[1], s[3], s[4], s[2], s[4], s[5]);
+				cv::Vec3d u_fit, v_fit;
+				if(!cv::solve(normal, cv::Vec3d(s[6], s[7], s[8]), u_fit, cv::DECOMP_CHOLESKY)
+				|| !cv::solve(normal, cv::Vec3d(s[9], s[10], s[11]), v_fit, cv::DECOMP_CHOLESKY))
+				{
+					u_fit[0] = s[6] / s[0];
+					v_fit[0] = s[9] / s[0];
+				}
+
+				const cv::Point2f webcam_point(static_cast<float>(u_fit[0]), static_cast<float>(v_fit[0]));
+				grid.at<cv::Vec2f>(gy, gx) = cv::Vec2f(webcam_point.x, webcam_point.y);
+				webcam_points.push_back(webcam_point);
+				screen_points.emplace_back(gx * CELL + (CELL - 1) / 2.0f, gy * CELL + (CELL - 1) / 2.0f);
+			}
+		}
+
+		if(webcam_points.size() < 4)
+		{
+			std::cout << "Failed to decode the structured light \n";
+			return std::nullopt;
+		}
+
+		// The homography is only used to fill in the cells which could not be decoded.
+		m_ViewHomography = cv::findHomography(webcam_points, screen_points, cv::RANSAC, 3.0);
+		if(m_ViewHomography.empty())
+		{
+			std::cout << "Failed to fit the structured light correspondences \n";
+			return std::nullopt;
+		}
+
+		const cv::Mat inverse_homography = m_ViewHomography.inv();
+		for(int gy = 0; gy < grid_size.height; gy++)
+		{
+			for(int gx = 0; gx < grid_size.width; gx++)
+			{
+				auto& point = grid.at<cv::Vec2f>(gy, gx);
+				if(point[0] >= 0.0f)
+					continue;
+
+				std::vector<cv::Point2f> centre = {{gx * CELL + (CELL - 1) / 2.0f, gy * CELL + (CELL - 1) / 2.0f}};
+				cv::perspectiveTransform(centre, centre, inverse_homography);
+				point = cv::Vec2f(centre[0].x, centre[0].y);
+			}
+		}
+
+		// Upsampling by the cell size puts each cell centre back on its pixel.
+		cv::Mat correction_map;
+		cv::resize(grid, correction_map, grid_size * CELL, 0, 0, cv::INTER_LINEAR);
+		m_CorrectionGrid = sample_correction_grid(correction_map(cv::Rect({0, 0}, m_OutputResolution)));
+		build_correction_maps();
+
+		return screen_corners;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::find_noise_model(
+		Webcam& webcam,
+		const int settle_time_ms,
+		const std::string& window_name
+	)
+	{
+		constexpr auto NOISE_MAP_DOWNSCALE = 8;
+
+		// The noise depends on the brightness, so is measured on a dark and a
+		// light grey, and the larger deviation of the two is kept for each pixel.
+		constexpr double NOISE_LEVELS[] = {64, 192};
+
+		Frame capture_buffer, sample_buffer;
+		cv::Mat deviation(m_OutputResolution, CV_64FC3, cv::Scalar::zeros());
+		for(const double level : NOISE_LEVELS)
+		{
+			capture_colour(webcam, capture_buffer, cv::Scalar::all(level), settle_time_ms, 1, window_name);
+
+			// Accumulate the moments of each pixel over a burst of frames of the static image. 
+			cv::Mat sum(m_OutputResolution, CV_64FC3, cv::Scalar::zeros());
+			cv::Mat sum_sqr(m_OutputResolution, CV_64FC3, cv::Scalar::zeros());
+			for(int i = 0; i < NOISE_BURST_FRAMES; i++)
+			{
+				webcam.next_frame(capture_buffer);
+				correct(capture_buffer, sample_buffer);
+				cv::accumulate(sample_buffer, sum);
+				cv::accumulateSquare(sample_buffer, sum_sqr);
+			}
+
+			// The variance is E[x^2] - E[x]^2, which rounding can make slightly negative.
+			cv::Mat mean, variance, level_deviation;
+			sum.convertTo(mean, CV_64FC3, 1.0 / NOISE_BURST_FRAMES);
+			sum_sqr.convertTo(variance, CV_64FC3, 1.0 / NOISE_BURST_FRAMES);
+			cv::subtract(variance, mean.mul(mean), variance);
+			cv::max(variance, cv::Scalar::all(0.0), variance);
+			cv::sqrt(variance, level_deviation);
+			cv::max(deviation, level_deviation, deviation);
+		}
+
+		// Average over the channels, and store it at a low resolution.
+		cv::Mat channel_deviation;
+		cv::transform(deviation, channel_deviation, cv::Matx13d(1.0 / 3.0, 1.0 / 3.0, 1.0 / 3.0));
+		cv::resize(channel_deviation, m_NoiseMap, m_OutputResolution / NOISE_MAP_DOWNSCALE, 0, 0, cv::INTER_AREA);
+		m_NoiseMap.convertTo(m_NoiseMap, CV_32FC1);
+
+		std::cout << cv::format("Measured webcam noise: %.2f (mean deviation)\n", cv::mean(m_NoiseMap)[0]);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::find_temporal_model(
+		Webcam& webcam,
+		const int settle_time_ms,
+		const std::string& window_name
+	)
+	{
+		// Progress through a transition at which it is taken to have started and
+		// ended, and the smallest change of the view that is worth measuring. 
+		constexpr auto TRANSITION_START = 0.1;
+		constexpr auto TRANSITION_END = 0.9;
+		constexpr auto TRANSITION_MIN_SPAN = 16.0;
+
+		// Settles on one colour, then switches to another and records the mean colour
+		// of the corrected view over each following frame, which includes the latency.
+		Frame capture_buffer, sample_buffer;
+		const auto measure_step = [&](const cv::Scalar& from, const cv::Scalar& to) {
+			capture_colour(webcam, capture_buffer, from, settle_time_ms, 1, window_name);
+			correct(capture_buffer, sample_buffer);
+			const cv::Scalar start = cv::mean(sample_buffer);
+
+			show_image(webcam, cv::Mat(1, 1, CV_8UC3, to), window_name);
+			std::vector<cv::Scalar> levels(TRANSITION_FRAMES);
+			for(auto& level : levels)
+			{
+				webcam.next_frame(capture_buffer);
+				correct(capture_buffer, sample_buffer);
+				level = cv::mean(sample_buffer);
+			}
+
+			// The display is taken to have settled by the last frame. Between the start
+			// and end of the transition, the remainder shrinks by a fraction each frame.
+			cv::Vec3f rate = cv::Vec3f::all(1.0f);
+			for(int k = 0; k < 3; k++)
+			{
+				const double span = levels.back()[k] - start[k];
+				if(std::abs(span) < TRANSITION_MIN_SPAN)
+					continue;
+
+				int first = -1, last = -1;
+				for(int t = 0; t < TRANSITION_FRAMES && last < 0; t++)
+				{
+					const double progress = (levels[t][k] - start[k]) / span;
+					if(first < 0 && progress >= TRANSITION_START)
+						first = t;
+					if(progress >= TRANSITION_END)
+						last = t;
+				}
+
+				if(first >= 0 && last > first)
+				{
+					const double first_remainder = 1.0 - (levels[first][k] - start[k]) / span;
+					const double last_remainder = std::max(1.0 - (levels[last][k] - start[k]) / span, 1e-3);
+					rate[k] = static_cast<float>(1.0 - std::pow(last_remainder / first_remainder, 1.0 / (last - first)));
+				}
+			}
+			return rate;
+		};
+
+		m_DisplayResponse.rise = measure_step(cv::Scalar::all(0), cv::Scalar::all(255));
+		m_DisplayResponse.fall = measure_step(cv::Scalar::all(255), cv::Scalar::all(0));
+
+		const auto& [rise, fall] = m_DisplayResponse;
+		std::cout << cv::format(
+			"Measured display response: rise (%.2f, %.2f, %.2f), fall (%.2f, %.2f, %.2f) per frame\n",
+			rise[0], rise[1], rise[2], fall[0], fall[1], fall[2]
+		);
+	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
@@ -372,11 +967,10 @@ namespace vt
 		Webcam& webcam,
 		const int settle_time_ms,
 		const std::string& window_name,
-		const cv::UMat& white_sample
+		const Frame& white_sample
 	)
 	{
-		cv::UMat capture_buffer(cv::UMatUsageFlags::USAGE_ALLOCATE_DEVICE_MEMORY);
-		cv::UMat sample_buffer(cv::UMatUsageFlags::USAGE_ALLOCATE_DEVICE_MEMORY);
+		Frame capture_buffer, sample_buffer;
 		cv::Mat cpu_buffer;
 
 		// Process the white sample. 
@@ -385,8 +979,8 @@ namespace vt
 		white_sample.convertTo(white_response, CV_32FC3);
 
 		// Estimate spatial reflectance of all pixels using white sample. 
-		m_ReflectanceMap.create(m_OutputResolution, CV_32FC3);
-		m_ReflectanceMap.forEach<cv::Vec3f>([&](cv::Vec3f& ref, const int coord[2]) {
+		cv::Mat reflectance_map(m_OutputResolution, CV_32FC3);
+		reflectance_map.forEach<cv::Vec3f>([&](cv::Vec3f& ref, const int coord[2]) {
 			const auto& response = white_response.at<cv::Vec3f>(coord[0], coord[1]);
 
 			ref[0] = response[0] / white_point[0];
@@ -394,15 +988,22 @@ namespace vt
 			ref[2] = response[2] / white_point[2];
 		});
 
+		// Store the reflectance as a grid, and measure the colours against its 
+		// expansion, so that they match the reflectance used by the prediction.
+		cv::resize(reflectance_map, reflectance_map, grid_size(m_OutputResolution, REFLECTANCE_CELL), 0, 0, cv::INTER_AREA);
+		reflectance_map.convertTo(m_ReflectanceMap, CV_16F);
+		expand_reflectance_grid(m_ReflectanceMap, m_OutputResolution, reflectance_map);
+
 		// Capture the photometric sample colours. 
-		for(int k = 0; k < 2; k++)
+		const int pattern_colours = CMAP_PATTERN_SIZE * CMAP_PATTERN_SIZE;
+		for(int k = 0; k < CMAP_PATTERN_CAPTURES; k++)
 		{
-			// Fill in the 16x16 colour pattern
-			cv::Mat pattern(16, 16, CV_8UC3);
-			for(int i = 0; i < 256; i++)
+			// Fill in the colour pattern
+			cv::Mat pattern(CMAP_PATTERN_SIZE, CMAP_PATTERN_SIZE, CV_8UC3);
+			for(int i = 0; i < pattern_colours; i++)
 			{
 				// Convert the map index to a colour
-				const int map_index = (k * 256) + i;
+				const int map_index = (k * pattern_colours) + i;
 
 				const int x =  map_index % CMAP_SIZE;
 				const int y = (map_index / CMAP_SIZE) % CMAP_SIZE;
@@ -415,32 +1016,43 @@ namespace vt
 				);
 			}
 
+			// The pattern is repeated in every region, so that all regions are captured together.
+			cv::Mat tiled_pattern;
+			cv::repeat(pattern, CMAP_REGIONS, CMAP_REGIONS, tiled_pattern);
+
 			// Capture and correct the colour pattern. 
-			capture_image(webcam, capture_buffer, pattern, settle_time_ms, CAPTURE_SAMPLES, window_name);
+			capture_image(webcam, capture_buffer, tiled_pattern, settle_time_ms, CAPTURE_SAMPLES, window_name);
 			correct(capture_buffer, sample_buffer);
 			sample_buffer.convertTo(cpu_buffer, CV_32FC3);
 
 			// Show the colour patterns 
 			if constexpr (show_photometric_samples)
 			{
-				thread_local cv::UMat tmp;
-				cv::resize(pattern, tmp, sample_buffer.size(), 0, 0, cv::INTER_NEAREST);
+				thread_local Frame tmp;
+				cv::resize(tiled_pattern, tmp, sample_buffer.size(), 0, 0, cv::INTER_NEAREST);
 				imshow_2x1("Photometric Pattern " + std::to_string(k), tmp, sample_buffer);
 				cv::pollKey();
 			}
 
-			// Size of each colour sample in the sample buffer. 
-			const auto sample_size = cv::Size(
-				m_OutputResolution.width / pattern.cols, 
-				m_OutputResolution.height / pattern.rows
-			);
-
-			// Fill in the colour map using the captured pattern colours. 
-			for(int r = 0; r < pattern.rows; r++)
+			// Bounds of each colour sample in the sample buffer, which are
+			// inset so that the blur between samples isn't measured. 
+			const auto sample_roi = [&](const int r, const int c) {
+				const int x0 = (c * m_OutputResolution.width) / tiled_pattern.cols;
+				const int x1 = ((c + 1) * m_OutputResolution.width) / tiled_pattern.cols;
+				const int y0 = (r * m_OutputResolution.height) / tiled_pattern.rows;
+				const int y1 = ((r + 1) * m_OutputResolution.height) / tiled_pattern.rows;
+
+				const int inset_x = static_cast<int>((x1 - x0) * CMAP_SAMPLE_INSET);
+				const int inset_y = static_cast<int>((y1 - y0) * CMAP_SAMPLE_INSET);
+				return cv::Rect(cv::Point(x0 + inset_x, y0 + inset_y), cv::Point(x1 - inset_x, y1 - inset_y));
+			};
+
+			// Fill in the colour map of each region using the captured pattern colours. 
+			for(int r = 0; r < tiled_pattern.rows; r++)
 			{
-				for(int c = 0; c < pattern.cols; c++)
+				for(int c = 0; c < tiled_pattern.cols; c++)
 				{
-					const cv::Rect roi({c * sample_size.width, r * sample_size.height}, sample_size);
+					const cv::Rect roi = sample_roi(r, c);
 					
 					// Grab the average measured colour, taking into account the reflectance. 
 					cv::Vec3f measured(0, 0, 0);
@@ -449,7 +1061,7 @@ namespace vt
 						for (int rc = 0; rc < roi.width; rc++)
 						{
 							const auto& raw = cpu_buffer.at<cv::Vec3f>(rr + roi.y, rc + roi.x);
-							const auto& ref = m_ReflectanceMap.at<cv::Vec3f>(rr + roi.y, rc + roi.x);
+							const auto& ref = reflectance_map.at<cv::Vec3f>(rr + roi.y, rc + roi.x);
 
 							measured += cv::Vec3f(
 								raw[0] / ref[0],
@@ -460,9 +1072,10 @@ namespace vt
 					}
 					measured /= roi.area();
 					
-					// Insert sample colour into the colour map. 
-					const int map_index = (k * 256) + (r * pattern.rows) + c;
-					m_ColourMap[map_index] = cv::Vec3f(measured[0], measured[1], measured[2]);
+					// Insert sample colour into the colour map of its region. 
+					const int region = (r / pattern.rows) * CMAP_REGIONS + (c / pattern.cols);
+					const int map_index = (k * pattern_colours) + ((r % pattern.rows) * pattern.cols) + (c % pattern.cols);
+					m_ColourMaps[region][map_index] = cv::Vec3f(measured[0], measured[1], measured[2]);
 				}
 			}
 		}
@@ -470,54 +1083,394 @@ namespace vt
 
 //---------------------------------------------------------------------------------------------------------------------
 
-	void ViewCalibrator::predict(
-		const cv::Mat& src,
-		cv::Mat& dst
-	) const
+	RegionBlend blend_regions(const int coord, const int extent)
 	{
-		CV_Assert(src.type() == CV_8UC3);
-		dst.create(src.size(), CV_32FC3);
+		return blend_cells(coord, extent, CMAP_REGIONS);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	RegionBlend blend_cells(const int coord, const int extent, const int cells)
+	{
+		const float g = std::clamp((coord + 0.5f) * cells / extent - 0.5f, 0.0f, cells - 1.0f);
+		const int cell = std::min(static_cast<int>(g), cells - 2);
+		return {cell, g - cell};
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	cv::Mat sample_correction_grid(const cv::Mat& correction_map)
+	{
+		CV_Assert(correction_map.type() == CV_32FC2 && correction_map.rows >= 2 && correction_map.cols >= 2);
+
+		// Each grid point is interpolated from the map at the centre of its cell.
+		cv::Mat grid(grid_size(correction_map.size(), CORRECTION_CELL), CV_32FC2);
+		grid.forEach<cv::Vec2f>([&](cv::Vec2f& point, const int position[2]) {
+			const double x = (position[1] + 0.5) * correction_map.cols / grid.cols - 0.5;
+			const double y = (position[0] + 0.5) * correction_map.rows / grid.rows - 0.5;
+			const int x0 = std::min(static_cast<int>(x), correction_map.cols - 2);
+			const int y0 = std::min(static_cast<int>(y), correction_map.rows - 2);
+
+			const auto at = [&](const int r, const int c) {
+				return cv::Vec2d(correction_map.at<cv::Vec2f>(r, c));
+			};
+			const double wx = x - x0, wy = y - y0;
+			point = cv::Vec2f(
+				(at(y0, x0) * (1.0 - wx) + at(y0, x0 + 1) * wx) * (1.0 - wy)
+			  + (at(y0 + 1, x0) * (1.0 - wx) + at(y0 + 1, x0 + 1) * wx) * wy
+			);
+		});
+		return grid;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void expand_correction_grid(const cv::Mat& grid, const cv::Size& resolution, cv::Mat& dst)
+	{
+		CV_Assert(grid.type() == CV_32FC2 && grid.rows >= 2 && grid.cols >= 2);
+
+		// The correction keeps changing right up to the edge of the view,
+		// so the outer half cells are extrapolated from their neighbours. 
+		const auto locate = [](const int coord, const int extent, const int cells) {
+			const float g = (coord + 0.5f) * cells / extent - 0.5f;
+			const int cell = std::clamp(static_cast<int>(std::floor(g)), 0, cells - 2);
+			return RegionBlend{cell, g - cell};
+		};
+
+		std::vector<RegionBlend> column_blends(resolution.width);
+		for(int c = 0; c < resolution.width; c++)
+			column_blends[c] = locate(c, resolution.width, grid.cols);
+
+		dst.create(resolution, CV_32FC2);
+		cv::parallel_for_(cv::Range(0, resolution.height), [&](const cv::Range& rows) {
+			for(int r = rows.start; r < rows.end; r++)
+			{
+				const auto row_blend = locate(r, resolution.height, grid.rows);
+				const auto* top = grid.ptr<cv::Vec2f>(row_blend.region);
+				const auto* bottom = grid.ptr<cv::Vec2f>(row_blend.region + 1);
+				auto* dst_row = dst.ptr<cv::Vec2f>(r);
+
+				for(int c = 0; c < resolution.width; c++)
+				{
+					const auto& blend = column_blends[c];
+					dst_row[c] = lerp(
+						lerp(top[blend.region], bottom[blend.region], row_blend.weight),
+						lerp(top[blend.region + 1], bottom[blend.region + 1], row_blend.weight),
+						blend.weight
+					);
+				}
+			}
+		});
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Blends the two rows of the reflectance grid around an image row.
+	static void blend_reflectance_rows(const cv::Mat& grid, const RegionBlend& row_blend, cv::Vec3f* dst)
+	{
+		const auto* top = grid.ptr<cv::float16_t>(row_blend.region);
+		const auto* bottom = grid.ptr<cv::float16_t>(row_blend.region + 1);
+		for(int c = 0; c < grid.cols; c++)
+		{
+			dst[c] = lerp(
+				cv::Vec3f(top[3 * c], top[3 * c + 1], top[3 * c + 2]),
+				cv::Vec3f(bottom[3 * c], bottom[3 * c + 1], bottom[3 * c + 2]),
+				row_blend.weight
+			);
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void expand_reflectance_grid(const cv::Mat& grid, const cv::Size& resolution, cv::Mat& dst)
+	{
+		CV_Assert(grid.type() == CV_16FC3 && grid.rows >= 2 && grid.cols >= 2);
+
+		std::vector<RegionBlend> column_blends(resolution.width);
+		for(int c = 0; c < resolution.width; c++)
+			column_blends[c] = blend_cells(c, resolution.width, grid.cols);
+
+		dst.create(resolution, CV_32FC3);
+		cv::parallel_for_(cv::Range(0, resolution.height), [&](const cv::Range& rows) {
+			std::vector<cv::Vec3f> cells(grid.cols);
+			for(int r = rows.start; r < rows.end; r++)
+			{
+				blend_reflectance_rows(grid, blend_cells(r, resolution.height, grid.rows), cells.data());
+
+				auto* dst_row = dst.ptr<cv::Vec3f>(r);
+				for(int c = 0; c < resolution.width; c++)
+				{
+					const auto& blend = column_blends[c];
+					dst_row[c] = lerp(cells[blend.region], cells[blend.region + 1], blend.weight);
+				}
+			}
+		});
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Blends the colour maps of the two rows of regions around an image row. 
+	static void blend_colour_rows(
+		const ColourGrid& colour_maps,
+		const RegionBlend& row_blend,
+		std::array<ColourMap, CMAP_REGIONS>& dst
+	)
+	{
+		for(int c = 0; c < CMAP_REGIONS; c++)
+		{
+			const auto& top = colour_maps[row_blend.region * CMAP_REGIONS + c];
+			const auto& bottom = colour_maps[(row_blend.region + 1) * CMAP_REGIONS + c];
+			for(size_t i = 0; i < top.size(); i++)
+				dst[c][i] = lerp(top[i], bottom[i], row_blend.weight);
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Predicts a row of pixels, where the row width is known at
+	// compile time unless WIDTH is zero. The colour maps are those
+	// of each column of regions, and the reflectance that of each
+	// column of the reflectance grid, already blended for the row. 
+	// NOTE: without REGIONAL, only the first colour map is used. 
+	template<int WIDTH, bool REGIONAL>
+	static void predict_row(
+		const cv::Vec3b* src,
+		const cv::Vec3f* reflectance_cells,
+		cv::Vec3f* dst,
+		const int width,
+		const ColourMap* colour_maps,
+		const RegionBlend* column_blends,
+		const RegionBlend* reflectance_blends
+	)
+	{
+		const int cols = (WIDTH > 0) ? WIDTH : width;
+		for(int c = 0; c < cols; c++)
+		{
+			const auto& colour = src[c];
 
-		src.forEach<cv::Vec3b>([&](const cv::Vec3b& colour, const int coord[2]) {
 			// Normalize the colour. 
 			const auto norm_col = cv::Vec3f(colour) / 255.0f;
 
 			// Locate the sub-cube within the map. 
-			const int x = static_cast<int>(norm_col[0] / CMAP_STEP);
-			const int y = static_cast<int>(norm_col[1] / CMAP_STEP);
-			const int z = static_cast<int>(norm_col[2] / CMAP_STEP);
+			// NOTE: the last cube is extended to the upper bound of the map.
+			const int x = std::min(static_cast<int>(norm_col[0] / CMAP_STEP), CMAP_SIZE - 2);
+			const int y = std::min(static_cast<int>(norm_col[1] / CMAP_STEP), CMAP_SIZE - 2);
+			const int z = std::min(static_cast<int>(norm_col[2] / CMAP_STEP), CMAP_SIZE - 2);
 			const auto sub_coord = cv::Vec3f(x, y, z) * CMAP_STEP;
 
-			// Perform trillinear interpolation of map colours. 
+			// Perform trillinear interpolation of map colours, in the 
+			// colour maps of the regions to the left and right.
 			const auto tlerp_factors = (norm_col - sub_coord) / CMAP_STEP;
-			const auto prediction = tlerp<cv::Vec3f>(
-				m_ColourMap[xyz_to_3d_index(x, y, z, CMAP_SIZE)],
-				m_ColourMap[xyz_to_3d_index(x, y + 1, z, CMAP_SIZE)],
-				m_ColourMap[xyz_to_3d_index(x + 1, y + 1, z, CMAP_SIZE)],
-				m_ColourMap[xyz_to_3d_index(x + 1, y, z, CMAP_SIZE)],
-				m_ColourMap[xyz_to_3d_index(x, y, z + 1, CMAP_SIZE)],
-				m_ColourMap[xyz_to_3d_index(x, y + 1, z + 1, CMAP_SIZE)],
-				m_ColourMap[xyz_to_3d_index(x + 1, y + 1, z + 1, CMAP_SIZE)],
-				m_ColourMap[xyz_to_3d_index(x + 1, y, z + 1, CMAP_SIZE)],
-				tlerp_factors[0], tlerp_factors[1], tlerp_factors[2]
-			);
+			const auto sample = [&](const ColourMap& colour_map) {
+				return tlerp<cv::Vec3f>(
+					colour_map[xyz_to_3d_index(x, y, z, CMAP_SIZE)],
+					colour_map[xyz_to_3d_index(x, y + 1, z, CMAP_SIZE)],
+					colour_map[xyz_to_3d_index(x + 1, y + 1, z, CMAP_SIZE)],
+					colour_map[xyz_to_3d_index(x + 1, y, z, CMAP_SIZE)],
+					colour_map[xyz_to_3d_index(x, y, z + 1, CMAP_SIZE)],
+					colour_map[xyz_to_3d_index(x, y + 1, z + 1, CMAP_SIZE)],
+					colour_map[xyz_to_3d_index(x + 1, y + 1, z + 1, CMAP_SIZE)],
+					colour_map[xyz_to_3d_index(x + 1, y, z + 1, CMAP_SIZE)],
+					tlerp_factors[0], tlerp_factors[1], tlerp_factors[2]
+				);
+			};
+
+			// The outer parts of the screen only see one region.
+			const auto& blend = column_blends[c];
+			const auto left = sample(colour_maps[REGIONAL ? blend.region : 0]);
+			const auto prediction = (REGIONAL && blend.weight > 0.0f)
+				? lerp(left, sample(colour_maps[blend.region + 1]), blend.weight)
+				: left;
+
+			const auto& cell = reflectance_blends[c];
+			const auto pixel_reflectance = lerp(reflectance_cells[cell.region], reflectance_cells[cell.region + 1], cell.weight);
+			cv::Vec3f& final_colour = dst[c];
+			final_colour[0] = prediction[0] * pixel_reflectance[0];
+			final_colour[1] = prediction[1] * pixel_reflectance[1];
+			final_colour[2] = prediction[2] * pixel_reflectance[2];
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::predict(
+		const cv::Mat& src,
+		cv::Mat& dst
+	) const
+	{
+		predict(src, dst, m_ColourMaps);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::predict(
+		const cv::Mat& src,
+		cv::Mat& dst,
+		const ColourGrid& colour_maps
+	) const
+	{
+		dst.create(src.size(), CV_32FC3);
+		predict(src, dst, colour_maps, cv::Range(0, src.rows));
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::predict(
+		const cv::Mat& src,
+		cv::Mat& dst,
+		const ColourGrid& colour_maps,
+		const cv::Range& rows
+	) const
+	{
+		CV_Assert(src.type() == CV_8UC3 && colour_maps.size() == CMAP_REGIONS * CMAP_REGIONS);
+		CV_Assert(dst.size() == src.size() && dst.type() == CV_32FC3);
+		CV_Assert(rows.start >= 0 && rows.end <= src.rows);
+
+		// Rows are split into tiles which are predicted in parallel. 
+		const double tiles = (m_Settings.predict_tile_rows > 0)
+			? std::ceil(static_cast<double>(rows.size()) / m_Settings.predict_tile_rows) : -1.0;
+
+		// The region and reflectance blends of each column are shared by every row.
+		std::vector<RegionBlend> column_blends(src.cols), reflectance_blends(src.cols);
+		for(int c = 0; c < src.cols; c++)
+		{
+			column_blends[c] = blend_regions(c, src.cols);
+			reflectance_blends[c] = blend_cells(c, src.cols, m_ReflectanceMap.cols);
+		}
 
-			const auto& reflectance = m_ReflectanceMap.at<cv::Vec3f>(coord[0], coord[1]);
-			cv::Vec3f& final_colour = dst.at<cv::Vec3f>(coord[0], coord[1]);
-			final_colour[0] = prediction[0] * reflectance[0];
-			final_colour[1] = prediction[1] * reflectance[1];
-			final_colour[2] = prediction[2] * reflectance[2];
+		// When every region has the same colour map, such as in a synthetic
+		// calibration, the blending between regions is skipped.
+		const bool regional = std::any_of(colour_maps.begin() + 1, colour_maps.end(), [&](const ColourMap& colour_map) {
+			return colour_map != colour_maps.front();
 		});
+
+		dispatch_width(src.cols, [&](auto width) {
+			constexpr int WIDTH = decltype(width)::value;
+			const auto predict_rows = [&](auto is_regional) {
+				constexpr bool REGIONAL = decltype(is_regional)::value;
+				cv::parallel_for_(rows, [&](const cv::Range& tile) {
+					// Rows beyond the outer centres share the same blend, so it is only redone when it changes.
+					thread_local std::array<ColourMap, CMAP_REGIONS> row_maps;
+					thread_local std::vector<cv::Vec3f> reflectance_cells;
+					reflectance_cells.resize(m_ReflectanceMap.cols);
+
+					RegionBlend row_blend = {-1, 0.0f}, reflectance_blend = {-1, 0.0f};
+					for(int r = tile.start; r < tile.end; r++)
+					{
+						if constexpr (REGIONAL)
+						{
+							if(const auto blend = blend_regions(r, src.rows); blend.region != row_blend.region || blend.weight != row_blend.weight)
+							{
+								blend_colour_rows(colour_maps, blend, row_maps);
+								row_blend = blend;
+							}
+						}
+
+						if(const auto blend = blend_cells(r, src.rows, m_ReflectanceMap.rows); blend.region != reflectance_blend.region || blend.weight != reflectance_blend.weight)
+						{
+							blend_reflectance_rows(m_ReflectanceMap, blend, reflectance_cells.data());
+							reflectance_blend = blend;
+						}
+
+						predict_row<WIDTH, REGIONAL>(
+							src.ptr<cv::Vec3b>(r),
+							reflectance_cells.data(),
+							dst.ptr<cv::Vec3f>(r),
+							src.cols,
+							REGIONAL ? row_maps.data() : colour_maps.data(),
+							column_blends.data(),
+							reflectance_blends.data()
+						);
+					}
+				}, tiles);
+			};
+
+			if(regional) predict_rows(std::true_type{});
+			else predict_rows(std::false_type{});
+		});
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::transition(
+		const cv::Mat& target,
+		cv::Mat& state
+	) const
+	{
+		CV_Assert(target.type() == CV_32FC3);
+
+		if(state.size() != target.size() || state.type() != target.type())
+		{
+			target.copyTo(state);
+			return;
+		}
+
+		// Each channel brightens and darkens at its own rate.
+		const auto& [rise, fall] = m_DisplayResponse;
+		cv::parallel_for_(cv::Range(0, target.rows), [&](const cv::Range& rows) {
+			for(int r = rows.start; r < rows.end; r++)
+			{
+				const auto* target_row = target.ptr<cv::Vec3f>(r);
+				auto* state_row = state.ptr<cv::Vec3f>(r);
+				for(int c = 0; c < target.cols; c++)
+				{
+					for(int k = 0; k < 3; k++)
+					{
+						const float difference = target_row[c][k] - state_row[c][k];
+						state_row[c][k] += (difference > 0.0f ? rise[k] : fall[k]) * difference;
+					}
+				}
+			}
+		});
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::correct(
+		const Frame& src,
+		Frame& dst
+	) const
+	{
+		if constexpr (cpu_native_pipeline)
+		{
+			// Each band of output rows only depends on its own band of the
+			// correction map, so the bands can be remapped independently. 
+			if(m_Settings.correct_tile_rows > 0)
+			{
+				dst.create(m_CorrectionMap.size(), src.type());
+
+				const int bands = (m_CorrectionMap.rows + m_Settings.correct_tile_rows - 1) / m_Settings.correct_tile_rows;
+				cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+					for(int b = range.start; b < range.end; b++)
+					{
+						const int start = b * m_Settings.correct_tile_rows;
+						const cv::Range rows(start, std::min(start + m_Settings.correct_tile_rows, m_CorrectionMap.rows));
+						
+						Frame dst_band = dst.rowRange(rows);
+						correct(src, dst_band, rows);
+					}
+				});
+				return;
+			}
+		}
+
+		correct(src, dst, cv::Range::all());
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
 	void ViewCalibrator::correct(
-		const cv::UMat& src,
-		cv::UMat& dst
+		cv::InputArray src,
+		cv::OutputArray dst,
+		const cv::Range& rows
 	) const
 	{
-		cv::remap(src, dst, m_CorrectionMap, cv::noArray(), cv::INTER_CUBIC);
+		// The fixed-point map is half the size to read and saves cv::remap from 
+		// converting the float map on every call, but rounds to 1/32nd pixel.
+		if(m_Settings.correct_fixed_point)
+			cv::remap(src, dst, m_FixedMap.rowRange(rows), m_FixedTable.rowRange(rows), m_Settings.correct_interpolation);
+		else
+			cv::remap(src, dst, m_CorrectionMap.rowRange(rows), cv::noArray(), m_Settings.correct_interpolation);
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -526,11 +1479,16 @@ namespace vt
 	{
 		ViewProperties context;
 		m_ReflectanceMap.copyTo(context.reflectance_map);
+		m_NoiseMap.copyTo(context.noise_map);
+		context.display_response = m_DisplayResponse;
+		context.input_resolution = m_InputResolution;
 		context.output_resolution = m_OutputResolution;
+		context.exposure = m_Exposure;
 		context.view_homography = m_ViewHomography;
 		context.screen_contour = m_ScreenContour;
-		context.correction_map = m_CorrectionMap;
-		context.colour_map = m_ColourMap;
+		context.correction_grid = m_CorrectionGrid;
+		context.colour_maps = m_ColourMaps;
+		context.settings = m_Settings;
 		return context;
 	}
 
@@ -538,15 +1496,15 @@ namespace vt
 
 	std::optional<std::vector<cv::Point2f>> ViewCalibrator::detect_screen(
 		const std::vector<cv::Scalar>& colours,
-		const std::vector<cv::UMat>& samples
+		const std::vector<Frame>& samples
 	) const
 	{
 		CV_Assert(samples.size() == colours.size());
 		CV_Assert(samples.size() > 0);
 
 		// Fill in all colour masks
-		cv::UMat difference, mask;
-		std::vector<cv::UMat> colour_masks;
+		Frame difference, mask;
+		std::vector<Frame> colour_masks;
 		for (int i = 0; i < colours.size(); i++)
 		{
 			// Create colour mask by detecting closest calibration colours. 
@@ -647,7 +1605,7 @@ namespace vt
 
 	std::optional<std::vector<cv::Point2f>> ViewCalibrator::detect_chessboard(
 		const std::vector<cv::Point2f>& screen_bounds,
-		const cv::UMat& chessboard_sample,
+		const Frame& chessboard_sample,
 		const cv::Size& chessboard_size
 	) const
 	{
@@ -658,7 +1616,7 @@ namespace vt
 		std::vector<std::vector<cv::Point>> screen_contour(1);
 		for(const auto& pt : screen_bounds) screen_contour[0].push_back(pt);
 
-		cv::UMat bordered_chessboard_sample(chessboard_sample.size(), CV_8UC3);
+		Frame bordered_chessboard_sample(chessboard_sample.size(), CV_8UC3);
 		bordered_chessboard_sample.setTo(cv::Scalar::zeros());
 		cv::drawContours(bordered_chessboard_sample, screen_contour, -1, cv::Scalar(255, 255, 255), cv::FILLED);
 		cv::bitwise_not(bordered_chessboard_sample, bordered_chessboard_sample);
@@ -696,6 +1654,22 @@ namespace vt
 		}
 	}
 
+//---------------------------------------------------------------------------------------------------------------------
+
+	void ViewCalibrator::build_correction_maps()
+	{
+		// NOTE: copies of the calibrator share their maps, so new ones are always allocated.
+		cv::Mat correction_map;
+		expand_correction_grid(m_CorrectionGrid, m_OutputResolution, correction_map);
+
+		Frame float_map, fixed_map, fixed_table;
+		correction_map.copyTo(float_map);
+		cv::convertMaps(correction_map, cv::noArray(), fixed_map, fixed_table, CV_16SC2);
+		m_CorrectionMap = float_map;
+		m_FixedMap = fixed_map;
+		m_FixedTable = fixed_table;
+	}
+
 //---------------------------------------------------------------------------------------------------------------------
 
 }
@@ -1,28 +1,94 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include <optional>
 #include <vector>
 #include <array>
 
 #include "Abstractions/Webcam.hpp"
 #include "Utility/Calibrator.hpp"
+#include "Utility/Settings.hpp"
+#include "Utility/Profiler.hpp"
 
 namespace vt
 {
 
+	// Photometric colour map properties.
+	constexpr auto CMAP_SIZE = 8;
+	constexpr auto CMAP_STEP = 1.0f / (CMAP_SIZE - 1.0f);
+
+	// The colour response varies across the screen, so a colour map is
+	// measured for each region of a grid, and blended between regions.
+	constexpr auto CMAP_REGIONS = 4;
+
+	using ColourMap = std::array<cv::Vec3f, CMAP_SIZE * CMAP_SIZE * CMAP_SIZE>;
+
+	// Colour maps of each region, in row major order.
+	// NOTE: this is kept on the heap, as it is too large for the stack. 
+	using ColourGrid = std::vector<ColourMap>;
+
+	// The reflectance and the correction map are smooth, so are stored as grids
+	// with a point at the centre of each cell of this many pixels, which are
+	// blended bilinearly. The reflectance is stored in half precision.
+	constexpr auto REFLECTANCE_CELL = 8;
+	constexpr auto CORRECTION_CELL = 8;
+
+	// Location of a pixel between the centres of the two regions
+	// around it, where pixels beyond the outer centres are clamped.
+	struct RegionBlend
+	{
+		int region;
+		float weight;
+	};
+
+	RegionBlend blend_regions(const int coord, const int extent);
+
+	// Location of a pixel between the centres of the two cells of a grid around it.
+	RegionBlend blend_cells(const int coord, const int extent, const int cells);
+
+	// Samples a CV_32FC2 correction map onto its control grid.
+	cv::Mat sample_correction_grid(const cv::Mat& correction_map);
+
+	// Expands a correction control grid into a CV_32FC2 map, where pixels
+	// beyond the outer centres are extrapolated rather than clamped.
+	void expand_correction_grid(const cv::Mat& grid, const cv::Size& resolution, cv::Mat& dst);
+
+	// Expands a CV_16FC3 reflectance grid into a CV_32FC3 map.
+	void expand_reflectance_grid(const cv::Mat& grid, const cv::Size& resolution, cv::Mat& dst);
+
+	// Fraction of the remaining transition that the display covers in each
+	// webcam frame, per channel, when brightening and when darkening. The
+	// display is modelled as instant if it was never measured.
+	struct DisplayResponse
+	{
+		cv::Vec3f rise = cv::Vec3f::all(1.0f);
+		cv::Vec3f fall = cv::Vec3f::all(1.0f);
+	};
+
 	// This is just a way of transferring a calibration 
 	// between two OpenCL contexts on different threads. 
 	struct ViewProperties
 	{
 		// Geometric Calibration
 		cv::Mat view_homography;
-		cv::UMat correction_map;
+		cv::Mat correction_grid;
+		cv::Size input_resolution;
 		cv::Size output_resolution;
 		std::vector<cv::Point2f> screen_contour;
+		double exposure = 0.0;
 
 		// Photometric calibration
-		std::array<cv::Vec3f, 8 * 8 * 8> colour_map;
+		ColourGrid colour_maps;
 		cv::Mat reflectance_map;
+
+		// Temporal noise of the webcam
+		cv::Mat noise_map;
+
+		// Temporal response of the display
+		DisplayResponse display_response;
+
+		// Runtime settings
+		PipelineSettings settings;
 	};
 
 
@@ -34,21 +100,63 @@ namespace vt
 
 		ViewCalibrator(const ViewProperties& context);
 
+		// Loads a calibration previously written by save().
+		static std::optional<ViewCalibrator> TryLoad(const std::string& path);
+
+		void save(const std::string& path) const;
+
+		const cv::Size& input_resolution() const;
+
 		const cv::Size& output_resolution() const; 
 
 		float ambient_intensity() const;
+
+		// Temporal standard deviation of each pixel of the corrected view, at
+		// a lower resolution. Empty if the calibration has no noise model. 
+		const cv::Mat& noise_map() const;
+
+		const DisplayResponse& display_response() const;
+
+		const ColourGrid& colour_maps() const;
+
+		// Reflectance of the screen as a low resolution CV_16FC3 grid.
+		const cv::Mat& reflectance_map() const;
+
+		// Use tuned settings for the correction and prediction.
+		void tune(const PipelineSettings& settings);
+
+		const PipelineSettings& settings() const;
 		
-		// Calibrate to the current view
-		void calibrate(
+		// Calibrate to the current view. This retries until it succeeds, except
+		// on a virtual rig, which can't be adjusted so returns false instead.
+		// NOTE: the profiler records each attempt, but not the time spent
+		// waiting for the user to respond.
+		bool calibrate(
 			Webcam& webcam,
 			const float min_coverage,
-			const int settle_time_ms = 500
+			const int settle_time_ms = 500,
+			Profiler* profiler = nullptr
 		);
 
+		// Restore the camera settings used by the calibration. 
+		void restore(Webcam& webcam) const;
+
+		// Checks that the calibration still fits the view, such as after
+		// the camera or screen was moved, by comparing the prediction of a
+		// chessboard to the corrected capture of it. 
+		bool verify(Webcam& webcam, const int settle_time_ms = 500) const;
+
 		// Correct frame based on the calibration. 
 		void correct(
-			const cv::UMat& src,
-			cv::UMat& dst
+			const Frame& src,
+			Frame& dst
+		) const;
+
+		// Correct a band of rows of the output frame.
+		void correct(
+			cv::InputArray src,
+			cv::OutputArray dst,
+			const cv::Range& rows
 		) const;
 
 		// Predict the output of the projector.
@@ -58,40 +166,96 @@ namespace vt
 			cv::Mat& dst
 		) const;
 
+		// Predict the output of the projector with different colour maps,
+		// such as those refined while running, in place of the calibrated.
+		void predict(
+			const cv::Mat& src,
+			cv::Mat& dst,
+			const ColourGrid& colour_maps
+		) const;
+
+		// Predict a band of rows of the output, leaving the other rows of dst as they were.
+		void predict(
+			const cv::Mat& src,
+			cv::Mat& dst,
+			const ColourGrid& colour_maps,
+			const cv::Range& rows
+		) const;
+
+		// Advances the state of the display by one webcam frame towards the
+		// target prediction, following the measured response of the display.
+		// NOTE: the state starts at the target if it doesn't match it. 
+		void transition(
+			const cv::Mat& target,
+			cv::Mat& state
+		) const;
+
 		ViewProperties context() const;
 
 	private:
 
 		std::optional<std::vector<cv::Point2f>> find_geometric_model(
 			const std::vector<cv::Scalar>& colours,
-			const std::vector<cv::UMat>& samples,
-			const cv::UMat& chessboard_sample,
+			const std::vector<Frame>& samples,
+			const Frame& chessboard_sample,
 			const cv::Size& chessboard_size
 		);
 
+		std::optional<std::vector<cv::Point2f>> find_structured_light_model(
+			Webcam& webcam,
+			const int settle_time_ms,
+			const std::string& window_name,
+			const std::vector<cv::Scalar>& colours,
+			const std::vector<Frame>& samples
+		);
+
+		void find_noise_model(
+			Webcam& webcam,
+			const int settle_time_ms,
+			const std::string& window_name
+		);
+
+		void find_temporal_model(
+			Webcam& webcam,
+			const int settle_time_ms,
+			const std::string& window_name
+		);
+
 		void find_photometric_model(
 			Webcam& webcam,
 			const int settle_time_ms,
 			const std::string& window_name,
-			const cv::UMat& white_sample
+			const Frame& white_sample
 		);
 
 		std::optional<std::vector<cv::Point2f>> detect_screen(
 			const std::vector<cv::Scalar>& colours,
-			const std::vector<cv::UMat>& samples
+			const std::vector<Frame>& samples
 		) const;
 
 		std::optional<std::vector<cv::Point2f>> detect_chessboard(
 			const std::vector<cv::Point2f>& screen_bounds,
-			const cv::UMat& chessboard_sample,
+			const Frame& chessboard_sample,
 			const cv::Size& chessboard_size
 		) const;
+
+		// Expands the correction grid into the float and fixed-point maps.
+		void build_correction_maps();
 		
 	private:
 		const cv::Size m_OutputResolution;
 		
+		// Camera properties
+		cv::Size m_InputResolution;
+		double m_Exposure = 0.0;
+
 		// Geometric calibration
-		cv::UMat m_CorrectionMap;
+		// Grid Size: 1/8th of the output resolution
+		// The fixed-point map holds the integer coordinates of each pixel, 
+		// and the table its 1/32nd pixel offset, as read by cv::remap.
+		cv::Mat m_CorrectionGrid;
+		Frame m_CorrectionMap;
+		Frame m_FixedMap, m_FixedTable;
 		cv::Mat m_ViewHomography;
 		std::vector<cv::Point2f> m_ScreenContour;
 
@@ -99,8 +263,20 @@ namespace vt
 		// Map Size: 8x8x8 = 512 samples
 		// Colour Step: 1/7 = 0.142
 		// Colour Mapping: x = B, y = G, z = R
-		std::array<cv::Vec3f, 8 * 8 * 8> m_ColourMap;
+		// Region Grid: 4x4, blended bilinearly
+		// Reflectance Grid: 1/8th of the output resolution, in CV_16FC3
+		ColourGrid m_ColourMaps;
 		cv::Mat m_ReflectanceMap;
+
+		// Noise calibration
+		// Map Size: 1/8th of the output resolution
+		cv::Mat m_NoiseMap;
+
+		// Temporal calibration
+		DisplayResponse m_DisplayResponse;
+
+		// Runtime settings
+		PipelineSettings m_Settings;
 	};
 
 
@@ -0,0 +1,211 @@
+#include "Autotuner.hpp"
+
+#include <opencv2/core/ocl.hpp>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "Benchmark.hpp"
+#include "../Systems/MaskGenerator.hpp"
+#include "../Utility/Common.hpp"
+#include "../Configuration.hpp"
+
+namespace vt
+{
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	template<typename T>
+	static double median_time_ms(T&& task)
+	{
+		// Wait for queued OpenCL work, so that it is included in the timing.
+		const auto synchronize = []() {
+			if constexpr (!cpu_native_pipeline) cv::ocl::finish();
+		};
+
+		for(int i = 0; i < WARM_UP_FRAMES; i++)
+			task();
+		synchronize();
+
+		std::vector<double> times;
+		for(int i = 0; i < AUTOTUNE_SAMPLES; i++)
+		{
+			const auto start = std::chrono::high_resolution_clock::now();
+			task();
+			synchronize();
+			const auto end = std::chrono::high_resolution_clock::now();
+
+			times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		}
+
+		std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+		return times[times.size() / 2];
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	PipelineSettings autotune(const ViewCalibrator& calibrator, std::ostream& stream)
+	{
+		const auto& output_size = calibrator.output_resolution();
+		const auto& input_size = calibrator.input_resolution();
+		
+		// Candidates are powers of two, up to the number of cores.
+		std::vector<int> thread_counts;
+		const int max_threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+		for(int threads = 1; threads < max_threads; threads *= 2)
+			thread_counts.push_back(threads);
+		thread_counts.push_back(max_threads);
+
+		// Zero leaves the tiling up to OpenCV.
+		const std::vector<int> predict_tiles = {0, 4, 8, 16, 32, 64};
+		const std::vector<int> correct_tiles = cpu_native_pipeline
+			? std::vector<int>{0, 8, 16, 32, 64} : std::vector<int>{0};
+		
+		// Bilinear interpolation is only a candidate if it is indistinguishable
+		// from bicubic interpolation, as the masks depend on it. 
+		cv::RNG rng(0);
+		cv::Mat screen_sample, webcam_sample, prediction_buffer;
+		make_synthetic_frames(calibrator, rng, screen_sample, webcam_sample);
+
+		Frame raw_frame, screen_frame, prediction, foreground_mask, shadow_mask;
+		webcam_sample.copyTo(raw_frame);
+		calibrator.predict(screen_sample, prediction_buffer);
+		prediction_buffer.copyTo(prediction);
+
+		ViewCalibrator candidate = calibrator;
+		std::vector<int> interpolations = {cv::INTER_CUBIC};
+		{
+			Frame cubic_frame, linear_frame;
+			PipelineSettings settings = calibrator.settings();
+
+			settings.correct_interpolation = cv::INTER_CUBIC;
+			candidate.tune(settings);
+			candidate.correct(raw_frame, cubic_frame);
+
+			settings.correct_interpolation = cv::INTER_LINEAR;
+			candidate.tune(settings);
+			candidate.correct(raw_frame, linear_frame);
+
+			const double error = cv::norm(cubic_frame, linear_frame, cv::NORM_L1) / (cubic_frame.total() * cubic_frame.channels());
+			stream << cv::format("Bilinear correction error: %.3f\n", error);
+			
+			if(error <= AUTOTUNE_MAX_ERROR)
+				interpolations.push_back(cv::INTER_LINEAR);
+		}
+
+		MaskGenerator mask_generator;
+		mask_generator.configure(calibrator);
+
+		PipelineSettings best_settings;
+		double best_time = std::numeric_limits<double>::max();
+		for(const int threads : thread_counts)
+		{
+			cv::setNumThreads(threads);
+
+			PipelineSettings settings = calibrator.settings();
+			settings.input_resolution = input_size;
+			settings.output_resolution = output_size;
+			settings.worker_threads = threads;
+
+			// Each stage is tuned independently for this thread count.
+			double predict_time = std::numeric_limits<double>::max();
+			for(const int tile_rows : predict_tiles)
+			{
+				PipelineSettings trial = settings;
+				trial.predict_tile_rows = tile_rows;
+				candidate.tune(trial);
+
+				const double time = median_time_ms([&]() { candidate.predict(screen_sample, prediction_buffer); });
+				if(time < predict_time)
+				{
+					predict_time = time;
+					settings.predict_tile_rows = tile_rows;
+				}
+			}
+
+			double correct_time = std::numeric_limits<double>::max();
+			for(const int interpolation : interpolations)
+			{
+				// The fixed-point map only rounds the coordinates to 1/32nd
+				// pixel, which the OpenCV CPU remap does internally anyway.
+				for(const bool fixed_point : {true, false})
+				{
+					for(const int tile_rows : correct_tiles)
+					{
+						PipelineSettings trial = settings;
+						trial.correct_interpolation = interpolation;
+						trial.correct_fixed_point = fixed_point;
+						trial.correct_tile_rows = tile_rows;
+						candidate.tune(trial);
+
+						const double time = median_time_ms([&]() { candidate.correct(raw_frame, screen_frame); });
+						if(time < correct_time)
+						{
+							correct_time = time;
+							settings.correct_interpolation = interpolation;
+							settings.correct_fixed_point = fixed_point;
+							settings.correct_tile_rows = tile_rows;
+						}
+					}
+				}
+			}
+
+			const double segment_time = median_time_ms([&]() {
+				mask_generator.segment(screen_frame, prediction, foreground_mask, shadow_mask);
+			});
+			mask_generator.reset();
+
+			const double total_time = predict_time + correct_time + segment_time;
+			stream << cv::format(
+				"%2d threads: predict %.3fms (%d rows), correct %.3fms (%d rows, %s, %s map), segment %.3fms\n",
+				threads,
+				predict_time, settings.predict_tile_rows,
+				correct_time, settings.correct_tile_rows,
+				settings.correct_interpolation == cv::INTER_LINEAR ? "bilinear" : "bicubic",
+				settings.correct_fixed_point ? "fixed" : "float",
+				segment_time
+			);
+
+			if(total_time < best_time)
+			{
+				best_time = total_time;
+				best_settings = settings;
+			}
+		}
+		
+		// Leave OpenCV as it was found, the settings are applied by the caller.
+		calibrator.settings().apply();
+
+		return best_settings;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	int run_autotuner()
+	{
+		const cv::Size output_resolution(CALIB_OUTPUT_WIDTH, CALIB_OUTPUT_HEIGHT);
+
+		auto calibrator = ViewCalibrator::TryLoad(CALIB_SAVE_PATH);
+		if(!calibrator.has_value())
+		{
+			std::cout << "No saved calibration found, using a synthetic calibration.\n";
+			calibrator.emplace(make_synthetic_calibration(cv::Size(WEBCAM_WIDTH, WEBCAM_HEIGHT), output_resolution));
+		}
+
+		// Keep the segmentation parameters which were chosen for this site.
+		if(const auto previous = PipelineSettings::TryLoad(SETTINGS_SAVE_PATH); previous.has_value())
+			calibrator->tune(*previous);
+
+		const auto settings = autotune(*calibrator, std::cout);
+		settings.save(SETTINGS_SAVE_PATH);
+
+		std::cout << "Saved settings: " << SETTINGS_SAVE_PATH << std::endl;
+		return 0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
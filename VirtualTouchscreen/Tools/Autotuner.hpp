@@ -0,0 +1,20 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <ostream>
+
+#include "Systems/ViewCalibrator.hpp"
+#include "Utility/Settings.hpp"
+
+namespace vt
+{
+
+	// Measures the pipeline stages under each candidate setting on
+	// this machine, at the resolutions of the calibration, and
+	// returns the fastest combination.
+	PipelineSettings autotune(const ViewCalibrator& calibrator, std::ostream& stream);
+
+	// Entry point for tuning on demand from the command line.
+	int run_autotuner();
+
+}
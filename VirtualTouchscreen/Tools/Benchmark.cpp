@@ -0,0 +1,550 @@
+#include "Benchmark.hpp"
+#include "CalibrationBenchmark.hpp"
+
+#include <opencv2/core/ocl.hpp>
+#include <iostream>
+
+#include "../Systems/MaskGenerator.hpp"
+#include "../Systems/FingerTracker.hpp"
+#include "../Utility/Profiler.hpp"
+#include "../Utility/PerfCounters.hpp"
+#include "../Utility/Common.hpp"
+#include "../Configuration.hpp"
+
+namespace vt
+{
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Screens change every webcam frame during video, and rarely otherwise.
+	constexpr int PREDICTION_SCREEN_INTERVALS[] = {1, 4, 30};
+
+	// Regional colour maps may cost at most this much more to predict than one colour map.
+	constexpr auto COLOUR_MAP_BUDGET = 2.0;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	ViewProperties make_synthetic_calibration(const cv::Size& input_resolution, const cv::Size& output_resolution)
+	{
+		ViewProperties calibration;
+		calibration.input_resolution = input_resolution;
+		calibration.output_resolution = output_resolution;
+		calibration.view_homography = cv::Mat::eye(3, 3, CV_64FC1);
+
+		// The screen fills the entire webcam view.
+		const cv::Point2f br = cv::Size2f(input_resolution);
+		calibration.screen_contour = {{0, 0}, {0, br.y}, {br.x, br.y}, {br.x, 0}};
+
+		// Map each output pixel to its scaled location in the webcam view.
+		const float sx = static_cast<float>(input_resolution.width) / static_cast<float>(output_resolution.width);
+		const float sy = static_cast<float>(input_resolution.height) / static_cast<float>(output_resolution.height);
+
+		cv::Mat correction_map(output_resolution, CV_32FC2);
+		correction_map.forEach<cv::Vec2f>([&](cv::Vec2f& coord, const int position[2]) {
+			coord[0] = position[1] * sx;
+			coord[1] = position[0] * sy;
+		});
+		calibration.correction_grid = sample_correction_grid(correction_map);
+
+		// The projector and webcam have a perfectly linear colour response, everywhere on the screen.
+		ColourMap colour_map;
+		for(int z = 0; z < CMAP_SIZE; z++)
+			for(int y = 0; y < CMAP_SIZE; y++)
+				for(int x = 0; x < CMAP_SIZE; x++)
+					colour_map[xyz_to_3d_index(x, y, z, CMAP_SIZE)] = cv::Vec3f(x, y, z) * CMAP_STEP * 255.0f;
+		calibration.colour_maps.assign(CMAP_REGIONS * CMAP_REGIONS, colour_map);
+
+		calibration.reflectance_map.create(2, 2, CV_16FC3);
+		calibration.reflectance_map.setTo(cv::Scalar::all(1.0));
+
+		return calibration;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void make_synthetic_frames(
+		const ViewCalibrator& calibrator,
+		cv::RNG& rng,
+		cv::Mat& screen_frame,
+		cv::Mat& webcam_frame
+	)
+	{
+		const auto& output_size = calibrator.output_resolution();
+		const auto& input_size = calibrator.input_resolution();
+
+		// Fill the screen with randomly coloured blocks.
+		cv::Mat blocks(8, 8, CV_8UC3);
+		rng.fill(blocks, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+		cv::resize(blocks, screen_frame, output_size, 0, 0, cv::INTER_NEAREST);
+
+		// Render the hand in front of the screen as seen by the webcam.
+		cv::resize(screen_frame, webcam_frame, input_size, 0, 0, cv::INTER_LINEAR);
+
+		const cv::Point palm(rng.uniform(input_size.width / 4, 3 * input_size.width / 4), input_size.height);
+		const cv::Point tip(palm.x + rng.uniform(-input_size.width / 8, input_size.width / 8), input_size.height / 3);
+		const int width = std::max(input_size.width / 40, 2);
+
+		cv::ellipse(webcam_frame, palm, cv::Size(width * 4, width * 5), 0, 0, 360, cv::Scalar(40, 60, 90), cv::FILLED);
+		cv::line(webcam_frame, palm, tip, cv::Scalar(40, 60, 90), width, cv::LINE_AA);
+
+		// Add some sensor noise to the capture.
+		cv::Mat noise(input_size, CV_16SC3);
+		rng.fill(noise, cv::RNG::NORMAL, cv::Scalar::all(0), cv::Scalar::all(3));
+		cv::add(webcam_frame, noise, webcam_frame, cv::noArray(), CV_8UC3);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void benchmark_pipeline(const ViewCalibrator& calibrator, const int frames, std::ostream& stream)
+	{
+		CV_Assert(frames > 0);
+
+		MaskGenerator mask_generator;
+		FingerTracker finger_tracker;
+		finger_tracker.tune(calibrator.settings());
+		mask_generator.configure(calibrator);
+
+		// Wait for queued OpenCL work, so that it is included in the stage timings.
+		const auto synchronize = []() {
+			if constexpr (!cpu_native_pipeline) cv::ocl::finish();
+		};
+
+		std::string mode = "CPU Native Pipeline (cv::Mat)";
+		if constexpr (!cpu_native_pipeline)
+		{
+			mode = cv::ocl::useOpenCL() ? "T-API Pipeline (cv::UMat, OpenCL)" : "T-API Pipeline (cv::UMat, CPU)";
+		}
+
+		Profiler profiler(mode), warm_up_profiler("Warm Up");
+		PerfCounters perf_counters(mode, show_perf_counters);
+
+		// The counters only see the calling thread, so OpenCV is pinned to it while they
+		// are open. NOTE: any OpenCL work is still done on the device, and isn't counted.
+		const int previous_threads = cv::getNumThreads();
+		if(perf_counters.valid())
+			cv::setNumThreads(1);
+
+		cv::RNG rng(0);
+		cv::Mat screen_sample, webcam_sample, prediction_buffer;
+		Frame raw_frame, screen_frame, prediction, foreground_mask, shadow_mask;
+		for(int i = 0; i < frames + WARM_UP_FRAMES; i++)
+		{
+			make_synthetic_frames(calibrator, rng, screen_sample, webcam_sample);
+			webcam_sample.copyTo(raw_frame);
+			synchronize();
+
+			// The first frames build the kernels, so aren't measured.
+			auto& active_profiler = (i < WARM_UP_FRAMES) ? warm_up_profiler : profiler;
+			if(i == WARM_UP_FRAMES) perf_counters.clear();
+
+			auto total = active_profiler.measure("Total");
+			{
+				auto phase = active_profiler.measure("Correct");
+				auto counter = perf_counters.measure("Correct");
+				calibrator.correct(raw_frame, screen_frame);
+				synchronize();
+			}
+			{
+				auto phase = active_profiler.measure("Predict");
+				auto counter = perf_counters.measure("Predict");
+				calibrator.predict(screen_sample, prediction_buffer);
+			}
+			{
+				auto phase = active_profiler.measure("Transfer prediction");
+				auto counter = perf_counters.measure("Transfer prediction");
+				prediction_buffer.copyTo(prediction);
+				synchronize();
+			}
+			{
+				auto phase = active_profiler.measure("Segment");
+				auto counter = perf_counters.measure("Segment");
+				mask_generator.segment(screen_frame, prediction, foreground_mask, shadow_mask);
+				synchronize();
+			}
+			{
+				auto phase = active_profiler.measure("Detect");
+				auto counter = perf_counters.measure("Detect");
+				finger_tracker.detect(foreground_mask, shadow_mask);
+			}
+		}
+
+		cv::setNumThreads(previous_threads);
+
+		profiler.summarize(stream);
+		perf_counters.report(stream);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void benchmark_segmentation(const ViewCalibrator& calibrator, const int frames, std::ostream& stream)
+	{
+		CV_Assert(frames > 0);
+
+		MaskGenerator eager_generator(false), graph_generator(true), stream_generator(false);
+		eager_generator.configure(calibrator);
+		graph_generator.configure(calibrator);
+		stream_generator.configure(calibrator);
+
+		const auto synchronize = []() {
+			if constexpr (!cpu_native_pipeline) cv::ocl::finish();
+		};
+
+		// Fraction of pixels on which two masks disagree. 
+		const auto disagreement = [](const Frame& a, const Frame& b) {
+			return static_cast<double>(cv::norm(a, b, cv::NORM_HAMMING)) / (a.total() * 8.0);
+		};
+
+		Profiler profiler("Segmentation"), warm_up_profiler("Warm Up");
+
+		cv::RNG rng(0);
+		cv::Mat screen_sample, webcam_sample, prediction_buffer;
+		Frame raw_frame, screen_frame, stream_frame, prediction;
+		Frame eager_foreground, eager_shadow, graph_foreground, graph_shadow, stream_foreground, stream_shadow;
+
+		double foreground_disagreement = 0.0, shadow_disagreement = 0.0;
+		double max_foreground_disagreement = 0.0;
+		double stream_foreground_disagreement = 0.0, stream_shadow_disagreement = 0.0;
+		for(int i = 0; i < frames + WARM_UP_FRAMES; i++)
+		{
+			make_synthetic_frames(calibrator, rng, screen_sample, webcam_sample);
+			webcam_sample.copyTo(raw_frame);
+			calibrator.predict(screen_sample, prediction_buffer);
+			prediction_buffer.copyTo(prediction);
+			synchronize();
+
+			auto& active_profiler = (i < WARM_UP_FRAMES) ? warm_up_profiler : profiler;
+			{
+				auto phase = active_profiler.measure("Correct");
+				calibrator.correct(raw_frame, screen_frame);
+				synchronize();
+			}
+			{
+				auto phase = active_profiler.measure("Eager");
+				eager_generator.segment(screen_frame, prediction, eager_foreground, eager_shadow);
+				synchronize();
+			}
+			{
+				auto phase = active_profiler.measure("G-API Fluid Graph");
+				graph_generator.segment(screen_frame, prediction, graph_foreground, graph_shadow);
+				synchronize();
+			}
+			{
+				auto phase = active_profiler.measure("Tile Stream (Correct + Segment)");
+				stream_generator.correct_and_segment(calibrator, raw_frame, prediction, stream_frame, stream_foreground, stream_shadow);
+				synchronize();
+			}
+
+			if(i >= WARM_UP_FRAMES)
+			{
+				const double foreground = disagreement(eager_foreground, graph_foreground);
+				foreground_disagreement += foreground / frames;
+				shadow_disagreement += disagreement(eager_shadow, graph_shadow) / frames;
+				max_foreground_disagreement = std::max(max_foreground_disagreement, foreground);
+
+				stream_foreground_disagreement += disagreement(eager_foreground, stream_foreground) / frames;
+				stream_shadow_disagreement += disagreement(eager_shadow, stream_shadow) / frames;
+			}
+		}
+
+		profiler.summarize(stream);
+
+		// The fused kernel sums in a different order, so pixels right at 
+		// the noise floor may flip, but the masks should otherwise agree.
+		stream << cv::format(
+			"  Graph mask disagreement: foreground %.4f%% (max %.4f%%), shadow %.4f%%\n",
+			foreground_disagreement * 100.0, max_foreground_disagreement * 100.0, shadow_disagreement * 100.0
+		);
+
+		// The tile stream runs the same operations on the same rows, so should match
+		// exactly in the CPU native pipeline.
+		stream << cv::format(
+			"  Tile stream mask disagreement: foreground %.4f%%, shadow %.4f%%\n",
+			stream_foreground_disagreement * 100.0, stream_shadow_disagreement * 100.0
+		);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void benchmark_correction(const ViewCalibrator& calibrator, const int frames, std::ostream& stream)
+	{
+		CV_Assert(frames > 0);
+
+		struct Variant
+		{
+			Variant(const std::string& name, const int interpolation, const bool fixed_point, const ViewCalibrator& calibrator)
+				: name(name),
+				  interpolation(interpolation),
+				  fixed_point(fixed_point),
+				  calibrator(calibrator)
+			{}
+
+			std::string name;
+			int interpolation;
+			bool fixed_point;
+			ViewCalibrator calibrator;
+			MaskGenerator generator;
+			Frame view, foreground, shadow;
+			double view_error = 0.0, foreground_disagreement = 0.0, shadow_disagreement = 0.0;
+		};
+
+		// The first variant is the reference that the others are measured against.
+		std::vector<std::unique_ptr<Variant>> variants;
+		const auto add_variant = [&](const std::string& name, const int interpolation, const bool fixed_point) {
+			auto& variant = variants.emplace_back(new Variant(name, interpolation, fixed_point, calibrator));
+			PipelineSettings settings = calibrator.settings();
+			settings.correct_interpolation = interpolation;
+			settings.correct_fixed_point = fixed_point;
+			variant->calibrator.tune(settings);
+			variant->generator.configure(variant->calibrator);
+		};
+		add_variant("Bicubic (float map)", cv::INTER_CUBIC, false);
+		add_variant("Bicubic (fixed-point map)", cv::INTER_CUBIC, true);
+		add_variant("Bilinear (float map)", cv::INTER_LINEAR, false);
+		add_variant("Bilinear (fixed-point map)", cv::INTER_LINEAR, true);
+
+		const auto synchronize = []() {
+			if constexpr (!cpu_native_pipeline) cv::ocl::finish();
+		};
+
+		const auto disagreement = [](const Frame& a, const Frame& b) {
+			return static_cast<double>(cv::norm(a, b, cv::NORM_HAMMING)) / (a.total() * 8.0);
+		};
+
+		Profiler profiler("Correction"), warm_up_profiler("Warm Up");
+
+		cv::RNG rng(0);
+		cv::Mat screen_sample, webcam_sample, prediction_buffer;
+		Frame raw_frame, prediction;
+		for(int i = 0; i < frames + WARM_UP_FRAMES; i++)
+		{
+			make_synthetic_frames(calibrator, rng, screen_sample, webcam_sample);
+			webcam_sample.copyTo(raw_frame);
+			calibrator.predict(screen_sample, prediction_buffer);
+			prediction_buffer.copyTo(prediction);
+			synchronize();
+
+			auto& active_profiler = (i < WARM_UP_FRAMES) ? warm_up_profiler : profiler;
+			for(auto& variant : variants)
+			{
+				{
+					auto phase = active_profiler.measure(variant->name);
+					variant->calibrator.correct(raw_frame, variant->view);
+					synchronize();
+				}
+				variant->generator.segment(variant->view, prediction, variant->foreground, variant->shadow);
+			}
+
+			if(i >= WARM_UP_FRAMES)
+			{
+				const auto& reference = *variants.front();
+				for(auto& variant : variants)
+				{
+					variant->view_error += cv::norm(variant->view, reference.view, cv::NORM_L1) 
+					                     / (reference.view.total() * reference.view.channels() * frames);
+					variant->foreground_disagreement += disagreement(variant->foreground, reference.foreground) / frames;
+					variant->shadow_disagreement += disagreement(variant->shadow, reference.shadow) / frames;
+				}
+			}
+		}
+
+		profiler.summarize(stream);
+
+		// The fixed-point map rounds each coordinate to 1/32nd pixel, so should 
+		// only move the view by a fraction of a level, and barely flip the masks.
+		for(const auto& variant : variants)
+		{
+			stream << cv::format(
+				"  %-28s view error %.3f, mask disagreement: foreground %.4f%%, shadow %.4f%%\n",
+				variant->name.c_str(), variant->view_error,
+				variant->foreground_disagreement * 100.0, variant->shadow_disagreement * 100.0
+			);
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void benchmark_colour_maps(const ViewCalibrator& calibrator, const int frames, std::ostream& stream)
+	{
+		CV_Assert(frames > 0);
+
+		// One colour map is used for the whole screen, which skips the blending between regions. 
+		// The regions are varied slightly, as the maps of a synthetic calibration are all the same.
+		const ColourGrid single_map(CMAP_REGIONS * CMAP_REGIONS, calibrator.colour_maps().front());
+		ColourGrid regional_maps = calibrator.colour_maps();
+		for(size_t region = 0; region < regional_maps.size(); region++)
+			for(auto& colour : regional_maps[region])
+				colour *= 1.0f + 0.01f * region;
+
+		Profiler profiler("Colour Maps"), warm_up_profiler("Warm Up");
+		double single_ms = 0.0, regional_ms = 0.0;
+
+		cv::RNG rng(0);
+		cv::Mat screen_sample, webcam_sample, prediction_buffer;
+		for(int i = 0; i < frames + WARM_UP_FRAMES; i++)
+		{
+			make_synthetic_frames(calibrator, rng, screen_sample, webcam_sample);
+
+			auto& active_profiler = (i < WARM_UP_FRAMES) ? warm_up_profiler : profiler;
+			const auto measure = [&](const std::string& name, const ColourGrid& colour_maps, double& total_ms) {
+				auto phase = active_profiler.measure(name);
+				const auto start = Profiler::Clock::now();
+				calibrator.predict(screen_sample, prediction_buffer, colour_maps);
+				if(i >= WARM_UP_FRAMES)
+					total_ms += std::chrono::duration<double, std::milli>(Profiler::Clock::now() - start).count();
+			};
+			measure("Predict, one colour map", single_map, single_ms);
+			measure("Predict, regional colour maps", regional_maps, regional_ms);
+		}
+
+		// NOTE: both runs blend the reflectance grid, which the kernel from before the
+		// regions did not, so this understates the cost against that kernel.
+		profiler.summarize(stream);
+		stream << cv::format(
+			"  Regional colour maps cost %.2fx one colour map, %s the %.1fx budget\n",
+			regional_ms / single_ms,
+			regional_ms <= COLOUR_MAP_BUDGET * single_ms ? "within" : "over",
+			COLOUR_MAP_BUDGET
+		);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void benchmark_prediction_latency(const ViewCalibrator& calibrator, const int frames, std::ostream& stream)
+	{
+		CV_Assert(frames > 0);
+
+		const auto synchronize = []() {
+			if constexpr (!cpu_native_pipeline) cv::ocl::finish();
+		};
+
+		enum class Mode { QUEUED, ON_DEMAND, ON_DEMAND_BAND };
+
+		Profiler profiler("Main Loop Latency"), warm_up_profiler("Warm Up");
+		for(const auto mode : {Mode::QUEUED, Mode::ON_DEMAND, Mode::ON_DEMAND_BAND})
+		{
+			for(const int screen_interval : PREDICTION_SCREEN_INTERVALS)
+			{
+				MaskGenerator mask_generator;
+				FingerTracker finger_tracker;
+				finger_tracker.tune(calibrator.settings());
+				mask_generator.configure(calibrator);
+
+				const char* mode_name = "Queued";
+				if(mode == Mode::ON_DEMAND) mode_name = "On demand";
+				if(mode == Mode::ON_DEMAND_BAND) mode_name = "On demand, band";
+				const std::string name = cv::format("%s, screen every %d", mode_name, screen_interval);
+
+				cv::RNG rng(0);
+				uint64_t screen_number = 0;
+				cv::Mat screen_sample, webcam_sample, prediction_buffer;
+				Frame raw_frame, screen_frame, prediction, foreground_mask, shadow_mask;
+				for(int i = 0; i < frames + WARM_UP_FRAMES; i++)
+				{
+					// The queued prediction is made on the predictor thread,
+					// so is outside of the main loop and isn't measured.
+					const bool new_screen = (i % screen_interval) == 0;
+					if(new_screen)
+					{
+						if(mode == Mode::ON_DEMAND_BAND && !screen_sample.empty())
+						{
+							// Only one row of blocks changes, as when a line of text is typed.
+							const int band_height = screen_sample.rows / 8;
+							const int band = rng.uniform(0, 8);
+							screen_sample.rowRange(band * band_height, (band + 1) * band_height).setTo(
+								cv::Scalar(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256))
+							);
+						}
+						else make_synthetic_frames(calibrator, rng, screen_sample, webcam_sample);
+
+						if(mode == Mode::QUEUED) calibrator.predict(screen_sample, prediction_buffer);
+						screen_number++;
+					}
+					webcam_sample.copyTo(raw_frame);
+					synchronize();
+
+					auto& active_profiler = (i < WARM_UP_FRAMES) ? warm_up_profiler : profiler;
+					auto phase = active_profiler.measure(name);
+
+					// The on demand prediction is read as the main loop reads it.
+					calibrator.correct(raw_frame, screen_frame);
+					if(mode == Mode::QUEUED)
+						prediction_buffer.copyTo(prediction);
+					else
+						mask_generator.predict_on_demand(calibrator, screen_sample, screen_number, prediction);
+					mask_generator.segment(screen_frame, prediction, foreground_mask, shadow_mask);
+					synchronize();
+
+					finger_tracker.detect(foreground_mask, shadow_mask);
+				}
+			}
+		}
+
+		profiler.summarize(stream);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	int run_benchmarks(const int argc, const char* argv[])
+	{
+		// Calibrate against a virtual rig, which can run headless.
+		if(argc >= 3 && std::string(argv[2]) == "calibration")
+		{
+			auto properties = RigProperties::Typical();
+			const int runs = (argc >= 4) ? atoi(argv[3]) : 1;
+			if(argc >= 5) properties.seed = std::strtoull(argv[4], nullptr, 10);
+			return benchmark_calibration(properties, runs, std::cout) ? 0 : -1;
+		}
+
+		const int frames = (argc >= 3) ? atoi(argv[2]) : 200;
+		const cv::Size output_resolution(CALIB_OUTPUT_WIDTH, CALIB_OUTPUT_HEIGHT);
+
+		auto calibrator = ViewCalibrator::TryLoad(CALIB_SAVE_PATH);
+		if(!calibrator.has_value())
+		{
+			std::cout << "No saved calibration found, using a synthetic calibration.\n";
+			calibrator.emplace(make_synthetic_calibration(cv::Size(WEBCAM_WIDTH, WEBCAM_HEIGHT), output_resolution));
+		}
+
+		// Benchmark with the tuned settings, if they fit the calibration.
+		const auto settings = PipelineSettings::TryLoad(SETTINGS_SAVE_PATH);
+		if(settings.has_value()
+		&& settings->output_resolution == calibrator->output_resolution()
+		&& settings->input_resolution == calibrator->input_resolution())
+		{
+			std::cout << "Using tuned settings: " << SETTINGS_SAVE_PATH << "\n";
+			settings->apply();
+			calibrator->tune(*settings);
+		}
+
+		std::cout << cv::format(
+			"Benchmarking %d frames (%dx%d -> %dx%d) with %d threads\n",
+			frames,
+			calibrator->input_resolution().width, calibrator->input_resolution().height,
+			calibrator->output_resolution().width, calibrator->output_resolution().height,
+			cv::getNumThreads()
+		);
+		benchmark_pipeline(*calibrator, frames, std::cout);
+		benchmark_segmentation(*calibrator, frames, std::cout);
+		benchmark_correction(*calibrator, frames, std::cout);
+		benchmark_colour_maps(*calibrator, frames, std::cout);
+		benchmark_prediction_latency(*calibrator, frames, std::cout);
+
+		// The T-API can also run without OpenCL, which separates the overhead
+		// of its dispatch from that of the device. Compare both against a
+		// build with the CPU native pipeline on the same machine.
+		if constexpr (!cpu_native_pipeline)
+		{
+			if(cv::ocl::useOpenCL())
+			{
+				cv::ocl::setUseOpenCL(false);
+				benchmark_pipeline(*calibrator, frames, std::cout);
+				cv::ocl::setUseOpenCL(true);
+			}
+		}
+
+		return 0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
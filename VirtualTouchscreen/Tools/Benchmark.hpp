@@ -0,0 +1,48 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <ostream>
+
+#include "Systems/ViewCalibrator.hpp"
+
+namespace vt
+{
+
+	// Creates an ideal calibration, so that the tools can be
+	// run on machines without a camera or projector attached.
+	ViewProperties make_synthetic_calibration(const cv::Size& input_resolution, const cv::Size& output_resolution);
+
+	// Renders a random screen frame along with its webcam
+	// capture, which has a hand reaching in from the bottom.
+	void make_synthetic_frames(
+		const ViewCalibrator& calibrator,
+		cv::RNG& rng,
+		cv::Mat& screen_frame,
+		cv::Mat& webcam_frame
+	);
+
+	// Times each stage of the pipeline over synthetic frames.
+	void benchmark_pipeline(const ViewCalibrator& calibrator, const int frames, std::ostream& stream);
+
+	// Times the eager segmentation against the G-API graph and the
+	// tile stream, and checks that they produce equivalent masks.
+	void benchmark_segmentation(const ViewCalibrator& calibrator, const int frames, std::ostream& stream);
+
+	// Times the correction with each interpolation and map format, and
+	// measures how far their views and masks are from the float bicubic one.
+	void benchmark_correction(const ViewCalibrator& calibrator, const int frames, std::ostream& stream);
+
+	// Times the prediction with one colour map against the blended colour
+	// maps of each region, and reports the cost of the regions as a multiple.
+	void benchmark_colour_maps(const ViewCalibrator& calibrator, const int frames, std::ostream& stream);
+
+	// Times the main loop with the prediction read from the queue, as when
+	// the predictor thread predicts every screen, against predicting it on
+	// demand on the main loop, for screens which change at different rates,
+	// either entirely or in a single band of rows.
+	void benchmark_prediction_latency(const ViewCalibrator& calibrator, const int frames, std::ostream& stream);
+
+	// Entry point for the command line benchmarks.
+	int run_benchmarks(const int argc, const char* argv[]);
+
+}
@@ -0,0 +1,85 @@
+#include "CalibrationBenchmark.hpp"
+
+#include <memory>
+
+#include "../Abstractions/Webcam.hpp"
+#include "../Systems/ViewCalibrator.hpp"
+#include "../Utility/Profiler.hpp"
+#include "../Configuration.hpp"
+
+namespace vt
+{
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool benchmark_calibration(const RigProperties& properties, const int runs, std::ostream& stream)
+	{
+		const cv::Size output_resolution(CALIB_OUTPUT_WIDTH, CALIB_OUTPUT_HEIGHT);
+		Profiler profiler("Virtual Calibration");
+
+		for(int run = 0; run < runs; run++)
+		{
+			// Each run sees different noise, but the same noise as the same run of any other benchmark.
+			RigProperties run_properties = properties;
+			run_properties.seed = properties.seed + run;
+
+			auto rig = std::make_shared<VirtualRig>(run_properties);
+			auto webcam = Webcam::TryCreate(rig);
+			CV_Assert(webcam.has_value());
+
+			// The rig settles as soon as its display latency has passed.
+			const int settle_time_ms = (properties.display_latency + 1) * webcam->latency_ms;
+
+			ViewCalibrator calibrator(output_resolution);
+			bool calibrated = false;
+			{
+				auto phase = profiler.measure("Calibrate");
+				calibrated = calibrator.calibrate(*webcam, CALIB_MIN_COVERAGE, settle_time_ms);
+			}
+
+			if(!calibrated)
+			{
+				stream << cv::format("Calibration %d failed to find the screen\n", run);
+				return false;
+			}
+
+			// Compare the correction against where the rig really shows each output pixel,
+			// as the output frame is stretched over the entire display.
+			std::vector<cv::Point2f> output_points, display_points;
+			const float sx = static_cast<float>(properties.display_resolution.width) / output_resolution.width;
+			const float sy = static_cast<float>(properties.display_resolution.height) / output_resolution.height;
+			for(int r = 8; r < output_resolution.height; r += 16)
+			{
+				for(int c = 8; c < output_resolution.width; c += 16)
+				{
+					output_points.emplace_back(c, r);
+					display_points.emplace_back((c + 0.5f) * sx - 0.5f, (r + 0.5f) * sy - 0.5f);
+				}
+			}
+			const auto camera_points = rig->project(display_points);
+
+			cv::Mat correction_map;
+			expand_correction_grid(calibrator.context().correction_grid, output_resolution, correction_map);
+			double total_error = 0.0, max_error = 0.0;
+			for(size_t i = 0; i < output_points.size(); i++)
+			{
+				const auto& corrected = correction_map.at<cv::Vec2f>(output_points[i]);
+				const double error = cv::norm(cv::Point2f(corrected[0], corrected[1]) - camera_points[i]);
+				total_error += error;
+				max_error = std::max(max_error, error);
+			}
+
+			stream << cv::format(
+				"Calibration %d: %d frames captured, %d images displayed, geometric error %.2fpx mean, %.2fpx max\n",
+				run, rig->frames_captured(), rig->images_displayed(),
+				total_error / output_points.size(), max_error
+			);
+		}
+
+		profiler.summarize(stream);
+		return true;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <ostream>
+
+#include "Abstractions/VirtualRig.hpp"
+
+namespace vt
+{
+
+	// Runs the full calibration against a virtual rig, timing it and measuring
+	// how far its correction is from the true geometry of the rig. Returns
+	// false if any of the calibrations fail.
+	// NOTE: this only depends on the calibration and the rig, not the
+	// segmentation, so it is kept apart from the other benchmarks.
+	bool benchmark_calibration(const RigProperties& properties, const int runs, std::ostream& stream);
+
+}
@@ -0,0 +1,26 @@
+// Entry point of the headless calibration benchmark, for machines without the Windows
+// dependencies of the touchscreen. It is excluded from the Visual Studio build, where
+// `--benchmark calibration [runs] [seed]` runs the same benchmark. From this directory:
+//
+//   g++ -std=c++20 -O2 -I. -o calibration_benchmark Tools/CalibrationBenchmarkMain.cpp
+//       Tools/CalibrationBenchmark.cpp Systems/ViewCalibrator.cpp Abstractions/VirtualRig.cpp
+//       Abstractions/Webcam.cpp Utility/Calibrator.cpp Utility/Common.cpp Utility/Profiler.cpp
+//       Utility/Settings.cpp $(pkg-config --cflags --libs opencv4)
+
+#include <cstdlib>
+#include <iostream>
+
+#include "CalibrationBenchmark.hpp"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	auto properties = vt::RigProperties::Typical();
+	const int runs = (argc >= 2) ? atoi(argv[1]) : 1;
+	if(argc >= 3) properties.seed = std::strtoull(argv[2], nullptr, 10);
+
+	return vt::benchmark_calibration(properties, runs, std::cout) ? 0 : -1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,253 @@
+#include "Reference.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include "../Utility/Common.hpp"
+
+namespace vt::reference
+{
+
+	// Settings of the kernels at the time they were frozen.
+	constexpr auto SHADOW_OFFSET = 50;
+	constexpr auto NOISE_OFFSET = 15;
+	constexpr auto ARC_TEST_LENGTH = 450;
+	constexpr auto NOISE_DEVIATIONS = 2.0;
+	constexpr auto MORPH_ITERATIONS = 2;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	PipelineSettings settings(const PipelineSettings& tuned)
+	{
+		PipelineSettings frozen = tuned;
+		frozen.correct_interpolation = cv::INTER_CUBIC;
+		frozen.correct_fixed_point = false;
+		frozen.noise_offset = NOISE_OFFSET;
+		frozen.erode_iterations = MORPH_ITERATIONS;
+		frozen.dilate_iterations = MORPH_ITERATIONS;
+		frozen.arc_test_length = ARC_TEST_LENGTH;
+		return frozen;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void predict(const ViewProperties& calibration, const cv::Mat& src, cv::Mat& dst)
+	{
+		CV_Assert(src.type() == CV_8UC3);
+		dst.create(src.size(), CV_32FC3);
+
+		// Location of a coordinate between the centres of the cells around it.
+		const auto blend_cells = [](const int coord, const int extent, const int cells) {
+			const float g = std::clamp((coord + 0.5f) * cells / extent - 0.5f, 0.0f, cells - 1.0f);
+			const int cell = std::min(static_cast<int>(g), cells - 2);
+			return std::make_pair(cell, g - cell);
+		};
+		const auto blend_regions = [&](const int coord, const int extent) {
+			return blend_cells(coord, extent, CMAP_REGIONS);
+		};
+
+		const auto& reflectance_grid = calibration.reflectance_map;
+		const auto reflectance_cell = [&](const int r, const int c) {
+			const auto* cell = reflectance_grid.ptr<cv::float16_t>(r) + 3 * c;
+			return cv::Vec3f(cell[0], cell[1], cell[2]);
+		};
+
+		// Calibrations with a single colour map are predicted from that map alone.
+		const bool regional = std::any_of(calibration.colour_maps.begin() + 1, calibration.colour_maps.end(), [&](const ColourMap& colour_map) {
+			return colour_map != calibration.colour_maps.front();
+		});
+
+		src.forEach<cv::Vec3b>([&](const cv::Vec3b& colour, const int coord[2]) {
+
+			// Normalize the colour. 
+			const auto norm_col = cv::Vec3f(colour) / 255.0f;
+
+			// Locate the sub-cube within the map. 
+			const int x = std::min(static_cast<int>(norm_col[0] / CMAP_STEP), CMAP_SIZE - 2);
+			const int y = std::min(static_cast<int>(norm_col[1] / CMAP_STEP), CMAP_SIZE - 2);
+			const int z = std::min(static_cast<int>(norm_col[2] / CMAP_STEP), CMAP_SIZE - 2);
+			const auto sub_coord = cv::Vec3f(x, y, z) * CMAP_STEP;
+
+			// Blend the map colours of the regions above and below, then perform
+			// trillinear interpolation in the regions to the left and right, 
+			// and blend those. 
+			const auto [row_region, row_weight] = blend_regions(coord[0], src.rows);
+			const auto [col_region, col_weight] = blend_regions(coord[1], src.cols);
+			const auto tlerp_factors = (norm_col - sub_coord) / CMAP_STEP;
+			const auto sample = [&](const int region_col, const int x, const int y, const int z) {
+				const auto& top = calibration.colour_maps[row_region * CMAP_REGIONS + region_col];
+				const auto& bottom = calibration.colour_maps[(row_region + 1) * CMAP_REGIONS + region_col];
+				const auto index = xyz_to_3d_index(x, y, z, CMAP_SIZE);
+				return regional ? lerp(top[index], bottom[index], row_weight) : calibration.colour_maps.front()[index];
+			};
+
+			std::array<cv::Vec3f, 2> column_predictions;
+			for(int i = 0; i < 2; i++)
+			{
+				column_predictions[i] = tlerp<cv::Vec3f>(
+					sample(col_region + i, x, y, z),
+					sample(col_region + i, x, y + 1, z),
+					sample(col_region + i, x + 1, y + 1, z),
+					sample(col_region + i, x + 1, y, z),
+					sample(col_region + i, x, y, z + 1),
+					sample(col_region + i, x, y + 1, z + 1),
+					sample(col_region + i, x + 1, y + 1, z + 1),
+					sample(col_region + i, x + 1, y, z + 1),
+					tlerp_factors[0], tlerp_factors[1], tlerp_factors[2]
+				);
+			}
+			const auto prediction = regional
+				? lerp(column_predictions[0], column_predictions[1], col_weight)
+				: column_predictions[0];
+
+			// Blend the reflectance of the cells above and below, then left and right.
+			const auto [cell_row, cell_row_weight] = blend_cells(coord[0], src.rows, reflectance_grid.rows);
+			const auto [cell_col, cell_col_weight] = blend_cells(coord[1], src.cols, reflectance_grid.cols);
+			const auto reflectance = lerp(
+				lerp(reflectance_cell(cell_row, cell_col), reflectance_cell(cell_row + 1, cell_col), cell_row_weight),
+				lerp(reflectance_cell(cell_row, cell_col + 1), reflectance_cell(cell_row + 1, cell_col + 1), cell_row_weight),
+				cell_col_weight
+			);
+			cv::Vec3f& final_colour = dst.at<cv::Vec3f>(coord[0], coord[1]);
+			final_colour[0] = prediction[0] * reflectance[0];
+			final_colour[1] = prediction[1] * reflectance[1];
+			final_colour[2] = prediction[2] * reflectance[2];
+		});
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void correct(const ViewProperties& calibration, const cv::Mat& src, cv::Mat& dst)
+	{
+		cv::Mat correction_map;
+		expand_correction_grid(calibration.correction_grid, calibration.output_resolution, correction_map);
+		cv::remap(src, dst, correction_map, cv::noArray(), cv::INTER_CUBIC);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	int arc_score(const std::vector<cv::Point>& contour, const size_t index, const cv::Rect& region, const float scale)
+	{
+		const auto edge_test = [&](const cv::Point& pt) {
+			return pt.x == region.x
+				|| pt.y == region.y
+				|| pt.x == region.br().x - 1
+				|| pt.y == region.br().y - 1;
+		};
+
+		const auto arc_char_max = [](int x) {
+			if(x < 40)
+				return -0.05f * (x * x) + 175;
+			else 
+				return -0.001f * (x * x) + 75.0f; 
+		};
+
+		const auto arc_char_min = [](int x) {
+			return std::max<float>(-0.1f * (x * x) + 50.0f, 10);
+		};
+
+		const auto& ref = contour[index];
+
+		// We cannot be an arc if we are on the edge. 
+		if(edge_test(ref))
+			return 0;
+
+		// NOTE: the walk wraps around the contour as often as needed. The original
+		// size_t arithmetic underflowed once a short contour was walked further
+		// than its start, which scored short contours against the wrong points. 
+		const auto size = static_cast<int>(contour.size());
+		int score = 0;
+		for (int i = 4; i < cvRound(ARC_TEST_LENGTH * scale) + 4; i++)
+		{
+			const auto& prev = contour[((static_cast<int>(index) - i) % size + size) % size];
+			const auto& next = contour[(static_cast<int>(index) + i) % size];
+
+			// Finish the test if we hit an edge. 
+			if (edge_test(prev) || edge_test(next))
+				break;
+
+			// Test that the angle is within angle bounds. 
+			const auto angle = fmod(360.0f + signed_angle_between(next - ref, prev - ref), 360.0f);
+			const int x = std::min(cvRound(i / scale), ARC_TEST_LENGTH + 3);
+			if(angle < arc_char_min(x) || angle > arc_char_max(x))
+				break;
+
+			score++;
+		}
+
+		return score;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	Segmenter::Segmenter(const cv::Size& resolution, const float ambient_intensity, const cv::Mat& noise_map)
+		: m_AmbientIntensity(ambient_intensity)
+	{
+		m_SharpeningKernel = cv::Mat({3,3}, {
+			0.00f, -0.25f,  0.00f,
+		   -0.25f,  2.00f, -0.25f,
+			0.00f, -0.25f,  0.00f
+		}).clone();
+
+		m_MorphKernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
+
+		m_BorderMask.create(resolution, CV_8UC1);
+		m_BorderMask.setTo(cv::Scalar::zeros());
+		const auto [w, h] = resolution - cv::Size(1, 1);
+		cv::line(m_BorderMask, {0,0}, {w,0}, cv::Scalar(255), 3);
+		cv::line(m_BorderMask, {w,0}, {w,h}, cv::Scalar(255), 3);
+		cv::line(m_BorderMask, {w,h}, {0,h}, cv::Scalar(255), 3);
+		cv::line(m_BorderMask, {0,h}, {0,0}, cv::Scalar(255), 3);
+
+		// Offset the threshold of each pixel by how much noisier it is than average.
+		if(!noise_map.empty())
+		{
+			const double gain = NOISE_DEVIATIONS * cv::norm(m_SharpeningKernel) * (0.75 + 0.75 + 1.00);
+			cv::resize(noise_map, m_NoiseThreshold, resolution, 0, 0, cv::INTER_LINEAR);
+			m_NoiseThreshold.convertTo(m_NoiseThreshold, CV_32FC1, gain, -gain * cv::mean(noise_map)[0]);
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void Segmenter::segment(const cv::Mat& view, const cv::Mat& prediction, cv::Mat& foreground_mask, cv::Mat& shadow_mask)
+	{
+		// Sharpen the input view.
+		cv::filter2D(view, m_View, CV_32FC3, m_SharpeningKernel);
+
+		// Perform dynamic background subtraction via the
+		// difference between the prediction and webcam view.
+		cv::absdiff(prediction, m_View, m_Difference);
+		cv::transform(m_Difference, m_Score, cv::Matx13f(0.75f, 0.75f, 1.00f));
+		if(!m_NoiseThreshold.empty())
+			cv::subtract(m_Score, m_NoiseThreshold, m_Score);
+
+		// Assume minimal differences belong to background and remove. 
+		const auto noise_floor = cv::mean(m_Score, m_BackgroundMask);
+		cv::threshold(m_Score, m_Score, noise_floor[0] + NOISE_OFFSET, 255, cv::THRESH_BINARY);
+		m_Score.convertTo(foreground_mask, CV_8UC1);
+
+		// Erode the mask to remove remove small noises and thin lines. 
+		cv::erode(foreground_mask, foreground_mask, m_MorphKernel, {-1,-1}, MORPH_ITERATIONS);
+
+		// Remove any noise that is not connected to the edge of the screen. 
+		cv::add(foreground_mask, m_BorderMask, m_NoiseMask);
+		cv::floodFill(m_NoiseMask, {0,0}, cv::Scalar(0));
+		cv::subtract(foreground_mask, m_NoiseMask, foreground_mask);
+		cv::subtract(foreground_mask, m_BorderMask, foreground_mask);
+
+		// Dilate the mask and smooth it to remove jagged edges. 
+		cv::dilate(foreground_mask, foreground_mask, m_MorphKernel, {-1,-1}, MORPH_ITERATIONS);
+		cv::boxFilter(foreground_mask, foreground_mask, -1, cv::Size(5, 5));
+		cv::threshold(foreground_mask, foreground_mask, 192, 255, cv::THRESH_BINARY);
+
+		// Find the shadow mask
+		cv::bitwise_not(foreground_mask, m_BackgroundMask);
+		cv::cvtColor(view, m_ForegroundView, cv::COLOR_BGR2GRAY);
+		m_ForegroundView.setTo(cv::Scalar::all(255), m_BackgroundMask);
+		cv::threshold(m_ForegroundView, shadow_mask, m_AmbientIntensity + SHADOW_OFFSET, 255, cv::THRESH_BINARY_INV);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "Systems/ViewCalibrator.hpp"
+
+// Frozen copies of the pipeline kernels, kept as the golden outputs which
+// the optimised kernels are verified against. They are deliberately 
+// simple and single threaded, and must never be optimised. They only
+// change when the intended output of the pipeline changes. 
+namespace vt::reference
+{
+
+	// The settings under which the pipeline computes the same as the reference kernels,
+	// which keeps those of the tuned settings that only affect how the pipeline runs.
+	PipelineSettings settings(const PipelineSettings& tuned);
+
+	// ViewCalibrator::predict
+	void predict(const ViewProperties& calibration, const cv::Mat& src, cv::Mat& dst);
+
+	// ViewCalibrator::correct
+	void correct(const ViewProperties& calibration, const cv::Mat& src, cv::Mat& dst);
+
+	// FingerTracker::arc_score, where the scale is the screen width over SPATIAL_REFERENCE_WIDTH.
+	int arc_score(const std::vector<cv::Point>& contour, const size_t index, const cv::Rect& region, const float scale);
+
+	// MaskGenerator::segment
+	class Segmenter
+	{
+	public:
+
+		Segmenter(const cv::Size& resolution, const float ambient_intensity, const cv::Mat& noise_map = cv::Mat());
+
+		void segment(const cv::Mat& view, const cv::Mat& prediction, cv::Mat& foreground_mask, cv::Mat& shadow_mask);
+
+	private:
+		const float m_AmbientIntensity;
+
+		cv::Mat m_View, m_Difference, m_Score;
+		cv::Mat m_ForegroundView, m_BackgroundMask, m_NoiseMask, m_BorderMask, m_NoiseThreshold;
+		cv::Mat m_SharpeningKernel, m_MorphKernel;
+	};
+
+}
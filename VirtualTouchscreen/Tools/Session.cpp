@@ -0,0 +1,142 @@
+#include "Session.hpp"
+
+#include <iostream>
+
+namespace vt
+{
+
+	// Frames are stored losslessly, so that replays are exact.
+	static std::filesystem::path webcam_path(const std::filesystem::path& directory, const size_t frame)
+	{
+		return directory / cv::format("%05d_webcam.png", static_cast<int>(frame));
+	}
+
+	static std::filesystem::path screen_path(const std::filesystem::path& directory, const size_t frame)
+	{
+		return directory / cv::format("%05d_screen.png", static_cast<int>(frame));
+	}
+
+	static std::filesystem::path calibration_path(const std::filesystem::path& directory)
+	{
+		return directory / "calibration.yml";
+	}
+
+	static std::filesystem::path settings_path(const std::filesystem::path& directory)
+	{
+		return directory / "settings.yml";
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	std::optional<SessionRecorder> SessionRecorder::TryCreate(const std::string& directory, const ViewCalibrator& calibration)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		if(error || !std::filesystem::is_empty(directory))
+		{
+			std::cerr << "Session directory must be new or empty: " << directory << std::endl;
+			return std::nullopt;
+		}
+
+		calibration.save(calibration_path(directory).string());
+		calibration.settings().save(settings_path(directory).string());
+		return SessionRecorder(directory);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	SessionRecorder::SessionRecorder(const std::filesystem::path& directory)
+		: m_Directory(directory)
+	{}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void SessionRecorder::record(cv::InputArray webcam_frame, cv::InputArray screen_frame)
+	{
+		CV_Assert(webcam_frame.type() == CV_8UC3 && screen_frame.type() == CV_8UC3);
+
+		cv::imwrite(webcam_path(m_Directory, m_Frames).string(), webcam_frame);
+		cv::imwrite(screen_path(m_Directory, m_Frames).string(), screen_frame);
+		m_Frames++;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	size_t SessionRecorder::size() const
+	{
+		return m_Frames;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	std::optional<SessionReader> SessionReader::TryOpen(const std::string& directory)
+	{
+		auto calibration = ViewCalibrator::TryLoad(calibration_path(directory).string());
+		if(!calibration.has_value())
+		{
+			std::cerr << "Failed to load session calibration: " << directory << std::endl;
+			return std::nullopt;
+		}
+
+		const auto settings = PipelineSettings::TryLoad(settings_path(directory).string());
+		if(!settings.has_value())
+		{
+			std::cerr << "Failed to load session settings: " << directory << std::endl;
+			return std::nullopt;
+		}
+		calibration->tune(*settings);
+
+		// The session ends at the first missing frame.
+		size_t frames = 0;
+		while(std::filesystem::exists(webcam_path(directory, frames)) && std::filesystem::exists(screen_path(directory, frames)))
+			frames++;
+
+		return SessionReader(directory, std::move(*calibration), frames);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	SessionReader::SessionReader(const std::filesystem::path& directory, ViewCalibrator&& calibration, const size_t frames)
+		: m_Directory(directory),
+		  m_Calibration(std::move(calibration)),
+		  m_Frames(frames)
+	{}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const ViewCalibrator& SessionReader::calibration() const
+	{
+		return m_Calibration;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool SessionReader::next(cv::Mat& webcam_frame, cv::Mat& screen_frame)
+	{
+		if(m_Position >= m_Frames)
+			return false;
+
+		webcam_frame = cv::imread(webcam_path(m_Directory, m_Position).string(), cv::IMREAD_COLOR);
+		screen_frame = cv::imread(screen_path(m_Directory, m_Position).string(), cv::IMREAD_COLOR);
+		m_Position++;
+
+		return !webcam_frame.empty() && !screen_frame.empty();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void SessionReader::rewind()
+	{
+		m_Position = 0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	size_t SessionReader::size() const
+	{
+		return m_Frames;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+#include "Systems/ViewCalibrator.hpp"
+
+namespace vt
+{
+
+	// Records the raw webcam frames along with the screen frames their
+	// predictions were made from, and the calibration and settings they 
+	// were captured with, so that a session can be replayed offline.
+	class SessionRecorder
+	{
+	public:
+
+		static std::optional<SessionRecorder> TryCreate(const std::string& directory, const ViewCalibrator& calibration);
+
+		void record(cv::InputArray webcam_frame, cv::InputArray screen_frame);
+
+		size_t size() const;
+
+	private:
+
+		SessionRecorder(const std::filesystem::path& directory);
+
+	private:
+		std::filesystem::path m_Directory;
+		size_t m_Frames = 0;
+	};
+
+
+	class SessionReader
+	{
+	public:
+
+		static std::optional<SessionReader> TryOpen(const std::string& directory);
+
+		const ViewCalibrator& calibration() const;
+
+		bool next(cv::Mat& webcam_frame, cv::Mat& screen_frame);
+
+		void rewind();
+
+		size_t size() const;
+
+	private:
+
+		SessionReader(const std::filesystem::path& directory, ViewCalibrator&& calibration, const size_t frames);
+
+	private:
+		std::filesystem::path m_Directory;
+		ViewCalibrator m_Calibration;
+		size_t m_Frames = 0, m_Position = 0;
+	};
+
+}
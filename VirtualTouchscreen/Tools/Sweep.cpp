@@ -0,0 +1,464 @@
+#include "Sweep.hpp"
+
+#include <opencv2/core/ocl.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "Reference.hpp"
+#include "../Systems/MaskGenerator.hpp"
+#include "../Systems/FingerTracker.hpp"
+#include "../Utility/PerfCounters.hpp"
+#include "../Utility/Common.hpp"
+#include "../Configuration.hpp"
+
+namespace vt
+{
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// The parameter grid, where the morphology iterations are shared
+	// by the erosion and dilation so that the mask keeps its size.
+	constexpr int SWEEP_NOISE_OFFSETS[] = {10, 15, 20, 25};
+	constexpr int SWEEP_MORPH_ITERATIONS[] = {1, 2, 3};
+	constexpr float SWEEP_RESOLUTION_SCALES[] = {0.5f, 0.75f, 1.0f};
+	constexpr int SWEEP_ARC_TEST_LENGTHS[] = {150, 300, 450};
+	constexpr int SWEEP_INTERPOLATIONS[] = {cv::INTER_LINEAR, cv::INTER_CUBIC};
+	constexpr int SWEEP_PREDICTION_DELAYS[] = {1, 2, 3, 4};
+
+	// Fingertips further apart than this are different fingertips,
+	// in pixels at the spatial reference width.
+	constexpr auto MATCH_DISTANCE = 10.0f;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	double SweepResult::f1_score() const
+	{
+		return (precision + recall > 0.0) ? 2.0 * precision * recall / (precision + recall) : 0.0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Rescales the calibration so that it processes at another resolution.
+	static ViewProperties rescale_calibration(const ViewProperties& calibration, const cv::Size& resolution)
+	{
+		ViewProperties rescaled = calibration;
+		rescaled.output_resolution = resolution;
+		rescaled.settings.output_resolution = resolution;
+
+		const double sx = static_cast<double>(resolution.width) / calibration.output_resolution.width;
+		const double sy = static_cast<double>(resolution.height) / calibration.output_resolution.height;
+
+		cv::Mat homography;
+		calibration.view_homography.convertTo(homography, CV_64FC1);
+		rescaled.view_homography = cv::Mat(cv::Matx33d(sx, 0, 0, 0, sy, 0, 0, 0, 1)) * homography;
+
+		// The grids of the correction map and reflectance are blended over the extent
+		// of the view, so they are the same at any resolution and only need a copy.
+		// NOTE: the maps are always copied, so that each worker has its own.
+		rescaled.correction_grid = calibration.correction_grid.clone();
+		rescaled.reflectance_map = calibration.reflectance_map.clone();
+
+		return rescaled;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	struct Replay
+	{
+		// Fingertips of each frame, at the reference resolution.
+		std::vector<std::vector<cv::Point2f>> fingertips;
+		double frame_ms = 0.0;
+
+		// How often the segmentation fell back to following the last masks.
+		std::string modes;
+	};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Replays the frames through the pipeline under the settings of the calibration. A
+	// different prediction delay is emulated by shifting the recorded screen frames.
+	// NOTE: the counters must have been opened on the thread running the replay.
+	static Replay replay(
+		const ViewProperties& calibration,
+		const std::vector<cv::Mat>& webcam_frames,
+		const std::vector<cv::Mat>& screen_frames,
+		const cv::Size& reference_resolution,
+		const int recorded_delay,
+		PerfCounters& perf_counters
+	)
+	{
+		const ViewCalibrator calibrator(calibration);
+		const auto& resolution = calibrator.output_resolution();
+		const float sx = static_cast<float>(reference_resolution.width) / resolution.width;
+		const float sy = static_cast<float>(reference_resolution.height) / resolution.height;
+
+		MaskGenerator mask_generator(false);
+		mask_generator.configure(calibrator);
+
+		FingerTracker finger_tracker;
+		finger_tracker.tune(calibration.settings);
+
+		const int frames = static_cast<int>(webcam_frames.size());
+		const int shift = calibration.settings.prediction_delay - recorded_delay;
+
+		Replay replay;
+		Frame raw_frame, screen_frame, prediction, foreground_mask, shadow_mask;
+		cv::Mat screen_sample, prediction_buffer, display_state;
+		for(int i = 0; i < frames; i++)
+		{
+			// The prediction is made on its own thread, so it is not timed.
+			cv::resize(screen_frames[std::clamp(i - shift, 0, frames - 1)], screen_sample, resolution, 0, 0, cv::INTER_AREA);
+			calibrator.predict(screen_sample, prediction_buffer);
+			if constexpr (use_temporal_fallback)
+			{
+				mask_generator.track_changes(screen_sample);
+			}
+			if constexpr (use_display_transitions)
+			{
+				calibrator.transition(prediction_buffer, display_state);
+				display_state.copyTo(prediction);
+			}
+			else prediction_buffer.copyTo(prediction);
+
+			// The edges are of the state that is segmented against.
+			if constexpr (use_edge_thresholds)
+			{
+				mask_generator.threshold_edges(use_display_transitions ? display_state : prediction_buffer);
+			}
+			webcam_frames[i].copyTo(raw_frame);
+
+			const auto start = std::chrono::high_resolution_clock::now();
+			if constexpr (use_tile_streaming)
+			{
+				auto counter = perf_counters.measure("Correct + Segment");
+				mask_generator.correct_and_segment(calibrator, raw_frame, prediction, screen_frame, foreground_mask, shadow_mask);
+			}
+			else
+			{
+				{
+					auto counter = perf_counters.measure("Correct");
+					calibrator.correct(raw_frame, screen_frame);
+				}
+				auto counter = perf_counters.measure("Segment");
+				mask_generator.segment(screen_frame, prediction, foreground_mask, shadow_mask);
+			}
+			if constexpr (use_temporal_fallback)
+			{
+				auto counter = perf_counters.measure("Temporal fallback");
+				mask_generator.apply_temporal_fallback(screen_frame, foreground_mask, shadow_mask);
+			}
+			std::vector<FingerTracker::Fingertip> fingertips;
+			{
+				auto counter = perf_counters.measure("Detect");
+				fingertips = finger_tracker.detect(foreground_mask, shadow_mask);
+			}
+			const auto end = std::chrono::high_resolution_clock::now();
+
+			replay.frame_ms += std::chrono::duration<double, std::milli>(end - start).count();
+
+			auto& points = replay.fingertips.emplace_back();
+			for(const auto& fingertip : fingertips)
+				points.emplace_back(fingertip.point.x * sx, fingertip.point.y * sy);
+		}
+		replay.frame_ms /= std::max(frames, 1);
+
+		if constexpr (use_temporal_fallback)
+		{
+			std::ostringstream modes;
+			mask_generator.report_modes(modes);
+			replay.modes = modes.str();
+		}
+
+		return replay;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Replays the frames through the reference kernels at the recorded resolution, which
+	// finds the fingertips that every configuration is scored against. It shares no
+	// parameter with the grid except for the prediction delay, which is left at the
+	// recorded delay as the session holds no other measure of the display latency.
+	static Replay reference_replay(
+		const ViewProperties& calibration,
+		const std::vector<cv::Mat>& webcam_frames,
+		const std::vector<cv::Mat>& screen_frames
+	)
+	{
+		const ViewCalibrator calibrator(calibration);
+		const auto& resolution = calibrator.output_resolution();
+
+		reference::Segmenter segmenter(resolution, calibrator.ambient_intensity(), calibrator.noise_map());
+		FingerTracker finger_tracker;
+		finger_tracker.tune(reference::settings(calibration.settings));
+
+		Replay replay;
+		cv::Mat screen_sample, prediction, view, foreground_mask, shadow_mask;
+		Frame foreground_frame, shadow_frame;
+		for(size_t i = 0; i < webcam_frames.size(); i++)
+		{
+			cv::resize(screen_frames[i], screen_sample, resolution, 0, 0, cv::INTER_AREA);
+			reference::predict(calibration, screen_sample, prediction);
+			reference::correct(calibration, webcam_frames[i], view);
+			segmenter.segment(view, prediction, foreground_mask, shadow_mask);
+
+			foreground_mask.copyTo(foreground_frame);
+			shadow_mask.copyTo(shadow_frame);
+
+			auto& points = replay.fingertips.emplace_back();
+			for(const auto& fingertip : finger_tracker.detect(foreground_frame, shadow_frame))
+				points.push_back(fingertip.point);
+		}
+
+		return replay;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Scores the fingertips of the replay against those of the baseline.
+	static void score_replay(const Replay& replay, const Replay& baseline, const float match_distance, SweepResult& result)
+	{
+		size_t expected = 0, detected = 0, matched = 0;
+		double displacement = 0.0;
+		for(size_t f = 0; f < baseline.fingertips.size(); f++)
+		{
+			auto candidates = replay.fingertips[f];
+			expected += baseline.fingertips[f].size();
+			detected += candidates.size();
+
+			// Greedily match each fingertip with its closest candidate.
+			for(const auto& fingertip : baseline.fingertips[f])
+			{
+				auto closest = candidates.end();
+				double closest_distance = match_distance;
+				for(auto it = candidates.begin(); it != candidates.end(); ++it)
+				{
+					const double distance = cv::norm(*it - fingertip);
+					if(distance <= closest_distance)
+					{
+						closest_distance = distance;
+						closest = it;
+					}
+				}
+
+				if(closest != candidates.end())
+				{
+					displacement += closest_distance;
+					candidates.erase(closest);
+					matched++;
+				}
+			}
+		}
+
+		// With no fingertips to find, finding none is a perfect score.
+		result.frame_ms = replay.frame_ms;
+		result.precision = (detected > 0) ? static_cast<double>(matched) / detected : (expected == 0 ? 1.0 : 0.0);
+		result.recall = (expected > 0) ? static_cast<double>(matched) / expected : (detected == 0 ? 1.0 : 0.0);
+		result.displacement = (matched > 0) ? displacement / matched : 0.0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	std::vector<SweepResult> sweep_parameters(SessionReader& session, const int frames, std::ostream& stream)
+	{
+		CV_Assert(frames > 0);
+
+		// Decode the session up front, so that the workers can share it.
+		std::vector<cv::Mat> webcam_frames, screen_frames;
+		cv::Mat webcam_frame, screen_frame;
+		session.rewind();
+		while(static_cast<int>(webcam_frames.size()) < frames && session.next(webcam_frame, screen_frame))
+		{
+			webcam_frames.push_back(webcam_frame);
+			screen_frames.push_back(screen_frame);
+		}
+		CV_Assert(!webcam_frames.empty());
+
+		const ViewProperties calibration = session.calibration().context();
+		const cv::Size& reference_resolution = calibration.output_resolution;
+		const int recorded_delay = calibration.settings.prediction_delay;
+		const float match_distance = MATCH_DISTANCE * reference_resolution.width / SPATIAL_REFERENCE_WIDTH;
+
+		// Every point of the grid is a variation of the recorded settings.
+		std::vector<SweepResult> results;
+		for(const float scale : SWEEP_RESOLUTION_SCALES)
+			for(const int interpolation : SWEEP_INTERPOLATIONS)
+				for(const int noise_offset : SWEEP_NOISE_OFFSETS)
+					for(const int iterations : SWEEP_MORPH_ITERATIONS)
+						for(const int arc_test_length : SWEEP_ARC_TEST_LENGTHS)
+							for(const int delay : SWEEP_PREDICTION_DELAYS)
+							{
+								SweepResult& result = results.emplace_back();
+								result.settings = calibration.settings;
+								result.settings.output_resolution = cv::Size(
+									cvRound(reference_resolution.width * scale),
+									cvRound(reference_resolution.height * scale)
+								);
+								result.settings.correct_interpolation = interpolation;
+								result.settings.noise_offset = noise_offset;
+								result.settings.erode_iterations = iterations;
+								result.settings.dilate_iterations = iterations;
+								result.settings.arc_test_length = arc_test_length;
+								result.settings.prediction_delay = delay;
+							}
+
+		stream << cv::format(
+			"Sweeping %d configurations over %d frames (%dx%d)\n",
+			static_cast<int>(results.size()), static_cast<int>(webcam_frames.size()),
+			reference_resolution.width, reference_resolution.height
+		);
+
+		// Each worker replays whole configurations, so OpenCV runs single
+		// threaded within them, and on the CPU as they can't share a device.
+		// NOTE: the workers compete for memory bandwidth, so the times are
+		// best compared with each other rather than with the live pipeline.
+		const int previous_threads = cv::getNumThreads();
+		cv::setNumThreads(1);
+
+		const auto run_on_cpu = [](auto&& task) {
+			std::thread([&]() {
+				cv::ocl::setUseOpenCL(false);
+				task();
+			}).join();
+		};
+
+		// The recorded settings are scored like the grid, so that they can be compared with the
+		// frontier, but only they are counted, on the thread which replays them.
+		Replay baseline;
+		SweepResult recorded;
+		std::string recorded_modes;
+		std::ostringstream counter_report;
+		run_on_cpu([&]() {
+			baseline = reference_replay(calibration, webcam_frames, screen_frames);
+
+			PerfCounters perf_counters("Recorded Settings", show_perf_counters);
+			const auto run = replay(calibration, webcam_frames, screen_frames, reference_resolution, recorded_delay, perf_counters);
+			score_replay(run, baseline, match_distance, recorded);
+			recorded_modes = run.modes;
+			perf_counters.report(counter_report);
+		});
+
+		std::mutex progress_mutex;
+		std::atomic<size_t> next_result = 0, completed = 0;
+		std::vector<std::thread> workers;
+		const int worker_count = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+		for(int w = 0; w < worker_count; w++)
+		{
+			workers.emplace_back([&]() {
+				cv::ocl::setUseOpenCL(false);
+				PerfCounters perf_counters("Sweep", false);
+				for(size_t r = next_result++; r < results.size(); r = next_result++)
+				{
+					auto& result = results[r];
+					auto configuration = rescale_calibration(calibration, result.settings.output_resolution);
+					configuration.settings = result.settings;
+
+					const auto run = replay(configuration, webcam_frames, screen_frames, reference_resolution, recorded_delay, perf_counters);
+					score_replay(run, baseline, match_distance, result);
+
+					std::scoped_lock lock(progress_mutex);
+					stream << cv::format("\rSwept %d/%d configurations", static_cast<int>(++completed), static_cast<int>(results.size())) << std::flush;
+				}
+			});
+		}
+		for(auto& worker : workers)
+			worker.join();
+		stream << "\n";
+
+		cv::setNumThreads(previous_threads);
+
+		// Sorted by time, a configuration is on the frontier
+		// if it is more accurate than every faster one.
+		std::sort(results.begin(), results.end(), [](const SweepResult& a, const SweepResult& b) {
+			return a.frame_ms < b.frame_ms;
+		});
+
+		double best_score = -1.0;
+		for(auto& result : results)
+		{
+			if(result.f1_score() > best_score)
+			{
+				result.pareto_optimal = true;
+				best_score = result.f1_score();
+			}
+		}
+
+		stream << cv::format(
+			"Recorded settings: %.2fms per frame  F1 %.3f (%.1fpx)\n",
+			recorded.frame_ms, recorded.f1_score(), recorded.displacement
+		);
+		stream << recorded_modes;
+		stream << counter_report.str();
+		stream << "Pareto frontier:\n";
+		for(const auto& result : results)
+		{
+			if(!result.pareto_optimal)
+				continue;
+
+			const auto& settings = result.settings;
+			stream << cv::format(
+				"\t%7.2fms  F1 %.3f (%.1fpx)  %4dx%-4d  noise %2d  morph %d  arc %3d  %s  delay %d\n",
+				result.frame_ms, result.f1_score(), result.displacement,
+				settings.output_resolution.width, settings.output_resolution.height,
+				settings.noise_offset, settings.erode_iterations, settings.arc_test_length,
+				settings.correct_interpolation == cv::INTER_LINEAR ? "bilinear" : "bicubic ",
+				settings.prediction_delay
+			);
+		}
+
+		return results;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	int run_sweep(const int argc, const char* argv[])
+	{
+		if(argc < 3)
+		{
+			std::cerr << "Usage: --sweep <session> [frames]" << std::endl;
+			return -1;
+		}
+
+		auto session = SessionReader::TryOpen(argv[2]);
+		if(!session.has_value())
+			return -1;
+
+		const int frames = (argc >= 4) ? atoi(argv[3]) : std::numeric_limits<int>::max();
+		const auto results = sweep_parameters(*session, frames, std::cout);
+
+		// Keep every configuration, so the frontier can be picked from for each site.
+		std::ofstream file(SWEEP_SAVE_PATH);
+		if(!file.is_open())
+		{
+			std::cerr << "Failed to save sweep results: " << SWEEP_SAVE_PATH << std::endl;
+			return -1;
+		}
+
+		file << "frame_ms,precision,recall,f1,displacement,width,height,noise_offset,"
+		        "erode_iterations,dilate_iterations,arc_test_length,correct_interpolation,prediction_delay,pareto\n";
+		for(const auto& result : results)
+		{
+			const auto& settings = result.settings;
+			file << cv::format(
+				"%.4f,%.4f,%.4f,%.4f,%.3f,%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
+				result.frame_ms, result.precision, result.recall, result.f1_score(), result.displacement,
+				settings.output_resolution.width, settings.output_resolution.height,
+				settings.noise_offset, settings.erode_iterations, settings.dilate_iterations,
+				settings.arc_test_length, settings.correct_interpolation, settings.prediction_delay,
+				result.pareto_optimal ? 1 : 0
+			);
+		}
+
+		std::cout << "Saved sweep results: " << SWEEP_SAVE_PATH << std::endl;
+		return 0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
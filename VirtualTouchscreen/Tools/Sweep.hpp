@@ -0,0 +1,40 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <ostream>
+#include <vector>
+
+#include "Tools/Session.hpp"
+#include "Utility/Settings.hpp"
+
+namespace vt
+{
+
+	// The measurements of one configuration of the parameter sweep.
+	struct SweepResult
+	{
+		PipelineSettings settings;
+
+		// Mean processing time of the main thread, per frame.
+		double frame_ms = 0.0;
+
+		// Agreement of the fingertips with those of the reference kernels,
+		// where the displacement is in pixels at the recorded resolution.
+		double precision = 0.0;
+		double recall = 0.0;
+		double displacement = 0.0;
+
+		bool pareto_optimal = false;
+
+		double f1_score() const;
+	};
+
+	// Replays the session under every configuration of the parameter grid, in
+	// parallel across the cores, and marks the configurations which no other
+	// configuration beats on both processing time and fingertip accuracy.
+	std::vector<SweepResult> sweep_parameters(SessionReader& session, const int frames, std::ostream& stream);
+
+	// Entry point for the command line parameter sweep.
+	int run_sweep(const int argc, const char* argv[]);
+
+}
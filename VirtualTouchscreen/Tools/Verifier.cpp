@@ -0,0 +1,384 @@
+#include "Verifier.hpp"
+
+#include <deque>
+#include <limits>
+#include <iostream>
+
+#include "Benchmark.hpp"
+#include "Reference.hpp"
+#include "../Systems/MaskGenerator.hpp"
+#include "../Systems/FingerTracker.hpp"
+#include "../Utility/Common.hpp"
+#include "../Configuration.hpp"
+
+namespace vt
+{
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// The correction remaps with the same map and interpolation as the reference,
+	// but the OpenCL kernel of cv::remap rounds its bicubic weights differently.
+	constexpr auto VERIFY_CORRECT_MAX_ERROR = 1.0;
+
+	// The segmentation variants sum the score in a different order, so may flip
+	// pixels right at the threshold, as a fraction of the pixels of the frame.
+	constexpr auto VERIFY_MASK_MEAN_DISAGREEMENT = 0.001;
+	constexpr auto VERIFY_MASK_MAX_DISAGREEMENT = 0.01;
+
+	// Flipped pixels along a contour can move a fingertip by a pixel or so, in pixels
+	// at the spatial reference width, or rarely split or merge a fingertip.
+	constexpr auto VERIFY_FINGERTIP_MAX_DISPLACEMENT = 2.0;
+	constexpr auto VERIFY_FINGERTIP_MAX_UNMATCHED = 0.01;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	static const char* verdict(const bool exact, const bool passed)
+	{
+		return exact ? "exact  " : (passed ? "bounded" : "FAILED ");
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Per element error of an output against its reference.
+	struct ErrorStats
+	{
+		double max_error = 0.0, squared_error = 0.0;
+		size_t elements = 0;
+
+		void add(cv::InputArray reference, cv::InputArray actual)
+		{
+			CV_Assert(reference.size() == actual.size() && reference.type() == actual.type());
+
+			max_error = std::max(max_error, cv::norm(reference, actual, cv::NORM_INF));
+			squared_error += cv::norm(reference, actual, cv::NORM_L2SQR);
+			elements += reference.total() * reference.channels();
+		}
+
+		bool exact() const
+		{
+			return max_error == 0.0;
+		}
+
+		bool within(const double max_tolerance) const
+		{
+			return max_error <= max_tolerance;
+		}
+
+		void report(const std::string& name, const bool passed, std::ostream& stream) const
+		{
+			stream << cv::format(
+				"  %-32s %s  (RMSE %.6f, max %.6f)\n",
+				name.c_str(),
+				verdict(exact(), passed),
+				std::sqrt(squared_error / std::max<size_t>(elements, 1)),
+				max_error
+			);
+		}
+	};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Fraction of pixels on which a mask disagrees with its reference.
+	struct MaskStats
+	{
+		double total = 0.0, max = 0.0;
+		size_t frames = 0;
+
+		void add(cv::InputArray reference, cv::InputArray actual)
+		{
+			const double disagreement = cv::norm(reference, actual, cv::NORM_HAMMING) / (reference.total() * 8.0);
+			total += disagreement;
+			max = std::max(max, disagreement);
+			frames++;
+		}
+
+		bool exact() const
+		{
+			return max == 0.0;
+		}
+
+		bool within(const double mean_tolerance, const double max_tolerance) const
+		{
+			return total / std::max<size_t>(frames, 1) <= mean_tolerance && max <= max_tolerance;
+		}
+
+		void report(const std::string& name, const bool passed, std::ostream& stream) const
+		{
+			stream << cv::format(
+				"  %-32s %s  (disagreement %.4f%%, max %.4f%%)\n",
+				name.c_str(),
+				verdict(exact(), passed),
+				100.0 * total / std::max<size_t>(frames, 1),
+				100.0 * max
+			);
+		}
+	};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// Displacement of the detected fingertips from the reference fingertips.
+	struct FingertipStats
+	{
+		double total_displacement = 0.0, max_displacement = 0.0;
+		size_t matched = 0, unmatched = 0;
+
+		void add(const std::vector<FingerTracker::Fingertip>& reference, const std::vector<FingerTracker::Fingertip>& actual)
+		{
+			// Match each reference fingertip with its closest detected fingertip.
+			for(const auto& expected : reference)
+			{
+				double closest = std::numeric_limits<double>::max();
+				for(const auto& fingertip : actual)
+					closest = std::min(closest, cv::norm(expected.point - fingertip.point));
+
+				if(actual.empty())
+				{
+					unmatched++;
+					continue;
+				}
+
+				total_displacement += closest;
+				max_displacement = std::max(max_displacement, closest);
+				matched++;
+			}
+
+			if(actual.size() > reference.size())
+				unmatched += actual.size() - reference.size();
+		}
+
+		bool exact() const
+		{
+			return unmatched == 0 && max_displacement == 0.0;
+		}
+
+		// The unmatched tolerance is a fraction of all the fingertips.
+		bool within(const double displacement_tolerance, const double unmatched_tolerance) const
+		{
+			return max_displacement <= displacement_tolerance
+			    && unmatched <= unmatched_tolerance * static_cast<double>(matched + unmatched);
+		}
+
+		void report(const std::string& name, const bool passed, std::ostream& stream) const
+		{
+			stream << cv::format(
+				"  %-32s %s  (displacement %.3fpx, max %.3fpx, %d unmatched)\n",
+				name.c_str(),
+				verdict(exact(), passed),
+				total_displacement / std::max<size_t>(matched, 1),
+				max_displacement,
+				static_cast<int>(unmatched)
+			);
+		}
+	};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	// An optimised segmentation path along with its own state.
+	struct SegmentationVariant
+	{
+		const std::string name;
+		const bool streamed;
+		
+		MaskGenerator generator;
+		FingerTracker tracker;
+		Frame view, foreground_mask, shadow_mask;
+
+		MaskStats foreground_stats, shadow_stats;
+		FingertipStats fingertip_stats;
+
+		SegmentationVariant(const std::string& name, const bool use_graph, const bool streamed)
+			: name(name),
+			  streamed(streamed),
+			  generator(use_graph)
+		{}
+	};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool verify_pipeline(
+		const ViewCalibrator& calibrator,
+		const int random_frames,
+		SessionReader* session,
+		std::ostream& stream
+	)
+	{
+		const auto context = calibrator.context();
+		const auto& output_size = calibrator.output_resolution();
+		const float scale = output_size.width / SPATIAL_REFERENCE_WIDTH;
+
+		reference::Segmenter reference_segmenter(output_size, calibrator.ambient_intensity(), calibrator.noise_map());
+		FingerTracker reference_tracker;
+
+		std::deque<SegmentationVariant> variants;
+		variants.emplace_back("Segment (eager)", false, false);
+		variants.emplace_back("Segment (G-API graph)", true, false);
+		variants.emplace_back("Segment (tile stream)", false, true);
+		for(auto& variant : variants)
+			variant.generator.configure(calibrator);
+
+		ErrorStats predict_stats, correct_stats;
+		size_t arc_tests = 0, arc_mismatches = 0;
+
+		cv::RNG rng(0);
+		cv::Mat webcam_sample, screen_sample;
+		cv::Mat reference_prediction, reference_view, reference_foreground, reference_shadow;
+		cv::Mat prediction_buffer;
+		Frame raw_frame, view, prediction, foreground_mask, shadow_mask;
+
+		const int session_frames = (session != nullptr) ? static_cast<int>(session->size()) : 0;
+		for(int i = 0; i < random_frames + session_frames; i++)
+		{
+			// Randomised frames come first, followed by the recording.
+			if(i < random_frames)
+				make_synthetic_frames(calibrator, rng, screen_sample, webcam_sample);
+			else if(!session->next(webcam_sample, screen_sample))
+				break;
+
+			webcam_sample.copyTo(raw_frame);
+
+			// Prediction
+			reference::predict(context, screen_sample, reference_prediction);
+			calibrator.predict(screen_sample, prediction_buffer);
+			predict_stats.add(reference_prediction, prediction_buffer);
+			prediction_buffer.copyTo(prediction);
+
+			// Correction
+			reference::correct(context, webcam_sample, reference_view);
+			calibrator.correct(raw_frame, view);
+			correct_stats.add(reference_view, view);
+
+			// Segmentation and tracking, where each variant starts from the 
+			// reference view so that its own error doesn't compound. 
+			reference_segmenter.segment(reference_view, reference_prediction, reference_foreground, reference_shadow);
+			reference_foreground.copyTo(foreground_mask);
+			reference_shadow.copyTo(shadow_mask);
+			const auto reference_fingertips = reference_tracker.detect(foreground_mask, shadow_mask);
+
+			for(auto& variant : variants)
+			{
+				if(variant.streamed)
+				{
+					variant.generator.correct_and_segment(
+						calibrator, raw_frame, prediction,
+						variant.view, variant.foreground_mask, variant.shadow_mask
+					);
+				}
+				else
+				{
+					reference_view.copyTo(variant.view);
+					variant.generator.segment(variant.view, prediction, variant.foreground_mask, variant.shadow_mask);
+				}
+
+				variant.foreground_stats.add(reference_foreground, variant.foreground_mask);
+				variant.shadow_stats.add(reference_shadow, variant.shadow_mask);
+				variant.fingertip_stats.add(reference_fingertips, variant.tracker.detect(variant.foreground_mask, variant.shadow_mask));
+			}
+
+			// Arc scores of every extremity on the reference contours.
+			std::vector<std::vector<cv::Point>> contours;
+			cv::findContours(reference_foreground, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+			for(const auto& contour : contours)
+			{
+				std::vector<int> extremities;
+				cv::convexHull(contour, extremities, false, false);
+				for(const auto index : extremities)
+				{
+					const auto expected = reference::arc_score(contour, index, cv::Rect(cv::Point(0, 0), output_size), scale);
+					if(reference_tracker.arc_score(contour, index) != expected)
+						arc_mismatches++;
+					arc_tests++;
+				}
+			}
+		}
+
+		// The prediction and arc scores have no reason to deviate, so must be exact.
+		bool passed = true;
+		const auto check = [&](const bool stage_passed) {
+			passed &= stage_passed;
+			return stage_passed;
+		};
+
+		stream << "Verification against reference kernels:\n";
+		predict_stats.report("Predict", check(predict_stats.exact()), stream);
+		correct_stats.report("Correct", check(correct_stats.within(VERIFY_CORRECT_MAX_ERROR)), stream);
+		for(const auto& variant : variants)
+		{
+			const auto& foreground = variant.foreground_stats;
+			const auto& shadow = variant.shadow_stats;
+			const auto& fingertips = variant.fingertip_stats;
+			foreground.report(
+				variant.name + " foreground",
+				check(foreground.within(VERIFY_MASK_MEAN_DISAGREEMENT, VERIFY_MASK_MAX_DISAGREEMENT)),
+				stream
+			);
+			shadow.report(
+				variant.name + " shadow",
+				check(shadow.within(VERIFY_MASK_MEAN_DISAGREEMENT, VERIFY_MASK_MAX_DISAGREEMENT)),
+				stream
+			);
+			fingertips.report(
+				variant.name + " fingertips",
+				check(fingertips.within(VERIFY_FINGERTIP_MAX_DISPLACEMENT * scale, VERIFY_FINGERTIP_MAX_UNMATCHED)),
+				stream
+			);
+		}
+		stream << cv::format(
+			"  %-32s %s  (%d of %d scores differ)\n",
+			"Arc score",
+			verdict(arc_mismatches == 0, check(arc_mismatches == 0)),
+			static_cast<int>(arc_mismatches),
+			static_cast<int>(arc_tests)
+		);
+
+		return passed;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	int run_verification(const int argc, const char* argv[])
+	{
+		const int frames = (argc >= 4) ? atoi(argv[3]) : 50;
+		const cv::Size output_resolution(CALIB_OUTPUT_WIDTH, CALIB_OUTPUT_HEIGHT);
+
+		// Verify with the calibration of the recorded session, if there is one.
+		auto session = (argc >= 3) ? SessionReader::TryOpen(argv[2]) : std::nullopt;
+		if(argc >= 3)
+		{
+			if(!session.has_value())
+				return -1;
+
+			std::cout << "Replaying " << session->size() << " recorded frames from: " << argv[2] << std::endl;
+		}
+
+		auto calibrator = session.has_value()
+			? std::optional<ViewCalibrator>(session->calibration())
+			: ViewCalibrator::TryLoad(CALIB_SAVE_PATH);
+
+		if(!calibrator.has_value())
+		{
+			std::cout << "No saved calibration found, using a synthetic calibration.\n";
+			calibrator.emplace(make_synthetic_calibration(cv::Size(WEBCAM_WIDTH, WEBCAM_HEIGHT), output_resolution));
+		}
+
+		// Verify with the tuned settings, as those are what will run.
+		const auto settings = PipelineSettings::TryLoad(SETTINGS_SAVE_PATH);
+		if(settings.has_value()
+		&& settings->output_resolution == calibrator->output_resolution()
+		&& settings->input_resolution == calibrator->input_resolution())
+		{
+			settings->apply();
+			calibrator->tune(*settings);
+		}
+
+		// The reference kernels are frozen at their own settings.
+		calibrator->tune(reference::settings(calibrator->settings()));
+
+		const bool passed = verify_pipeline(*calibrator, frames, session.has_value() ? &*session : nullptr, std::cout);
+		std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+
+		return passed ? 0 : 1;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
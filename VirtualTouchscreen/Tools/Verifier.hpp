@@ -0,0 +1,27 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <ostream>
+
+#include "Systems/ViewCalibrator.hpp"
+#include "Tools/Session.hpp"
+
+namespace vt
+{
+
+	// Runs the optimised kernels side by side with the frozen reference kernels,
+	// over randomised frames and an optional recorded session, and reports how 
+	// far each output deviates from its reference. Returns false if any output
+	// is not exact where it is meant to be, or deviates beyond its tolerance.
+	// NOTE: the calibrator must be tuned to the reference settings. 
+	bool verify_pipeline(
+		const ViewCalibrator& calibrator,
+		const int random_frames,
+		SessionReader* session,
+		std::ostream& stream
+	);
+
+	// Entry point for the command line verification.
+	int run_verification(const int argc, const char* argv[]);
+
+}
@@ -0,0 +1,95 @@
+#include "BackgroundSampler.hpp"
+
+namespace vt
+{
+
+	using namespace std::chrono;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void BackgroundSampler::configure(const cv::Size& resolution, const int stride)
+	{
+		CV_Assert(!m_Worker.running() && stride > 0);
+
+		m_SampleSize = cv::Size(
+			std::max(resolution.width / stride, 1),
+			std::max(resolution.height / stride, 1)
+		);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void BackgroundSampler::start(const int interval_ms, std::function<void(BackgroundSample&)> task)
+	{
+		CV_Assert(!m_SampleSize.empty());
+
+		m_Interval = milliseconds(interval_ms);
+		m_LastSample = steady_clock::now();
+		m_Worker.start(std::move(task));
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void BackgroundSampler::stop()
+	{
+		m_Worker.stop();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool BackgroundSampler::running() const
+	{
+		return m_Worker.running();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	const cv::Size& BackgroundSampler::sample_size() const
+	{
+		return m_SampleSize;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void BackgroundSampler::sample(
+		const Frame& view,
+		const Frame& prediction,
+		const Frame& foreground_mask,
+		const cv::Mat& screen,
+		const Frame& gain,
+		const Frame& offset
+	)
+	{
+		// Drop the sample if it isn't due, or the task is still busy with the last one.
+		if(steady_clock::now() - m_LastSample < m_Interval || !m_Worker.idle())
+			return;
+
+		// Any sample whose area touches the foreground is left out by the
+		// task, so that the edges of the hand don't leak into the models.
+		cv::resize(view, m_View, m_SampleSize, 0, 0, cv::INTER_NEAREST);
+		cv::resize(prediction, m_Prediction, m_SampleSize, 0, 0, cv::INTER_NEAREST);
+		cv::resize(foreground_mask, m_Mask, m_SampleSize, 0, 0, cv::INTER_AREA);
+		if(!gain.empty() && gain.size() == prediction.size())
+		{
+			cv::resize(gain, m_Gain, m_SampleSize, 0, 0, cv::INTER_NEAREST);
+			cv::resize(offset, m_Offset, m_SampleSize, 0, 0, cv::INTER_NEAREST);
+			cv::multiply(m_Prediction, m_Gain, m_Prediction);
+			cv::add(m_Prediction, m_Offset, m_Prediction);
+		}
+
+		// NOTE: cv::Mat is needed to transfer to the task's thread.
+		m_View.copyTo(m_Sample.view);
+		m_Prediction.copyTo(m_Sample.prediction);
+		m_Mask.copyTo(m_Sample.foreground_mask);
+		if(!screen.empty())
+			cv::resize(screen, m_Sample.screen, m_SampleSize, 0, 0, cv::INTER_NEAREST);
+		else
+			m_Sample.screen.release();
+
+		if(m_Worker.submit(m_Sample))
+			m_LastSample = steady_clock::now();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
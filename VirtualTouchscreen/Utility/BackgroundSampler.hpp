@@ -0,0 +1,66 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <chrono>
+
+#include "Utility/Common.hpp"
+#include "Utility/Worker.hpp"
+
+namespace vt
+{
+
+	// A sparse sample of the frames, where each pixel of the foreground mask
+	// is the fraction of the sample's area that was foreground. The screen is
+	// only sampled if it was given.
+	struct BackgroundSample
+	{
+		cv::Mat screen, view, prediction, foreground_mask;
+	};
+
+	// Takes sparse samples of the background at a limited rate and hands them
+	// over to a task on its own thread, for models which are fitted to the
+	// background while segmenting. This never blocks, so samples are dropped
+	// while the task is still busy with the last one.
+	class BackgroundSampler
+	{
+	public:
+
+		BackgroundSampler() = default;
+
+		// Samples every stride pixels of frames of the given resolution.
+		void configure(const cv::Size& resolution, const int stride);
+
+		void start(const int interval_ms, std::function<void(BackgroundSample&)> task);
+
+		// NOTE: does nothing if the sampler was never started.
+		void stop();
+
+		bool running() const;
+
+		const cv::Size& sample_size() const;
+
+		// Hands a sample of the frames over to the task, if one is due. The sampled
+		// prediction is corrected by the residual gain and offset, if they are given.
+		void sample(
+			const Frame& view,
+			const Frame& prediction,
+			const Frame& foreground_mask,
+			const cv::Mat& screen = cv::Mat(),
+			const Frame& gain = Frame(),
+			const Frame& offset = Frame()
+		);
+
+	private:
+		cv::Size m_SampleSize;
+		std::chrono::milliseconds m_Interval{0};
+		std::chrono::steady_clock::time_point m_LastSample;
+
+		// Main Thread Resources
+		Frame m_View, m_Prediction, m_Mask, m_Gain, m_Offset;
+		BackgroundSample m_Sample;
+
+		Worker<BackgroundSample> m_Worker;
+	};
+
+}
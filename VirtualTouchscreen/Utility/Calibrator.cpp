@@ -1,10 +1,19 @@
 #include "Calibrator.hpp"
 
+#include <thread>
+
 #include "../Configuration.hpp"
 
 namespace vt
 {
 
+	// Range of exposure levels that are searched, in log2 seconds. 
+	constexpr auto MIN_EXPOSURE_LEVEL = -13;
+	constexpr auto MAX_EXPOSURE_LEVEL = 0;
+
+	// Brightness at which the webcam clips, so that the response is unknown.
+	constexpr auto SATURATED_BRIGHTNESS = 254.0;
+
 //---------------------------------------------------------------------------------------------------------------------
 
 	void Calibrator::calibrate_exposure(
@@ -16,31 +25,15 @@ namespace vt
 	{
 		CV_Assert(brightness_target > 0 && brightness_target < 255);
 
-		auto& cam = webcam.raw();
-
-		// Lock the camera focus - assume it is already in focus. 
-		cam.set(cv::CAP_PROP_AUTOFOCUS, false);
-		cam.set(cv::CAP_PROP_FOCUS, cam.get(cv::CAP_PROP_FOCUS));
-
-		// Lock the camera white balance to neutral.
-		// NOTE: this is unsupported by all Windows backends. 
-		cam.set(cv::CAP_PROP_AUTO_WB, false);
-		cam.set(cv::CAP_PROP_WB_TEMPERATURE, 4500);
+		lock_camera(webcam);
 
-		// Disable auto-exposure and gain
-		cam.set(cv::CAP_PROP_AUTO_EXPOSURE, 0.25);
-		cam.set(cv::CAP_PROP_GAIN, 0);
-
-		// solve for the exposure which doesn't blow out the 
-		// projector. We do this by looking at the brightest
-		// pixel in the image each exposure level. 
-		int exposure_level = 0;
-		cv::UMat webcam_sample, intensity;
-		double min_brightness, max_brightness;
-		do
-		{
-			cam.set(cv::CAP_PROP_EXPOSURE, exposure_level--);
+		// Measures the brightest pixel in the image at an exposure level, 
+		// so that we find the exposure which doesn't blow out the projector. 
+		Frame webcam_sample, intensity;
+		const auto measure = [&](const int exposure_level) {
+			webcam.set(cv::CAP_PROP_EXPOSURE, exposure_level);
 
+			double min_brightness, max_brightness;
 			capture_colour(webcam, webcam_sample, cv::Scalar::all(255), webcam.latency_ms * 2, 3, window_name);
 			cv::cvtColor(webcam_sample, intensity, cv::COLOR_BGR2GRAY);
 			cv::minMaxLoc(intensity, &min_brightness, &max_brightness);
@@ -52,16 +45,74 @@ namespace vt
 					intensity
 				);
 			}
-		} while (max_brightness > brightness_target);
+			return max_brightness;
+		};
+
+		// Search for the longest exposure which meets the brightness target. The 
+		// exposure levels are in log2 seconds, so while the brightest pixel isn't
+		// saturated, the camera's response predicts how many levels to jump by.
+		// Otherwise we know nothing about the brightness, so bisect the range. 
+		int lower = MIN_EXPOSURE_LEVEL, upper = MAX_EXPOSURE_LEVEL;
+		int exposure_level = upper, set_level = upper;
+		while(lower < upper)
+		{
+			const double max_brightness = measure(exposure_level);
+			set_level = exposure_level;
+
+			const int predicted_level = exposure_level + static_cast<int>(
+				std::floor(std::log2(brightness_target / std::max(max_brightness, 1.0)))
+			);
+
+			if(max_brightness <= brightness_target)
+			{
+				// The next level up would be blown out if the response holds. 
+				lower = exposure_level;
+				if(predicted_level <= exposure_level)
+					upper = exposure_level;
+
+				exposure_level = std::clamp(predicted_level, lower + 1, std::max(upper, lower + 1));
+			}
+			else
+			{
+				upper = exposure_level - 1;
+				lower = std::min(lower, upper);
+
+				exposure_level = (max_brightness < SATURATED_BRIGHTNESS)
+					? std::clamp(predicted_level, lower, upper)
+					: lower + (upper - lower + 1) / 2;
+			}
+		}
+
+		// The search may have ended on a rejected level. 
+		if(set_level != lower)
+			webcam.set(cv::CAP_PROP_EXPOSURE, lower);
+
+		if(auto_destroy_window && webcam.rig() == nullptr) cv::destroyWindow(window_name);
+	}
 
-		if(auto_destroy_window) cv::destroyWindow(window_name);
+//---------------------------------------------------------------------------------------------------------------------
+
+	void Calibrator::lock_camera(Webcam& webcam)
+	{
+		// Lock the camera focus - assume it is already in focus. 
+		webcam.set(cv::CAP_PROP_AUTOFOCUS, false);
+		webcam.set(cv::CAP_PROP_FOCUS, webcam.get(cv::CAP_PROP_FOCUS));
+
+		// Lock the camera white balance to neutral.
+		// NOTE: this is unsupported by all Windows backends. 
+		webcam.set(cv::CAP_PROP_AUTO_WB, false);
+		webcam.set(cv::CAP_PROP_WB_TEMPERATURE, 4500);
+
+		// Disable auto-exposure and gain
+		webcam.set(cv::CAP_PROP_AUTO_EXPOSURE, 0.25);
+		webcam.set(cv::CAP_PROP_GAIN, 0);
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
 
 	void Calibrator::capture_colour(
 		Webcam& webcam,
-		cv::UMat& dst,
+		Frame& dst,
 		const cv::Scalar& colour,
 		const int settle_time_ms,
 		const int capture_samples,
@@ -94,7 +145,7 @@ namespace vt
 
 	void Calibrator::capture_image(
 		Webcam& webcam,
-		cv::UMat& dst,
+		Frame& dst,
 		const cv::Mat& image,
 		const int settle_time_ms,
 		const int capture_samples,
@@ -105,12 +156,7 @@ namespace vt
 		CV_Assert(settle_time_ms >= 0);
 		CV_Assert(capture_samples >= 1);
 
-		// Ensure the output window exists and is in fullscreen.
-		make_fullscreen_window(window_name);
-
-		// Show the image on the screen. 
-		cv::imshow(window_name, image);
-		cv::pollKey();
+		show_image(webcam, image, window_name);
 
 		// Sleep for the settle time.
 		std::this_thread::sleep_for(std::chrono::milliseconds(settle_time_ms));
@@ -142,7 +188,28 @@ namespace vt
 			//cv::imshow(std::to_string(i++), dst);
 		}
 
-		if (auto_destroy_window) cv::destroyWindow(window_name);
+		if (auto_destroy_window && webcam.rig() == nullptr) cv::destroyWindow(window_name);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void Calibrator::show_image(
+		Webcam& webcam,
+		const cv::Mat& image,
+		const std::string& window_name
+	)
+	{
+		// Show the image fullscreen on the screen, or on the virtual display.
+		if(auto* rig = webcam.rig(); rig != nullptr)
+		{
+			rig->display(image);
+		}
+		else
+		{
+			make_fullscreen_window(window_name);
+			cv::imshow(window_name, image);
+			cv::pollKey();
+		}
 	}
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -155,6 +222,10 @@ namespace vt
 		const bool auto_destroy_window
 	)
 	{
+		// There is nobody in front of a virtual rig to respond.
+		if(webcam.rig() != nullptr)
+			return;
+
 		// Ensure the feedback window exists and is in fullscreen.
 		auto window_region = make_fullscreen_window(window_name);
 		const cv::Size window_size = window_region.size();
@@ -171,7 +242,7 @@ namespace vt
 		const cv::Rect webcam_slot((window_size - webcam_size) / 2, webcam_size);
 
 		// Show the feedback to the user until they press any key. 
-		cv::UMat window_frame, webcam_frame, webcam_scaled_frame;
+		Frame window_frame, webcam_frame, webcam_scaled_frame;
 		window_frame.create(window_size, CV_8UC3);
 		while (cv::waitKey(webcam.latency_ms) == -1)
 		{
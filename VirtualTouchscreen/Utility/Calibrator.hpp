@@ -19,9 +19,13 @@ namespace vt
 			const bool auto_destroy_window = false
 		);
 
+		static void lock_camera(
+			Webcam& webcam
+		);
+
 		static void capture_colour(
 			Webcam& webcam,
-			cv::UMat& dst,
+			Frame& dst,
 			const cv::Scalar& colour,
 			const int settle_time_ms,
 			const int capture_samples,
@@ -31,7 +35,7 @@ namespace vt
 
 		static void capture_image(
 			Webcam& webcam,
-			cv::UMat& dst,
+			Frame& dst,
 			const cv::Mat& image,
 			const int settle_time_ms,
 			const int capture_samples,
@@ -39,6 +43,13 @@ namespace vt
 			const bool auto_destroy_window = false
 		);
 
+		// Shows the image fullscreen without waiting for it to be captured.
+		static void show_image(
+			Webcam& webcam,
+			const cv::Mat& image,
+			const std::string& window_name
+		);
+
 		static void show_feedback(
 			Webcam& webcam,
 			const cv::String& top_text,
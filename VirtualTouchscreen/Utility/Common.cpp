@@ -71,10 +71,10 @@ namespace vt
 	
 //---------------------------------------------------------------------------------------------------------------------
 
-	void imshow_2x1(const std::string& title, const cv::UMat& left, const cv::UMat& right)
+	void imshow_2x1(const std::string& title, const Frame& left, const Frame& right)
 	{
 		CV_Assert(left.type() == right.type());
-		thread_local cv::UMat container;
+		thread_local Frame container;
 		
 		container.create(
 			cv::Size(left.cols + right.cols, std::max(left.rows, right.rows)),
@@ -90,11 +90,11 @@ namespace vt
 
 	//---------------------------------------------------------------------------------------------------------------------
 
-	void imshow_3x1(const std::string& title, const cv::UMat& left, const cv::UMat& middle, const cv::UMat& right)
+	void imshow_3x1(const std::string& title, const Frame& left, const Frame& middle, const Frame& right)
 	{
 		CV_Assert(left.type() == middle.type());
 		CV_Assert(left.type() == right.type());
-		thread_local cv::UMat container;
+		thread_local Frame container;
 
 		container.create(
 			cv::Size(left.cols + middle.cols + right.cols, std::max(left.rows, std::max(right.rows, middle.rows))),
@@ -1,8 +1,16 @@
+#pragma once
+
 #include <opencv2/opencv.hpp>
+#include <type_traits>
+
+#include "Configuration.hpp"
 
 namespace vt
 {
 
+	// The frame type used throughout the pipeline.
+	using Frame = std::conditional_t<cpu_native_pipeline, cv::Mat, cv::UMat>;
+
 	cv::Mat make_chessboard(const cv::Size& size, const cv::Vec3b& colour_1, const cv::Vec3b& colour_2);
 
 	bool error_within(const float actual, const float sample, const float percentage_error);
@@ -19,9 +27,26 @@ namespace vt
 
 
 
-	void imshow_2x1(const std::string& title, const cv::UMat& left, const cv::UMat& right);
+	void imshow_2x1(const std::string& title, const Frame& left, const Frame& right);
+
+	void imshow_3x1(const std::string& title, const Frame& left, const Frame& middle, const Frame& right);
 
-	void imshow_3x1(const std::string& title, const cv::UMat& left, const cv::UMat& middle, const cv::UMat& right);
+
+
+	// Calls the kernel with its width known at compile time, for the common
+	// processing resolutions. Any other width falls back to the generic 
+	// kernel, which is given a width of zero and must use the runtime width.
+	template<typename K>
+	decltype(auto) dispatch_width(const int width, K&& kernel)
+	{
+		switch(width)
+		{
+			case 320:  return kernel(std::integral_constant<int, 320>{});
+			case 640:  return kernel(std::integral_constant<int, 640>{});
+			case 1280: return kernel(std::integral_constant<int, 1280>{});
+			default:   return kernel(std::integral_constant<int, 0>{});
+		}
+	}
 
 
 
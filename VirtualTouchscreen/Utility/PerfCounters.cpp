@@ -0,0 +1,203 @@
+#include "PerfCounters.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace vt
+{
+
+	// Stages which miss the cache this often per thousand instructions,
+	// while retiring fewer than one instruction per cycle, are assumed to 
+	// be stalled on memory rather than on their arithmetic. 
+	constexpr double MEMORY_BOUND_MPKI = 5.0;
+	constexpr double MEMORY_BOUND_IPC = 1.0;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	PerfCounters::Scope::Scope(PerfCounters& counters, const std::string& stage)
+		: m_Counters(counters),
+		  m_Stage(stage)
+	{
+		m_Start = counters.read();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	PerfCounters::Scope::~Scope()
+	{
+		if(m_Counters.valid())
+			m_Counters.record(m_Stage, m_Start, m_Counters.read());
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	PerfCounters::PerfCounters(const std::string& name, const bool enabled)
+		: m_Name(name)
+	{
+		m_Events.fill(-1);
+
+#ifdef __linux__
+		if(!enabled) return;
+
+		constexpr std::array<uint64_t, EVENT_COUNT> configs = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES
+		};
+
+		// The events are opened as a group, so that they are always scheduled
+		// together. Only user space is counted, which is allowed by the default
+		// perf_event_paranoid setting without any further privileges.
+		for(int e = 0; e < EVENT_COUNT; e++)
+		{
+			perf_event_attr attr = {};
+			attr.size = sizeof(perf_event_attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = configs[e];
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			attr.disabled = (e == 0) ? 1 : 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			m_Events[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, m_Events[0], 0));
+			if(m_Events[e] < 0)
+			{
+				std::cerr << "Failed to open hardware performance counters, check /proc/sys/kernel/perf_event_paranoid" << std::endl;
+				for(int o = 0; o < e; o++)
+					close(m_Events[o]);
+
+				m_Events.fill(-1);
+				return;
+			}
+		}
+		m_OpenEvents = EVENT_COUNT;
+
+		ioctl(m_Events[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(m_Events[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+		if(enabled)
+			std::cerr << "Hardware performance counters are only supported on Linux" << std::endl;
+#endif
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	PerfCounters::~PerfCounters()
+	{
+#ifdef __linux__
+		for(const int fd : m_Events)
+			if(fd >= 0) close(fd);
+#endif
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	bool PerfCounters::valid() const
+	{
+		return m_OpenEvents == EVENT_COUNT;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	PerfCounters::Scope PerfCounters::measure(const std::string& stage)
+	{
+		return Scope(*this, stage);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	PerfCounters::Sample PerfCounters::read() const
+	{
+		Sample sample = {};
+
+#ifdef __linux__
+		if(!valid()) return sample;
+
+		// Group layout: count, time enabled, time running, values...
+		std::array<uint64_t, 3 + EVENT_COUNT> buffer = {};
+		if(::read(m_Events[0], buffer.data(), sizeof(buffer)) != sizeof(buffer))
+			return sample;
+
+		// Scale the counts up if the group was multiplexed with other events.
+		const double scale = (buffer[2] > 0) ? static_cast<double>(buffer[1]) / static_cast<double>(buffer[2]) : 1.0;
+		for(int e = 0; e < EVENT_COUNT; e++)
+			sample[e] = static_cast<uint64_t>(buffer[3 + e] * scale);
+#endif
+
+		return sample;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void PerfCounters::record(const std::string& stage, const Sample& start, const Sample& end)
+	{
+		std::unique_lock lock(m_Mutex);
+
+		auto entry = std::find_if(m_Stages.begin(), m_Stages.end(), [&](const auto& s) {
+			return s.name == stage;
+		});
+		if(entry == m_Stages.end())
+			entry = m_Stages.insert(m_Stages.end(), {stage});
+
+		entry->count++;
+		for(int e = 0; e < EVENT_COUNT; e++)
+			entry->events[e] += (end[e] > start[e]) ? end[e] - start[e] : 0;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void PerfCounters::report(std::ostream& stream) const
+	{
+		if(!valid()) return;
+
+		std::unique_lock lock(m_Mutex);
+
+		stream << m_Name << " Counters:\n";
+		stream << cv::format(
+			"  %-20s %8s %12s %12s %6s %12s %12s  %s\n",
+			"Stage", "Count", "Cycles", "Instr", "IPC", "Cache MPKI", "Branch MPKI", "Bound"
+		);
+		for(const auto& stage : m_Stages)
+		{
+			const double count = static_cast<double>(std::max<uint64_t>(stage.count, 1));
+			const double cycles = static_cast<double>(stage.events[CYCLES]);
+			const double instructions = static_cast<double>(std::max<uint64_t>(stage.events[INSTRUCTIONS], 1));
+
+			const double ipc = instructions / std::max(cycles, 1.0);
+			const double cache_mpki = 1000.0 * stage.events[CACHE_MISSES] / instructions;
+			const double branch_mpki = 1000.0 * stage.events[BRANCH_MISSES] / instructions;
+			const bool memory_bound = ipc < MEMORY_BOUND_IPC && cache_mpki > MEMORY_BOUND_MPKI;
+
+			stream << cv::format(
+				"  %-20s %8d %12.0f %12.0f %6.2f %12.2f %12.2f  %s\n",
+				stage.name.c_str(),
+				static_cast<int>(stage.count),
+				cycles / count,
+				instructions / count,
+				ipc,
+				cache_mpki,
+				branch_mpki,
+				memory_bound ? "memory" : "compute"
+			);
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void PerfCounters::clear()
+	{
+		std::unique_lock lock(m_Mutex);
+		m_Stages.clear();
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <ostream>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <array>
+#include <mutex>
+
+namespace vt
+{
+
+	// Counts hardware events of named stages on the thread which 
+	// created the counters, using perf_event_open on Linux. 
+	// On other platforms the counters are never valid. 
+	// NOTE: work handed to the parallel_for_ workers or to OpenCL
+	// isn't seen by the thread's counters, so the tools which use
+	// them must run OpenCV single threaded on the CPU themselves.
+	class PerfCounters
+	{
+	public:
+
+		enum Event { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, EVENT_COUNT };
+
+		using Sample = std::array<uint64_t, EVENT_COUNT>;
+
+		// Counts a stage over the lifetime of the object.
+		class Scope
+		{
+		public:
+
+			Scope(PerfCounters& counters, const std::string& stage);
+
+			Scope(const Scope&) = delete;
+
+			~Scope();
+
+		private:
+			PerfCounters& m_Counters;
+			const std::string m_Stage;
+			Sample m_Start;
+		};
+
+	public:
+
+		PerfCounters(const std::string& name, const bool enabled = true);
+
+		PerfCounters(const PerfCounters&) = delete;
+
+		~PerfCounters();
+
+		bool valid() const;
+
+		Scope measure(const std::string& stage);
+
+		void record(const std::string& stage, const Sample& start, const Sample& end);
+
+		// Reports the events per stage, along with whether
+		// the stage is likely bound by memory or compute. 
+		void report(std::ostream& stream) const;
+
+		void clear();
+
+	private:
+
+		Sample read() const;
+
+		struct Stage
+		{
+			std::string name;
+			uint64_t count = 0;
+			Sample events = {};
+		};
+
+	private:
+		const std::string m_Name;
+
+		// File descriptors of the event group, the
+		// first of which is the leader of the group.
+		std::array<int, EVENT_COUNT> m_Events;
+		int m_OpenEvents = 0;
+
+		mutable std::mutex m_Mutex;
+		std::vector<Stage> m_Stages;
+	};
+
+}
@@ -0,0 +1,133 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+namespace vt
+{
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	Profiler::Phase::Phase(Profiler& profiler, const std::string& name)
+		: m_Profiler(profiler),
+		  m_Name(name),
+		  m_Start(Clock::now())
+	{}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	Profiler::Phase::~Phase()
+	{
+		m_Profiler.record(m_Name, m_Start, Clock::now());
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	Profiler::Profiler(const std::string& name)
+		: m_Name(name),
+		  m_Origin(Clock::now())
+	{}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	Profiler::Phase Profiler::measure(const std::string& name)
+	{
+		return Phase(*this, name);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void Profiler::record(const std::string& name, const Clock::time_point& start, const Clock::time_point& end)
+	{
+		std::unique_lock lock(m_Mutex);
+		m_Records.push_back({name, start, end, std::this_thread::get_id()});
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void Profiler::report(std::ostream& stream) const
+	{
+		using namespace std::chrono;
+		const auto to_ms = [](const Clock::duration& duration) {
+			return duration_cast<microseconds>(duration).count() / 1000.0f;
+		};
+
+		std::unique_lock lock(m_Mutex);
+
+		// Sort the phases by their start time, so that the
+		// report reads as a timeline of the profiled process.
+		auto records = m_Records;
+		std::sort(records.begin(), records.end(), [](const auto& a, const auto& b) {
+			return a.start < b.start;
+		});
+
+		// Label threads in the order that they first appear.
+		std::vector<std::thread::id> threads;
+		float total_ms = 0.0f, sum_ms = 0.0f;
+
+		stream << m_Name << " Profile:\n";
+		for(const auto& record : records)
+		{
+			auto thread = std::find(threads.begin(), threads.end(), record.thread);
+			if(thread == threads.end())
+				thread = threads.insert(threads.end(), record.thread);
+
+			const float start_ms = to_ms(record.start - m_Origin);
+			const float duration_ms = to_ms(record.end - record.start);
+			total_ms = std::max(total_ms, to_ms(record.end - m_Origin));
+			sum_ms += duration_ms;
+
+			stream << cv::format(
+				"  [+%8.1fms] %-28s %8.1fms  (thread %d)\n",
+				start_ms, record.name.c_str(), duration_ms, static_cast<int>(thread - threads.begin())
+			);
+		}
+
+		// The difference between the total and sum shows the
+		// time saved by running the phases concurrently.
+		stream << cv::format("  Total: %.1fms, Sum of Phases: %.1fms\n", total_ms, sum_ms);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void Profiler::summarize(std::ostream& stream) const
+	{
+		using namespace std::chrono;
+
+		std::unique_lock lock(m_Mutex);
+
+		// Group the phase durations by name, in order of first appearance.
+		std::vector<std::pair<std::string, std::vector<float>>> phases;
+		for(const auto& record : m_Records)
+		{
+			auto phase = std::find_if(phases.begin(), phases.end(), [&](const auto& p) {
+				return p.first == record.name;
+			});
+			if(phase == phases.end())
+				phase = phases.insert(phases.end(), {record.name, {}});
+
+			phase->second.push_back(duration_cast<microseconds>(record.end - record.start).count() / 1000.0f);
+		}
+
+		stream << m_Name << " Summary:\n";
+		stream << cv::format("  %-28s %8s %8s %8s %8s %8s\n", "Phase", "Count", "Mean", "Median", "P95", "Max");
+		for(auto& [name, durations] : phases)
+		{
+			std::sort(durations.begin(), durations.end());
+			const float mean = std::accumulate(durations.begin(), durations.end(), 0.0f) / durations.size();
+
+			stream << cv::format(
+				"  %-28s %8d %6.2fms %6.2fms %6.2fms %6.2fms\n",
+				name.c_str(),
+				static_cast<int>(durations.size()),
+				mean,
+				durations[durations.size() / 2],
+				durations[(durations.size() * 95) / 100],
+				durations.back()
+			);
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <ostream>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include <mutex>
+
+namespace vt
+{
+
+	// Records the wall time of named phases, which may
+	// overlap when they are run on different threads.
+	class Profiler
+	{
+	public:
+
+		using Clock = std::chrono::high_resolution_clock;
+
+		// Measures a phase over the lifetime of the object.
+		class Phase
+		{
+		public:
+
+			Phase(Profiler& profiler, const std::string& name);
+
+			Phase(const Phase&) = delete;
+
+			~Phase();
+
+		private:
+			Profiler& m_Profiler;
+			const std::string m_Name;
+			const Clock::time_point m_Start;
+		};
+
+	public:
+
+		Profiler(const std::string& name);
+
+		Phase measure(const std::string& name);
+
+		void record(const std::string& name, const Clock::time_point& start, const Clock::time_point& end);
+
+		// Reports each phase as a timeline.
+		void report(std::ostream& stream) const;
+
+		// Reports statistics over repeated phases of the same name. 
+		void summarize(std::ostream& stream) const;
+
+	private:
+
+		struct Record
+		{
+			std::string name;
+			Clock::time_point start, end;
+			std::thread::id thread;
+		};
+
+	private:
+		const std::string m_Name;
+		const Clock::time_point m_Origin;
+
+		mutable std::mutex m_Mutex;
+		std::vector<Record> m_Records;
+	};
+
+}
@@ -0,0 +1,92 @@
+#include "Settings.hpp"
+
+#include <iostream>
+
+namespace vt
+{
+
+	// Version of the saved settings, which must be raised whenever what is saved changes.
+	// Settings of any other version are rejected, so that they are tuned again.
+	constexpr auto SETTINGS_FORMAT_VERSION = 1;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	std::optional<PipelineSettings> PipelineSettings::TryLoad(const std::string& path)
+	{
+		try
+		{
+			cv::FileStorage file(path, cv::FileStorage::READ);
+			if(!file.isOpened())
+				return std::nullopt;
+
+			int version = 0;
+			file["format_version"] >> version;
+			if(version != SETTINGS_FORMAT_VERSION)
+			{
+				std::cerr << "Ignoring settings of another version: " << path << std::endl;
+				return std::nullopt;
+			}
+
+			PipelineSettings settings;
+			file["input_resolution"] >> settings.input_resolution;
+			file["output_resolution"] >> settings.output_resolution;
+			file["worker_threads"] >> settings.worker_threads;
+			file["predict_tile_rows"] >> settings.predict_tile_rows;
+			file["correct_tile_rows"] >> settings.correct_tile_rows;
+			file["correct_interpolation"] >> settings.correct_interpolation;
+			file["noise_offset"] >> settings.noise_offset;
+			file["erode_iterations"] >> settings.erode_iterations;
+			file["dilate_iterations"] >> settings.dilate_iterations;
+			file["arc_test_length"] >> settings.arc_test_length;
+			file["prediction_delay"] >> settings.prediction_delay;
+			settings.correct_fixed_point = static_cast<int>(file["correct_fixed_point"]) != 0;
+
+			if(settings.input_resolution.empty() || settings.output_resolution.empty() || settings.prediction_delay < 1
+			|| settings.erode_iterations < 0 || settings.dilate_iterations < 0 || settings.arc_test_length < 1)
+			{
+				std::cerr << "Ignoring invalid settings: " << path << std::endl;
+				return std::nullopt;
+			}
+
+			return settings;
+		}
+		catch(const cv::Exception& e)
+		{
+			std::cerr << "Failed to load settings: " << e.what() << std::endl;
+			return std::nullopt;
+		}
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void PipelineSettings::save(const std::string& path) const
+	{
+		cv::FileStorage file(path, cv::FileStorage::WRITE);
+		CV_Assert(file.isOpened());
+
+		file << "format_version" << SETTINGS_FORMAT_VERSION;
+		file << "input_resolution" << input_resolution;
+		file << "output_resolution" << output_resolution;
+		file << "worker_threads" << worker_threads;
+		file << "predict_tile_rows" << predict_tile_rows;
+		file << "correct_tile_rows" << correct_tile_rows;
+		file << "correct_interpolation" << correct_interpolation;
+		file << "correct_fixed_point" << static_cast<int>(correct_fixed_point);
+		file << "noise_offset" << noise_offset;
+		file << "erode_iterations" << erode_iterations;
+		file << "dilate_iterations" << dilate_iterations;
+		file << "arc_test_length" << arc_test_length;
+		file << "prediction_delay" << prediction_delay;
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+	void PipelineSettings::apply() const
+	{
+		// NOTE: a negative thread count resets OpenCV to its default.
+		cv::setNumThreads(worker_threads > 0 ? worker_threads : -1);
+	}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <optional>
+#include <string>
+
+#include "Configuration.hpp"
+
+namespace vt
+{
+
+	// Runtime settings of the pipeline, which are tuned to
+	// the machine and stored alongside the calibration.
+	struct PipelineSettings
+	{
+		// Resolutions the settings were tuned for.
+		cv::Size input_resolution;
+		cv::Size output_resolution;
+
+		// Parallelism, where zero leaves it up to OpenCV.
+		int worker_threads = 0;
+		int predict_tile_rows = 0;
+		int correct_tile_rows = 0;
+
+		// Interpolation used to correct webcam frames, and whether it
+		// reads the fixed-point form of the correction map. 
+		int correct_interpolation = cv::INTER_CUBIC;
+		bool correct_fixed_point = true;
+
+		// Segmentation and tracking parameters, which trade
+		// accuracy for latency and are specific to each site. 
+		// The morphology is only lowered by a sweep of the site,
+		// as it also removes more than the webcam noise.
+		int noise_offset = 15;
+		int erode_iterations = 2;
+		int dilate_iterations = 2;
+		int arc_test_length = 450;
+		int prediction_delay = ::prediction_delay;
+
+
+		static std::optional<PipelineSettings> TryLoad(const std::string& path);
+
+		void save(const std::string& path) const;
+
+		// Applies the settings which are global to the process.
+		void apply() const;
+	};
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace vt
+{
+
+	// Runs a task on its own thread over the latest input handed to it. Handing
+	// an input over never waits on the task, so inputs are dropped while the
+	// task is still busy with the last one.
+	template<typename T>
+	class Worker
+	{
+	public:
+
+		Worker() = default;
+
+		Worker(const Worker&) = delete;
+
+		~Worker()
+		{
+			stop();
+		}
+
+		void start(std::function<void(T&)> task)
+		{
+			CV_Assert(!m_Thread.joinable());
+
+			m_Task = std::move(task);
+			m_Pending = false;
+			m_Runflag = true;
+			m_Thread = std::thread(&Worker::process, this);
+		}
+
+		// NOTE: does nothing if the worker was never started.
+		void stop()
+		{
+			if(!m_Thread.joinable())
+				return;
+
+			{
+				std::unique_lock lock(m_Mutex);
+				m_Runflag = false;
+			}
+			m_Signal.notify_one();
+			m_Thread.join();
+		}
+
+		bool running() const
+		{
+			return m_Thread.joinable();
+		}
+
+		// Whether the task could take a new input.
+		bool idle()
+		{
+			std::unique_lock lock(m_Mutex, std::try_to_lock);
+			return lock.owns_lock() && m_Runflag && !m_Pending;
+		}
+
+		// Hands the input over to the task by swapping it with an old input,
+		// so no data is copied. Returns false if the input was dropped.
+		bool submit(T& input)
+		{
+			{
+				std::unique_lock lock(m_Mutex);
+				if(!m_Runflag || m_Pending)
+					return false;
+
+				std::swap(input, m_Input);
+				m_Pending = true;
+			}
+			m_Signal.notify_one();
+			return true;
+		}
+
+	private:
+
+		void process()
+		{
+			T input;
+			while(true)
+			{
+				{
+					std::unique_lock lock(m_Mutex);
+					m_Signal.wait(lock, [&](){ return m_Pending || !m_Runflag; });
+					if(!m_Runflag) return;
+
+					// NOTE: the input stays pending until the task is
+					// done with it, so any new inputs are dropped.
+					std::swap(input, m_Input);
+				}
+
+				m_Task(input);
+
+				{
+					std::unique_lock lock(m_Mutex);
+					m_Pending = false;
+				}
+			}
+		}
+
+	private:
+		std::function<void(T&)> m_Task;
+		std::thread m_Thread;
+		std::mutex m_Mutex;
+		std::condition_variable m_Signal;
+		T m_Input;
+		bool m_Pending = false;
+		bool m_Runflag = false;
+	};
+
+}